@@ -0,0 +1,1609 @@
+//Benchmarks for the hot paths: variations, flame functions, FlameCalculator thread scaling, snapshots, merging and
+//resolving. Results are written as JSON to stdout (or --out FILE), progress goes to stderr.
+//
+//Some results are checks with a limit (the accuracy of the fast math for example). The exit code is 1 if any check
+//failed, so the benchmark doubles as a regression test.
+//
+//Usage: flames_bench [--filter TEXT] [--min-time SECONDS] [--threads N] [--size N] [--out FILE]
+
+#include "CompiledGenome.h"
+#include "Convergence.h"
+#include "FlameBatch.h"
+#include "FlameCalculator.h"
+#include "FlameFunctions.h"
+#include "GenomeFile.h"
+#include "GenomeHandle.h"
+#include "HeadlessRenderer.h"
+#include "HistogramFile.h"
+#include "OutOfCoreHistogram.h"
+#include "PlanarHistogram.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace flame;
+
+namespace
+{
+   struct BenchOptions
+   {
+      //! \brief Minimum time that each measurement runs for
+      double minSeconds = 0.5;
+      size_t maxThreads = HardwareThreads();
+      //! \brief Output edge length in pixels for the calculator, snapshot, merge and resolve benchmarks
+      size_t imageSize = 1024;
+      std::string filter;
+      std::string outPath;
+   };
+
+   struct BenchResult
+   {
+      std::string name;
+      double value;
+      std::string unit;
+      //! \brief Only for checks, which pass if value <= limit
+      bool isCheck;
+      double limit;
+
+      bool Passed() const { return !isCheck || value <= limit; }
+   };
+
+   class BenchSuite
+   {
+   public:
+      explicit BenchSuite( const BenchOptions& options ) :
+         _options( options )
+      {
+      }
+
+      const BenchOptions& GetOptions() const { return _options; }
+
+      bool IsEnabled( const std::string& name ) const
+      {
+         return _options.filter.empty() || name.find( _options.filter ) != std::string::npos;
+      }
+
+      void Add( const std::string& name, double value, const std::string& unit )
+      {
+         std::cerr << name << ": " << value << " " << unit << std::endl;
+         _results.push_back( { name, value, unit, false, 0.0 } );
+      }
+
+      //! \brief Adds a result that fails if it exceeds the limit
+      void AddCheck( const std::string& name, double value, double limit, const std::string& unit )
+      {
+         std::cerr << name << ": " << value << " " << unit << " (limit " << limit << ( value <= limit ? ", passed)" : ", FAILED)" )
+            << std::endl;
+         _results.push_back( { name, value, unit, true, limit } );
+      }
+
+      bool HasFailedChecks() const
+      {
+         return std::any_of( _results.begin(), _results.end(), []( const BenchResult& result ) { return !result.Passed(); } );
+      }
+
+      void WriteJson( std::ostream& stream ) const
+      {
+         stream << "{\n";
+         stream << "  \"simd\": \"" << GetBatchKernels().name << "\",\n";
+         stream << "  \"hardware_threads\": " << HardwareThreads() << ",\n";
+         stream << "  \"image_size\": " << _options.imageSize << ",\n";
+         stream << "  \"results\": [\n";
+         for ( size_t idx = 0; idx < _results.size(); idx++ )
+         {
+            const auto& result = _results[idx];
+            stream << "    { \"name\": \"" << result.name << "\", \"value\": " << result.value << ", \"unit\": \""
+               << result.unit << "\"";
+            if ( result.isCheck ) stream << ", \"limit\": " << result.limit << ", \"passed\": " << ( result.Passed() ? "true" : "false" );
+            stream << " }" << ( idx + 1 < _results.size() ? "," : "" ) << "\n";
+         }
+         stream << "  ]\n";
+         stream << "}\n";
+      }
+
+   private:
+      BenchOptions _options;
+      std::vector<BenchResult> _results;
+   };
+
+   using Clock_t = std::chrono::high_resolution_clock;
+
+   double SecondsSince( Clock_t::time_point start )
+   {
+      return std::chrono::duration<double>( Clock_t::now() - start ).count();
+   }
+
+   //! \brief Calls func repeatedly until minSeconds passed, after one warm up call
+   //! \returns Average seconds per call
+   template<typename Func>
+   double TimePerCall( double minSeconds, Func&& func )
+   {
+      func();
+      size_t calls = 0;
+      const auto start = Clock_t::now();
+      double elapsed;
+      do
+      {
+         func();
+         calls++;
+         elapsed = SecondsSince( start );
+      } while ( elapsed < minSeconds );
+      return elapsed / calls;
+   }
+
+   //! \brief Keeps the optimizer from removing computations whose result is otherwise unused
+   volatile float Sink;
+
+   //! \brief Seed of all random inputs, so that every run measures the same data
+   constexpr uint64_t BenchSeed = 1;
+
+   void FillRandom( SimpleHistogram_t& histogram, Xoshiro128& rnd )
+   {
+      for ( size_t idx = 0; idx < histogram.GetWidth() * histogram.GetHeight(); idx++ )
+      {
+         //Roughly a quarter of the entries stay empty, like the background of a typical flame
+         auto& entry = histogram[idx];
+         entry.count = ( rnd() & 3 ) ? rnd() % 1024 : 0;
+         entry.color = entry.count ? RandomColor<Color3_8>( rnd ) : Color3_8();
+      }
+   }
+
+   template<typename _Layout>
+   void FillRandom( PlanarHistogram<_Layout>& histogram, Xoshiro128& rnd )
+   {
+      for ( size_t y = 0; y < histogram.GetHeight(); y++ )
+      {
+         for ( size_t x = 0; x < histogram.GetWidth(); x++ )
+         {
+            const auto idx = histogram.GetLayout().GetIndex( x, y );
+            const auto count = ( rnd() & 3 ) ? rnd() % 1024 : 0;
+            const auto color = RandomColor<Color3_8>( rnd );
+            histogram.GetCounts()[idx] = count;
+            histogram.GetColorSums( 0 )[idx] = static_cast<uint64_t>( count ) * color.r;
+            histogram.GetColorSums( 1 )[idx] = static_cast<uint64_t>( count ) * color.g;
+            histogram.GetColorSums( 2 )[idx] = static_cast<uint64_t>( count ) * color.b;
+         }
+      }
+      histogram.ScanOccupied();
+   }
+
+   //! \brief Adds a hit the way FlameCalculator did before the planar histogram, for comparison
+   void AddHit( SimpleHistogram_t& histogram, size_t x, size_t y, const Color3_8& color )
+   {
+      auto& entry = histogram[{ x, y }];
+      entry.count++;
+      entry.color = entry.color.BlendWith( color, 0.5f );
+   }
+
+   template<typename _Layout>
+   void AddHit( PlanarHistogram<_Layout>& histogram, size_t x, size_t y, const Color3_8& color )
+   {
+      histogram.Add( x, y, color );
+   }
+
+   FlameFunctionSet MakeBenchGenome( SymmetryMode symmetryMode = SymmetryMode::Functions )
+   {
+      FlameFunctionSet ffs;
+      ffs.AddFunction( FlameFunction( { Variations::Linear }, { Coefficients::Build( 0.3f, 0, 0, 0, 0.3f, 0 ) }, { 1.f }, Color3_8( 138, 43, 226 ) ), 0.33f );
+      ffs.AddFunction( FlameFunction( { Variations::Heart, Variations::Sinusoidal },
+                                      { Coefficients::Build( 0.3f, 0, 0, 0, 0.3f, 0.5f ), Coefficients::Build( 0.3f, 0.3f, 0.2f, 0.3f, 0.7f, 0.4f ) },
+                                      { 0.8f, 0.2f }, Color3_8( 153, 50, 204 ) ), 0.33f );
+      ffs.AddFunction( FlameFunction( { Variations::Spherical }, { Coefficients::Build( 0.3f, 0, 0.5f, 0, 0.3f, 0 ) }, { 1.f }, Color3_8( 255, 105, 180 ) ), 0.33f );
+      ffs.AddSymmetries( { Symmetry::Rotate72 }, symmetryMode );
+      return ffs;
+   }
+
+   const std::vector<std::pair<const char*, Variations::Func_t>>& AllVariations()
+   {
+      static const std::vector<std::pair<const char*, Variations::Func_t>> variations = {
+         { "Linear", Variations::Linear },
+         { "Spherical", Variations::Spherical },
+         { "Sinusoidal", Variations::Sinusoidal },
+         { "Swirl", Variations::Swirl },
+         { "Heart", Variations::Heart }
+      };
+      return variations;
+   }
+
+   //! \brief Every variation on its own: through the Func_t pointer, and through the batch kernels of every
+   //!        instruction set that this CPU supports, in both precisions
+   void BenchVariations( BenchSuite& suite )
+   {
+      constexpr size_t Points = 4096;
+      Xoshiro128 rnd( BenchSeed );
+      std::vector<float> xs( Points ), ys( Points ), accX( Points ), accY( Points );
+      for ( size_t idx = 0; idx < Points; idx++ )
+      {
+         xs[idx] = ToMinusOneOne( rnd() );
+         ys[idx] = ToMinusOneOne( rnd() );
+      }
+      const auto coefficients = Coefficients::Build( 0.9f, 0.1f, 0.05f, -0.1f, 0.9f, 0.02f );
+
+      std::vector<const BatchKernels*> kernelSets;
+      for ( auto precision : { MathPrecision::Exact, MathPrecision::Fast } )
+      {
+         for ( auto level : { simd::SimdLevel::Scalar, simd::SimdLevel::Sse2, simd::SimdLevel::Avx2 } )
+         {
+            const auto& kernels = GetBatchKernels( level, precision );
+            if ( kernels.level == level ) kernelSets.push_back( &kernels );
+         }
+      }
+
+      for ( const auto& variation : AllVariations() )
+      {
+         const auto pointerName = std::string( "variation/" ) + variation.first + "/pointer";
+         if ( suite.IsEnabled( pointerName ) )
+         {
+            auto func = variation.second;
+            const auto seconds = TimePerCall( suite.GetOptions().minSeconds, [&]()
+            {
+               const auto& c = coefficients;
+               auto sum = 0.f;
+               for ( size_t idx = 0; idx < Points; idx++ )
+               {
+                  auto p = func( { xs[idx] * c.a + ys[idx] * c.b + c.c, xs[idx] * c.d + ys[idx] * c.e + c.f } );
+                  sum += p.x + p.y;
+               }
+               Sink = sum;
+            } );
+            suite.Add( pointerName, Points / seconds, "iterations/s" );
+         }
+
+         for ( auto kernels : kernelSets )
+         {
+            const auto name = std::string( "variation/" ) + variation.first + "/" + kernels->name;
+            if ( !suite.IsEnabled( name ) ) continue;
+
+            auto kernel = kernels->Find( variation.second );
+            const auto seconds = TimePerCall( suite.GetOptions().minSeconds, [&]()
+            {
+               kernel( xs.data(), ys.data(), accX.data(), accY.data(), Points, coefficients, 1.f );
+            } );
+            Sink = accX[0];
+            suite.Add( name, Points / seconds, "iterations/s" );
+         }
+      }
+   }
+
+   //! \brief Applies a function to a point over and over
+   //! \returns Iterations per second
+   template<typename Function>
+   double IterateFunction( double minSeconds, const Function& function )
+   {
+      constexpr size_t Iterations = 1 << 16;
+      const auto seconds = TimePerCall( minSeconds, [&]()
+      {
+         cv::Point2f point( 0.1f, 0.2f );
+         for ( size_t it = 0; it < Iterations; it++ )
+         {
+            point = function( point );
+            //Restart escaped points, otherwise the benchmark measures NaN arithmetic
+            if ( !std::isfinite( point.x ) || !std::isfinite( point.y ) ) point = { 0.1f, 0.2f };
+         }
+         Sink = point.x;
+      } );
+      return Iterations / seconds;
+   }
+
+   //! \brief FlameFunction::operator() and the CompiledFunction with an increasing number of variations
+   void BenchFunctionComplexity( BenchSuite& suite )
+   {
+      const Variations::Func_t funcs[] = { Variations::Sinusoidal, Variations::Swirl, Variations::Spherical, Variations::Heart };
+      const auto c = Coefficients::Build( 0.5f, 0.1f, 0.1f, -0.1f, 0.5f, 0.1f );
+      const std::vector<FlameFunction> functions = {
+         FlameFunction( { funcs[0] }, { c }, { 1.f } ),
+         FlameFunction( { funcs[0], funcs[1] }, { c, c }, { 0.5f, 0.5f } ),
+         FlameFunction( { funcs[0], funcs[1], funcs[2] }, { c, c, c }, { 0.4f, 0.3f, 0.3f } ),
+         FlameFunction( { funcs[0], funcs[1], funcs[2], funcs[3] }, { c, c, c, c }, { 0.25f, 0.25f, 0.25f, 0.25f } )
+      };
+
+      for ( size_t idx = 0; idx < functions.size(); idx++ )
+      {
+         const auto name = "function/variations_" + std::to_string( idx + 1 );
+         if ( suite.IsEnabled( name ) ) suite.Add( name, IterateFunction( suite.GetOptions().minSeconds, functions[idx] ), "iterations/s" );
+
+         const auto compiledName = "function/compiled_variations_" + std::to_string( idx + 1 );
+         if ( suite.IsEnabled( compiledName ) )
+         {
+            const CompiledFunction compiled( functions[idx] );
+            suite.Add( compiledName, IterateFunction( suite.GetOptions().minSeconds, compiled ), "iterations/s" );
+         }
+      }
+   }
+
+   //! \brief Largest error of an approximation against the double precision reference, on evenly spaced points
+   //! \param relative Divides the error by the magnitude of the reference
+   template<typename Approx, typename Reference>
+   double MaxError( float from, float to, const Approx& approx, const Reference& reference, bool relative )
+   {
+      constexpr size_t Steps = 1 << 20;
+      double maxError = 0.0;
+      for ( size_t step = 0; step <= Steps; step++ )
+      {
+         const auto v = from + ( to - from ) * static_cast<float>( step ) / Steps;
+         const auto expected = reference( static_cast<double>( v ) );
+         const auto error = std::abs( approx( v ) - expected );
+         maxError = std::max( maxError, relative ? error / std::abs( expected ) : error );
+      }
+      return maxError;
+   }
+
+#ifdef FLAME_SIMD_SSE2
+   //The hardware estimates only differ from exact results on vectors
+   using MathVec_t = simd::VecSse;
+#else
+   using MathVec_t = simd::VecScalar;
+#endif
+
+   //! \brief Evaluates a vector function for a single value
+   template<MathVec_t( *Function )( const MathVec_t& )>
+   float OnLanes( float v )
+   {
+      float lanes[MathVec_t::Width];
+      MathVec_t::Store( lanes, Function( MathVec_t::Broadcast( v ) ) );
+      return lanes[0];
+   }
+
+   //! \brief Accuracy of the fast math functions, checked against the bounds that FastMath.h documents
+   void BenchMath( BenchSuite& suite )
+   {
+      struct ErrorCheck
+      {
+         const char* name;
+         float from, to;
+         float( *approx )( float );
+         double( *reference )( double );
+         bool relative;
+         double limit;
+      };
+      const ErrorCheck checks[] = {
+         { "reciprocal", 1e-3f, 1e3f, OnLanes<fastmath::Reciprocal<MathVec_t>>, []( double v ) { return 1.0 / v; }, true, 5e-7 },
+         { "sqrt", 1e-3f, 1e3f, OnLanes<fastmath::Sqrt<MathVec_t>>, []( double v ) { return std::sqrt( v ); }, true, 5e-7 },
+         { "sin", -1024.f, 1024.f, OnLanes<fastmath::Sin<MathVec_t>>, []( double v ) { return std::sin( v ); }, false, 4e-6 },
+         { "cos", -1024.f, 1024.f, OnLanes<fastmath::Cos<MathVec_t>>, []( double v ) { return std::cos( v ); }, false, 4e-6 },
+         { "atan", -100.f, 100.f, OnLanes<fastmath::Atan<MathVec_t>>, []( double v ) { return std::atan( v ); }, false, 5e-5 },
+         //Beyond the range of the fast reduction both have to follow the exact path, e.g. for the r^2 of swirl
+         { "sin_large", -1e9f, 1e9f, OnLanes<fastmath::Sin<MathVec_t>>,
+           []( double v ) { return static_cast<double>( OnLanes<simd::Sin<MathVec_t>>( static_cast<float>( v ) ) ); }, false, 4e-6 },
+         { "cos_large", -1e9f, 1e9f, OnLanes<fastmath::Cos<MathVec_t>>,
+           []( double v ) { return static_cast<double>( OnLanes<simd::Cos<MathVec_t>>( static_cast<float>( v ) ) ); }, false, 4e-6 },
+         { "sin_large_scalar", -1e9f, 1e9f, []( float v ) { return fastmath::Sin( simd::VecScalar::Broadcast( v ) ).v; },
+           []( double v ) { return std::sin( static_cast<double>( static_cast<float>( v ) ) ); }, false, 4e-6 }
+      };
+      for ( const auto& check : checks )
+      {
+         const auto name = std::string( "math/fast_" ) + check.name + "_max_error";
+         if ( !suite.IsEnabled( name ) ) continue;
+         suite.AddCheck( name, MaxError( check.from, check.to, check.approx, check.reference, check.relative ), check.limit,
+                         check.relative ? "relative" : "absolute" );
+      }
+   }
+
+   //! \brief Normalized hit counts of a coarse grid over a histogram
+   std::vector<double> CoarseDensity( const FlameHistogram_t& histogram, size_t cells )
+   {
+      std::vector<double> density( cells * cells, 0.0 );
+      double total = 0.0;
+      for ( size_t y = 0; y < histogram.GetHeight(); y++ )
+      {
+         for ( size_t x = 0; x < histogram.GetWidth(); x++ )
+         {
+            const auto count = histogram.GetCount( x, y );
+            density[( y * cells / histogram.GetHeight() ) * cells + x * cells / histogram.GetWidth()] += count;
+            total += count;
+         }
+      }
+      for ( auto& d : density ) d /= std::max( total, 1.0 );
+      return density;
+   }
+
+   double TotalVariationDistance( const std::vector<double>& p, const std::vector<double>& q )
+   {
+      double sum = 0.0;
+      for ( size_t idx = 0; idx < p.size(); idx++ ) sum += std::abs( p[idx] - q[idx] );
+      return sum / 2.0;
+   }
+
+   //! \brief Renders the bench genome with the fast batch kernels and twice with the exact ones, with the same
+   //!        budget. The distance between the fast and the exact density has to be within the noise of the chaos
+   //!        game, which the distance between the two exact renders shows
+   void BenchMathDensity( BenchSuite& suite )
+   {
+      constexpr size_t Size = 256;
+      constexpr size_t Cells = 32;
+      constexpr uint64_t Budget = 1 << 23;
+      const auto genome = MakeBenchGenome();
+
+      const std::string name = "math/fast_density_tv";
+      if ( !suite.IsEnabled( name ) ) return;
+
+      auto render = [&]( MathPrecision precision )
+      {
+         FlameCalculator calculator( genome, Size, Size, 1, IterationMode::Batch, ScatterMode::Auto, precision );
+         calculator.Start( Budget );
+         calculator.Wait();
+         FlameHistogram_t histogram( Size, Size );
+         calculator.Flush( histogram );
+         return CoarseDensity( histogram, Cells );
+      };
+      const auto exact = render( MathPrecision::Exact );
+      const auto noise = TotalVariationDistance( exact, render( MathPrecision::Exact ) );
+      const auto fast = TotalVariationDistance( exact, render( MathPrecision::Fast ) );
+      suite.AddCheck( name, fast, 2.0 * noise + 0.005, "tv_distance" );
+   }
+
+   //! \brief Throughput of the generators and of the conversions to floats. Also checks that two renders with the same
+   //!        seed have identical histograms, in both iteration modes
+   void BenchRandom( BenchSuite& suite )
+   {
+      const auto& options = suite.GetOptions();
+      constexpr size_t Numbers = 1 << 16;
+      std::vector<uint32_t> numbers( Numbers );
+      std::vector<float> floats( Numbers );
+
+      if ( suite.IsEnabled( "rng/xoshiro128/scalar" ) )
+      {
+         Xoshiro128 rnd( BenchSeed );
+         const auto seconds = TimePerCall( options.minSeconds, [&]()
+         {
+            for ( auto& number : numbers ) number = rnd();
+         } );
+         suite.Add( "rng/xoshiro128/scalar", Numbers / seconds, "numbers/s" );
+      }
+
+      if ( suite.IsEnabled( "rng/xoshiro128/lanes_8" ) )
+      {
+         Xoshiro128Lanes<8> rnd( BenchSeed, 0 );
+         const auto seconds = TimePerCall( options.minSeconds, [&]() { rnd.Fill( numbers.data(), Numbers ); } );
+         suite.Add( "rng/xoshiro128/lanes_8", Numbers / seconds, "numbers/s" );
+      }
+
+      if ( suite.IsEnabled( "rng/float/bits" ) )
+      {
+         Xoshiro128 rnd( BenchSeed );
+         for ( auto& number : numbers ) number = rnd();
+         const auto seconds = TimePerCall( options.minSeconds, [&]()
+         {
+            for ( size_t idx = 0; idx < Numbers; idx++ ) floats[idx] = ToMinusOneOne( numbers[idx] );
+         } );
+         Sink = floats[Numbers / 2];
+         suite.Add( "rng/float/bits", Numbers / seconds, "floats/s" );
+      }
+
+      if ( suite.IsEnabled( "rng/float/distribution" ) )
+      {
+         Xoshiro128 rnd( BenchSeed );
+         std::uniform_real_distribution<float> distribution( -1.f, 1.f );
+         const auto seconds = TimePerCall( options.minSeconds, [&]()
+         {
+            for ( auto& value : floats ) value = distribution( rnd );
+         } );
+         Sink = floats[Numbers / 2];
+         suite.Add( "rng/float/distribution", Numbers / seconds, "floats/s" );
+      }
+
+      constexpr size_t Size = 256;
+      const auto genome = MakeBenchGenome();
+      for ( auto mode : { IterationMode::Scalar, IterationMode::Batch } )
+      {
+         const auto name = std::string( "rng/determinism/" ) + ( mode == IterationMode::Scalar ? "scalar" : "batch" );
+         if ( !suite.IsEnabled( name ) ) continue;
+
+         auto render = [&]()
+         {
+            FlameCalculator calculator( genome, Size, Size, 1, mode );
+            calculator.SetSeed( BenchSeed, 3 );
+            calculator.Start( 1 << 20 );
+            calculator.Wait();
+            FlameHistogram_t histogram( Size, Size );
+            calculator.Flush( histogram );
+            return histogram;
+         };
+         const auto first = render();
+         const auto second = render();
+         size_t differences = 0;
+         for ( size_t idx = 0; idx < first.GetLayout().GetStorageSize(); idx++ )
+         {
+            bool isEqual = first.GetCounts()[idx] == second.GetCounts()[idx];
+            for ( size_t channel = 0; channel < FlameHistogram_t::Channels; channel++ )
+            {
+               isEqual = isEqual && first.GetColorSums( channel )[idx] == second.GetColorSums( channel )[idx];
+            }
+            if ( !isEqual ) differences++;
+         }
+         suite.AddCheck( name, static_cast<double>( differences ), 0.0, "entries" );
+      }
+   }
+
+   //! \brief Runs the given number of calculators with the same budget each
+   //! \param shards Number of shards of a shared histogram, 0 for a histogram per calculator
+   //! \param onScheduler Runs the calculators on a TaskScheduler with one worker per calculator instead of their
+   //!        own threads
+   //! \returns Iterations per second over all calculators
+   double RunCalculators( const FlameFunctionSet& genome, size_t threads, size_t imageSize, IterationMode mode, uint64_t budgetPerThread,
+                          size_t shards = 0, ScatterMode scatter = ScatterMode::Auto,
+                          MathPrecision precision = MathPrecision::Exact, bool onScheduler = false )
+   {
+      std::unique_ptr<TaskScheduler> scheduler;
+      if ( onScheduler )
+      {
+         SchedulerSettings settings;
+         settings.threads = threads;
+         scheduler = std::make_unique<TaskScheduler>( settings );
+      }
+
+      std::unique_ptr<SharedHistogram> sharedHistogram;
+      if ( shards ) sharedHistogram = std::make_unique<SharedHistogram>( imageSize * 2, imageSize * 2, shards );
+
+      std::vector<FlameCalculator::Ptr> calculators;
+      for ( size_t idx = 0; idx < threads; idx++ )
+      {
+         if ( sharedHistogram ) calculators.push_back( std::make_unique<FlameCalculator>( genome, *sharedHistogram, 2, mode, scatter, precision ) );
+         else calculators.push_back( std::make_unique<FlameCalculator>( genome, imageSize, imageSize, 2, mode, scatter, precision ) );
+      }
+
+      const auto start = Clock_t::now();
+      for ( auto& calc : calculators )
+      {
+         if ( scheduler ) calc->Start( *scheduler, budgetPerThread );
+         else calc->Start( budgetPerThread );
+      }
+      uint64_t iterations = 0;
+      for ( auto& calc : calculators )
+      {
+         calc->Wait();
+         iterations += calc->GetIterations();
+      }
+      return iterations / SecondsSince( start );
+   }
+
+   //! \brief FlameCalculator throughput from 1 thread up to the maximum, in powers of two. The batch mode is also
+   //!        measured with each scatter mode, with the fast math, on a TaskScheduler, and with a shared histogram of
+   //!        one shard, which shows the cost of contention
+   void BenchCalculatorScaling( BenchSuite& suite )
+   {
+      const auto genome = MakeBenchGenome();
+      const auto& options = suite.GetOptions();
+
+      struct Variant
+      {
+         std::string name;
+         IterationMode mode;
+         size_t shards;
+         ScatterMode scatter;
+         MathPrecision precision;
+         bool onScheduler;
+      };
+      const std::vector<Variant> variants = {
+         { "scalar", IterationMode::Scalar, 0, ScatterMode::Auto, MathPrecision::Exact, false },
+         { "batch", IterationMode::Batch, 0, ScatterMode::Auto, MathPrecision::Exact, false },
+         { "batch_fast", IterationMode::Batch, 0, ScatterMode::Auto, MathPrecision::Fast, false },
+         { "batch_direct", IterationMode::Batch, 0, ScatterMode::Direct, MathPrecision::Exact, false },
+         { "batch_binned", IterationMode::Batch, 0, ScatterMode::Binned, MathPrecision::Exact, false },
+         { "batch_pool", IterationMode::Batch, 0, ScatterMode::Auto, MathPrecision::Exact, true },
+         { "batch_shared", IterationMode::Batch, 1, ScatterMode::Auto, MathPrecision::Exact, false }
+      };
+
+      for ( const auto& variant : variants )
+      {
+         if ( !suite.IsEnabled( "calculator/" + variant.name + "/" ) ) continue;
+
+         //Calibrate the budget so that each run takes about minSeconds
+         const auto rate = RunCalculators( genome, 1, options.imageSize, variant.mode, 1 << 20, variant.shards, variant.scatter,
+                                           variant.precision, variant.onScheduler );
+         const auto budget = static_cast<uint64_t>( rate * options.minSeconds );
+
+         std::vector<size_t> threadCounts;
+         for ( size_t threads = 1; threads < options.maxThreads; threads *= 2 ) threadCounts.push_back( threads );
+         threadCounts.push_back( options.maxThreads );
+
+         for ( auto threads : threadCounts )
+         {
+            const auto name = "calculator/" + variant.name + "/threads_" + std::to_string( threads );
+            if ( !suite.IsEnabled( name ) ) continue;
+            suite.Add( name, RunCalculators( genome, threads, options.imageSize, variant.mode, budget, variant.shards, variant.scatter,
+                                             variant.precision, variant.onScheduler ),
+                       "iterations/s" );
+         }
+      }
+   }
+
+   //! \brief Cost of a ParallelFor over a few small items, which threads started per call and workers of a
+   //!        TaskScheduler pay differently. Also checks that a low priority render only gets the workers that a
+   //!        normal one leaves idle: both share a single worker, the low one starts first
+   void BenchScheduler( BenchSuite& suite )
+   {
+      const auto& options = suite.GetOptions();
+      const auto items = options.maxThreads * 4;
+      std::vector<float> values( items, 1.f );
+      auto body = [&]( size_t idx ) { values[idx] = std::sqrt( values[idx] + 1.f ); };
+
+      if ( suite.IsEnabled( "scheduler/parallel_for/threads" ) )
+      {
+         const auto seconds = TimePerCall( options.minSeconds, [&]() { ParallelFor( items, options.maxThreads, body ); } );
+         suite.Add( "scheduler/parallel_for/threads", seconds * 1e6, "us" );
+      }
+
+      if ( suite.IsEnabled( "scheduler/parallel_for/pool" ) )
+      {
+         TaskScheduler scheduler;
+         const auto seconds = TimePerCall( options.minSeconds, [&]()
+         {
+            scheduler.Run( [&]() { ParallelFor( items, options.maxThreads, body ); } );
+         } );
+         suite.Add( "scheduler/parallel_for/pool", seconds * 1e6, "us" );
+      }
+      Sink = values[0];
+
+      if ( suite.IsEnabled( "scheduler/priority/low_share" ) )
+      {
+         const auto genome = MakeBenchGenome();
+         SchedulerSettings settings;
+         settings.threads = 1;
+         TaskScheduler scheduler( settings );
+         FlameCalculator low( genome, 256, 256, 1 ), normal( genome, 256, 256, 1 );
+         low.Start( scheduler, 0, TaskPriority::Low );
+         normal.Start( scheduler, 1 << 22, TaskPriority::Normal );
+         normal.Wait();
+         low.Stop();
+         const auto share = static_cast<double>( low.GetIterations() ) / ( low.GetIterations() + normal.GetIterations() );
+         suite.AddCheck( "scheduler/priority/low_share", share, 0.05, "fraction" );
+      }
+   }
+
+   //! \brief Hits per second that end up in the histogram, with the symmetries of the bench genome in the chaos
+   //!        game and plotted per hit. The hits of plotted symmetries are not independent, but every one of them
+   //!        comes from an iteration of the original functions. Also checks that mirrors keep all hits on odd sizes
+   void BenchSymmetry( BenchSuite& suite )
+   {
+      const auto& options = suite.GetOptions();
+      for ( auto mode : { SymmetryMode::Functions, SymmetryMode::Plot } )
+      {
+         const auto name = std::string( "symmetry/" ) + ( mode == SymmetryMode::Functions ? "functions" : "plot" ) + "/hits";
+         if ( !suite.IsEnabled( name ) ) continue;
+
+         const auto genome = MakeBenchGenome( mode );
+         const auto rate = RunCalculators( genome, 1, options.imageSize, IterationMode::Batch, 1 << 20 );
+         FlameCalculator calculator( genome, options.imageSize, options.imageSize, 2 );
+         const auto start = Clock_t::now();
+         calculator.Start( static_cast<uint64_t>( rate * options.minSeconds ) );
+         calculator.Wait();
+         const auto seconds = SecondsSince( start );
+
+         FlameHistogram_t histogram( options.imageSize * 2, options.imageSize * 2 );
+         calculator.Flush( histogram );
+         uint64_t hits = 0;
+         for ( size_t idx = 0; idx < histogram.GetLayout().GetStorageSize(); idx++ ) hits += histogram.GetCounts()[idx];
+         suite.Add( name, hits / seconds, "hits/s" );
+      }
+
+      //An odd width has a last column without a mirror image on the pixel grid, its hits have to be mirrored as
+      //points. The genome collapses onto a point in that column, so all hits belong into the first and last column
+      if ( suite.IsEnabled( "symmetry/odd_size/lost_hits" ) )
+      {
+         FlameFunctionSet genome;
+         genome.AddFunction( FlameFunction( { Variations::Linear }, { Coefficients::Build( 0, 0, 1.01f, 0, 0, 0.005f ) }, { 1.f }, Color3_8( 255, 0, 0 ) ), 1.f );
+         genome.AddSymmetries( { Symmetry::MirrorY }, SymmetryMode::Plot );
+         const size_t width = 101, height = 100;
+         uint64_t lost = 0;
+         for ( auto mode : { IterationMode::Scalar, IterationMode::Batch } )
+         {
+            FlameCalculator calculator( genome, width, height, 1, mode );
+            calculator.Start( 1 << 16 );
+            calculator.Wait();
+            FlameHistogram_t histogram( width, height );
+            calculator.Flush( histogram );
+            uint64_t hits = 0;
+            for ( size_t y = 0; y < height; y++ )
+            {
+               hits += histogram.GetCounts()[histogram.GetLayout().GetIndex( 0, y )];
+               hits += histogram.GetCounts()[histogram.GetLayout().GetIndex( width - 1, y )];
+            }
+            const auto plotted = calculator.GetStats().plotted;
+            lost += plotted > hits ? plotted - hits : hits - plotted;
+         }
+         suite.AddCheck( "symmetry/odd_size/lost_hits", static_cast<double>( lost ), 0.0, "hits" );
+      }
+   }
+
+   //! \brief Checks the noise estimate of the ConvergenceTracker against the actual noise: two renders with
+   //!        different seeds differ by sqrt( 2 ) times the noise of one. The ratio of the estimated to the measured
+   //!        noise at the 95% quantile of the tiles must be within a factor of 2
+   void BenchConvergence( BenchSuite& suite )
+   {
+      const auto name = std::string( "convergence/noise_estimate_error" );
+      if ( !suite.IsEnabled( name ) ) return;
+
+      const auto& options = suite.GetOptions();
+      const size_t superSampling = 2;
+      const auto size = options.imageSize;
+      const auto genome = MakeBenchGenome();
+      std::vector<Color3_8> images[2];
+      ConvergenceSettings settings;
+      ConvergenceTracker tracker( size * superSampling, size * superSampling, superSampling, settings );
+      for ( uint32_t render = 0; render < 2; render++ )
+      {
+         FlameCalculator calculator( genome, size, size, superSampling );
+         calculator.SetSeed( BenchSeed, render );
+         calculator.Start( static_cast<uint64_t>( size * size * 100 ) );
+         calculator.Wait();
+
+         FlameHistogram_t histogram( size * superSampling, size * superSampling );
+         calculator.Flush( histogram );
+         if ( render == 0 ) tracker.Update( histogram, nullptr, options.maxThreads );
+         images[render].resize( size * size );
+         histogram.Resolve( images[render].begin(), images[render].end(), superSampling, options.maxThreads );
+      }
+
+      std::vector<float> estimated, measured;
+      const auto& tiles = tracker.GetTiles();
+      for ( size_t tile = 0; tile < tiles.GetTileCount(); tile++ )
+      {
+         const auto noise = tracker.GetTileNoise( tile );
+         if ( noise <= 0.f ) continue;
+
+         const auto rect = tiles.GetTileRect( tile );
+         double sumSquares = 0.0;
+         size_t values = 0;
+         for ( auto y = rect.y0 / superSampling; y < rect.y1 / superSampling; y++ )
+         {
+            for ( auto x = rect.x0 / superSampling; x < rect.x1 / superSampling; x++ )
+            {
+               const auto& a = images[0][y * size + x];
+               const auto& b = images[1][y * size + x];
+               for ( auto diff : { float( a.r ) - b.r, float( a.g ) - b.g, float( a.b ) - b.b } ) sumSquares += diff * diff;
+               values += 3;
+            }
+         }
+         estimated.push_back( noise );
+         measured.push_back( static_cast<float>( std::sqrt( sumSquares / values / 2.0 ) ) );
+      }
+      if ( estimated.empty() ) return;
+
+      auto quantile = []( std::vector<float>& values )
+      {
+         const auto nth = values.begin() + static_cast<ptrdiff_t>( 0.95 * ( values.size() - 1 ) );
+         std::nth_element( values.begin(), nth, values.end() );
+         return *nth;
+      };
+      const auto ratio = quantile( estimated ) / std::max( quantile( measured ), 1e-3f );
+      suite.AddCheck( name, std::abs( std::log2( ratio ) ), 1.0, "log2_ratio" );
+   }
+
+   //! \brief Checks that a reset ConvergenceTracker estimates a histogram like a new tracker does. This is the case of
+   //!        a genome swap that cleared the snapshot, whose new hits must not be normalized by the old highest count
+   void BenchConvergenceReset( BenchSuite& suite )
+   {
+      const auto name = std::string( "convergence/reset_error" );
+      if ( !suite.IsEnabled( name ) ) return;
+
+      const auto& options = suite.GetOptions();
+      const size_t superSampling = 2;
+      const auto size = options.imageSize;
+      auto render = [&]( const FlameFunctionSet& genome, uint64_t iterations, FlameHistogram_t& histogram )
+      {
+         FlameCalculator calculator( genome, size, size, superSampling );
+         calculator.SetSeed( BenchSeed, 0 );
+         calculator.Start( iterations );
+         calculator.Wait();
+         calculator.Flush( histogram );
+      };
+
+      ConvergenceSettings settings;
+      ConvergenceTracker reset( size * superSampling, size * superSampling, superSampling, settings );
+      ConvergenceTracker fresh( size * superSampling, size * superSampling, superSampling, settings );
+      FlameHistogram_t histogram( size * superSampling, size * superSampling );
+      render( MakeBenchGenome(), static_cast<uint64_t>( size * size * 100 ), histogram );
+      reset.Update( histogram, nullptr, options.maxThreads );
+      reset.Reset();
+
+      histogram.Clear();
+      render( MakeBenchGenome( SymmetryMode::Plot ), static_cast<uint64_t>( size * size * 4 ), histogram );
+      reset.Update( histogram, nullptr, options.maxThreads );
+      fresh.Update( histogram, nullptr, options.maxThreads );
+      suite.AddCheck( name, std::abs( reset.GetNoise() - fresh.GetNoise() ), 0.0, "levels" );
+   }
+
+   //! \brief Setup of a genome from its file: parsing, validating and normalizing, and the same through a GenomeCache
+   //!        that already has it. Also checks that genomes round trip through their files and that
+   //!        malformed files are rejected
+   void BenchGenomeLoading( BenchSuite& suite )
+   {
+      std::ostringstream file;
+      WriteGenome( file, MakeBenchGenome( SymmetryMode::Plot ) );
+      const auto content = file.str();
+
+      if ( suite.IsEnabled( "genome/load" ) )
+      {
+         const auto seconds = TimePerCall( suite.GetOptions().minSeconds, [&]()
+         {
+            std::istringstream stream( content );
+            const auto functions = ParseGenome( stream );
+            Sink = static_cast<float>( functions.GetFunctions().size() );
+         } );
+         suite.Add( "genome/load", seconds * 1e6, "us" );
+      }
+
+      if ( suite.IsEnabled( "genome/cache_hit" ) )
+      {
+         GenomeCache cache;
+         const auto seconds = TimePerCall( suite.GetOptions().minSeconds, [&]()
+         {
+            Sink = static_cast<float>( cache.Parse( content )->hash );
+         } );
+         suite.Add( "genome/cache_hit", seconds * 1e6, "us" );
+      }
+
+      //A genome that was loaded writes a file that loads into the same genome, also with symmetries that were added as
+      //functions. It starts from a loaded genome because loading normalizes the probabilities
+      if ( suite.IsEnabled( "genome/roundtrip_mismatches" ) )
+      {
+         auto rewrite = []( const FlameFunctionSet& genome )
+         {
+            std::ostringstream written;
+            WriteGenome( written, genome );
+            std::istringstream stream( written.str() );
+            return ParseGenome( stream );
+         };
+         size_t mismatches = 0;
+         for ( auto mode : { SymmetryMode::Plot, SymmetryMode::Functions } )
+         {
+            const auto loaded = rewrite( MakeBenchGenome( mode ) );
+            if ( HashGenome( rewrite( loaded ) ) != HashGenome( loaded ) ) mismatches++;
+         }
+         suite.AddCheck( "genome/roundtrip_mismatches", static_cast<double>( mismatches ), 0.0, "genomes" );
+      }
+
+      //Malformed files are rejected with a GenomeError. The flam3 ones differ from a valid flame in one attribute
+      if ( suite.IsEnabled( "genome/accepted_errors" ) )
+      {
+         const std::string genomes[] = {
+            "variation linear 1 1 0 0 0 1 0\n",
+            "function 1\n   variation bogus 1 1 0 0 0 1 0\n",
+            "function nan\n   variation linear 1 1 0 0 0 1 0\n"
+         };
+         auto flam3 = []( const std::string& element )
+         {
+            return "<flame><xform weight=\"1\" coefs=\"1 0 0 1 0 0\" linear=\"1\"/>" + element + "</flame>";
+         };
+         const std::string flam3s[] = {
+            flam3( "<symmetry kind=\"1e12\"/>" ),
+            flam3( "<symmetry kind=\"-1e12\"/>" ),
+            flam3( "<symmetry kind=\"2.5\"/>" ),
+            flam3( "<color index=\"-1\" rgb=\"0 0 0\"/>" ),
+            flam3( "<color index=\"1e12\" rgb=\"0 0 0\"/>" )
+         };
+         auto isRejected = []( const std::string& content, bool isFlam3 )
+         {
+            std::istringstream stream( content );
+            try
+            {
+               if ( isFlam3 ) ParseFlam3( stream );
+               else ParseGenome( stream );
+            }
+            catch ( const GenomeError& )
+            {
+               return true;
+            }
+            return false;
+         };
+         size_t accepted = 0;
+         for ( const auto& content : genomes ) accepted += isRejected( content, false ) ? 0 : 1;
+         for ( const auto& content : flam3s ) accepted += isRejected( content, true ) ? 0 : 1;
+         //The valid flame that the malformed ones are made of counts if it is rejected
+         accepted += isRejected( flam3( "<symmetry kind=\"-2\"/>" ), true ) ? 1 : 0;
+         suite.AddCheck( "genome/accepted_errors", static_cast<double>( accepted ), 0.0, "files" );
+      }
+   }
+
+   //! \brief Genome of three contractions by 0.3 whose attractor lies in one half of the image, including the hits
+   //!        right after a walker starts at a random point
+   FlameFunctionSet MakeHalfGenome( bool isRight )
+   {
+      const auto side = isRight ? 1.f : -1.f;
+      FlameFunctionSet ffs;
+      ffs.AddFunction( FlameFunction( { Variations::Linear }, { Coefficients::Build( 0.3f, 0, 0.7f * side, 0, 0.3f, -0.5f ) }, { 1.f }, Color3_8( 255, 0, 0 ) ), 0.33f );
+      ffs.AddFunction( FlameFunction( { Variations::Linear }, { Coefficients::Build( 0.3f, 0, 0.7f * side, 0, 0.3f, 0.5f ) }, { 1.f }, Color3_8( 0, 255, 0 ) ), 0.33f );
+      ffs.AddFunction( FlameFunction( { Variations::Linear }, { Coefficients::Build( 0.3f, 0, 0.4f * side, 0, 0.3f, 0 ) }, { 1.f }, Color3_8( 0, 0, 255 ) ), 0.33f );
+      return ffs;
+   }
+
+   //! \brief Time from publishing a new genome until the first snapshot with its hits, with the calculators that
+   //!        pick it up at their next chunk, and with calculators that are stopped and built again for it. The
+   //!        genomes alternate between the two halves of the image, hits on the wrong half after a swap are a failed
+   //!        check
+   void BenchGenomeSwap( BenchSuite& suite )
+   {
+      if ( !suite.IsEnabled( "genome/swap/" ) ) return;
+      const auto& options = suite.GetOptions();
+      const auto size = options.imageSize;
+      const size_t Rounds = 20;
+      SchedulerSettings settings;
+      settings.threads = options.maxThreads;
+      TaskScheduler scheduler( settings );
+      FlameHistogram_t snapshot( size * 2, size * 2 );
+      DirtyTiles changes( size * 2, size * 2, 2 );
+
+      //Hits on the half of the image that the genome of the round doesn't cover
+      auto countStaleHits = [&]( bool isRight )
+      {
+         uint64_t hits = 0;
+         for ( size_t y = 0; y < size * 2; y++ )
+         {
+            for ( size_t x = isRight ? 0 : size; x < ( isRight ? size : size * 2 ); x++ ) hits += snapshot.GetCount( x, y );
+         }
+         return hits;
+      };
+      //Takes snapshots until one has hits
+      auto waitForHits = [&]( std::vector<FlameCalculator::Ptr>& calculators, uint64_t version )
+      {
+         changes.Clear();
+         while ( !changes.GetMaxCount() )
+         {
+            for ( auto& calc : calculators ) calc->TakeSnapshot( snapshot, &changes, 0.f, version );
+         }
+      };
+
+      double hotSeconds = 0.0;
+      uint64_t staleHits = 0;
+      {
+         GenomeHandle genome( MakeHalfGenome( false ) );
+         std::vector<FlameCalculator::Ptr> calculators;
+         for ( size_t idx = 0; idx < options.maxThreads; idx++ )
+         {
+            calculators.push_back( std::make_unique<FlameCalculator>( genome, size, size, 2 ) );
+            calculators.back()->Start( scheduler );
+         }
+         for ( size_t round = 1; round <= Rounds; round++ )
+         {
+            const auto isRight = round % 2 == 1;
+            const auto start = Clock_t::now();
+            const auto version = genome.Publish( MakeHalfGenome( isRight ) );
+            while ( std::any_of( calculators.begin(), calculators.end(),
+                                 [&]( const FlameCalculator::Ptr& calc ) { return calc->GetGenomeVersion() != version; } ) )
+            {
+               std::this_thread::yield();
+            }
+            snapshot.Clear();
+            waitForHits( calculators, version );
+            hotSeconds += SecondsSince( start );
+            staleHits += countStaleHits( isRight );
+         }
+         for ( auto& calc : calculators ) calc->Stop();
+      }
+
+      double rebuildSeconds = 0.0;
+      {
+         FlameFunctionSet genome;
+         std::vector<FlameCalculator::Ptr> calculators;
+         for ( size_t round = 1; round <= Rounds; round++ )
+         {
+            const auto start = Clock_t::now();
+            calculators.clear();
+            genome = MakeHalfGenome( round % 2 == 1 );
+            for ( size_t idx = 0; idx < options.maxThreads; idx++ )
+            {
+               calculators.push_back( std::make_unique<FlameCalculator>( genome, size, size, 2 ) );
+               calculators.back()->Start( scheduler );
+            }
+            snapshot.Clear();
+            waitForHits( calculators, 0 );
+            rebuildSeconds += SecondsSince( start );
+         }
+      }
+
+      suite.Add( "genome/swap/hot", hotSeconds / Rounds * 1e3, "ms" );
+      suite.Add( "genome/swap/rebuild", rebuildSeconds / Rounds * 1e3, "ms" );
+      suite.AddCheck( "genome/swap/stale_hits", static_cast<double>( staleHits ), 0.0, "hits" );
+   }
+
+   //! \brief Full copy of a histogram (what a snapshot used to cost), TakeSnapshot with every tile dirty and the
+   //!        snapshots of a sparse render
+   void BenchSnapshot( BenchSuite& suite )
+   {
+      const auto& options = suite.GetOptions();
+      const auto size = options.imageSize * 2;
+      Xoshiro128 rnd( BenchSeed );
+
+      if ( suite.IsEnabled( "snapshot/copy" ) )
+      {
+         FlameHistogram_t from( size, size ), to( size, size );
+         FillRandom( from, rnd );
+         const auto seconds = TimePerCall( options.minSeconds, [&]() { from.CopyTo( to ); } );
+         const auto bytes = from.GetLayout().GetStorageSize() * ( sizeof( uint32_t ) + FlameHistogram_t::Channels * sizeof( FlameHistogram_t::ColorSum_t ) );
+         suite.Add( "snapshot/copy", seconds * 1e3, "ms" );
+         suite.Add( "snapshot/copy_bandwidth", 2.0 * bytes / seconds / 1e9, "GB/s" );
+      }
+
+      if ( suite.IsEnabled( "snapshot/take" ) )
+      {
+         const auto genome = MakeBenchGenome();
+         FlameCalculator calculator( genome, options.imageSize, options.imageSize, 2 );
+         FlameHistogram_t snapshot( size, size );
+
+         //Every round iterates enough to touch all tiles, only the snapshot itself is timed
+         double totalSeconds = 0.0;
+         size_t rounds = 0;
+         do
+         {
+            calculator.Start( 1 << 22 );
+            calculator.Wait();
+            totalSeconds += calculator.TakeSnapshot( snapshot ).merge.count() * 1e-6;
+            rounds++;
+         } while ( totalSeconds < options.minSeconds && rounds < 20 );
+         suite.Add( "snapshot/take", totalSeconds / rounds * 1e3, "ms" );
+      }
+
+      //Few iterations per snapshot at a high supersampling, like an interactive render: the dirty tiles are mostly
+      //empty blocks, which the snapshot, the copy and the resolve skip
+      if ( suite.IsEnabled( "snapshot/sparse" ) )
+      {
+         constexpr size_t SuperSampling = 4;
+         const auto genome = MakeBenchGenome();
+         FlameCalculator calculator( genome, options.imageSize, options.imageSize, SuperSampling );
+         const auto sparseSize = options.imageSize * SuperSampling;
+         FlameHistogram_t snapshot( sparseSize, sparseSize ), copy( sparseSize, sparseSize );
+         std::vector<Color3_8> colors( options.imageSize * options.imageSize );
+
+         //The first round touches the pages of both histograms and isn't timed
+         calculator.Start( 1 << 16 );
+         calculator.Wait();
+         calculator.TakeSnapshot( snapshot );
+         snapshot.CopyTo( copy );
+
+         double takeSeconds = 0.0, copySeconds = 0.0, resolveSeconds = 0.0;
+         size_t rounds = 0;
+         do
+         {
+            calculator.Start( 1 << 16 );
+            calculator.Wait();
+            takeSeconds += calculator.TakeSnapshot( snapshot ).merge.count() * 1e-6;
+            const auto copyStart = std::chrono::steady_clock::now();
+            snapshot.CopyTo( copy );
+            const auto resolveStart = std::chrono::steady_clock::now();
+            copy.Resolve( colors.begin(), colors.end(), SuperSampling );
+            const auto resolveEnd = std::chrono::steady_clock::now();
+            copySeconds += std::chrono::duration<double>( resolveStart - copyStart ).count();
+            resolveSeconds += std::chrono::duration<double>( resolveEnd - resolveStart ).count();
+            rounds++;
+         } while ( takeSeconds + copySeconds + resolveSeconds < options.minSeconds && rounds < 20 );
+         suite.Add( "snapshot/sparse/take", takeSeconds / rounds * 1e3, "ms" );
+         suite.Add( "snapshot/sparse/copy", copySeconds / rounds * 1e3, "ms" );
+         suite.Add( "snapshot/sparse/resolve", resolveSeconds / rounds * 1e3, "ms" );
+         const auto blocks = snapshot.GetLayout().GetStorageSize() / FlameHistogram_t::BlockEntries;
+         suite.Add( "snapshot/sparse/occupied_blocks", static_cast<double>( snapshot.CountOccupiedBlocks() ) / blocks, "fraction" );
+
+         //Every hit has to be within the occupied blocks, of the snapshot and of its copy
+         uint64_t hits = 0, flaggedHits = 0;
+         for ( size_t idx = 0; idx < snapshot.GetLayout().GetStorageSize(); idx++ ) hits += snapshot.GetCounts()[idx] + copy.GetCounts()[idx];
+         for ( const auto* histogram : { &snapshot, &copy } )
+         {
+            histogram->ForEachOccupiedSpan( { 0, 0, sparseSize, sparseSize }, [&]( size_t begin, size_t end )
+            {
+               for ( auto idx = begin; idx < end; idx++ ) flaggedHits += histogram->GetCounts()[idx];
+            } );
+         }
+         suite.AddCheck( "snapshot/sparse/unflagged_hits", static_cast<double>( hits - flaggedHits ), 0.0, "hits" );
+      }
+   }
+
+   //! \brief Entries in which two histograms of the same size differ
+   size_t CountDifferences( const FlameHistogram_t& a, const FlameHistogram_t& b )
+   {
+      size_t differences = 0;
+      const auto size = a.GetLayout().GetStorageSize();
+      for ( size_t idx = 0; idx < size; idx++ )
+      {
+         auto isEqual = a.GetCounts()[idx] == b.GetCounts()[idx];
+         for ( size_t channel = 0; channel < FlameHistogram_t::Channels; channel++ )
+         {
+            isEqual = isEqual && a.GetColorSums( channel )[idx] == b.GetColorSums( channel )[idx];
+         }
+         differences += isEqual ? 0 : 1;
+      }
+      return differences;
+   }
+
+   //! \brief Writing and reading histogram files, and renders that resume from a checkpoint. The read and the
+   //!        mapped histogram have to be identical to the written one. A render of half the budget resumed to the
+   //!        full one has to do the full budget, and its density has to be within the noise of the chaos game of
+   //!        a render that ran through, which the distance between two such renders shows
+   void BenchCheckpoint( BenchSuite& suite )
+   {
+      const auto& options = suite.GetOptions();
+      const auto size = options.imageSize * 2;
+      const std::string path = "flames_bench_checkpoint.hist";
+      Xoshiro128 rnd( BenchSeed );
+
+      if ( suite.IsEnabled( "checkpoint/file" ) )
+      {
+         FlameHistogram_t histogram( size, size );
+         FillRandom( histogram, rnd );
+         HistogramFileInfo info;
+         info.superSampling = 2;
+         info.iterations = 1;
+
+         const auto writeSeconds = TimePerCall( options.minSeconds, [&]() { WriteHistogramFile( path, histogram, info ); } );
+         const auto bytes = histogram.GetLayout().GetStorageSize() * ( sizeof( uint32_t ) + FlameHistogram_t::Channels * sizeof( FlameHistogram_t::ColorSum_t ) );
+         suite.Add( "checkpoint/file/write", writeSeconds * 1e3, "ms" );
+         suite.Add( "checkpoint/file/write_bandwidth", bytes / writeSeconds / 1e9, "GB/s" );
+         const auto readSeconds = TimePerCall( options.minSeconds, [&]()
+         {
+            HistogramFileInfo readInfo;
+            Sink = static_cast<float>( ReadHistogramFile( path, readInfo ).GetCounts()[0] );
+         } );
+         suite.Add( "checkpoint/file/read", readSeconds * 1e3, "ms" );
+
+         HistogramFileInfo readInfo, mappedInfo;
+         const auto read = ReadHistogramFile( path, readInfo );
+         const auto mapped = MapHistogramFile( path, mappedInfo );
+         const auto differences = CountDifferences( histogram, read ) + CountDifferences( histogram, mapped ) +
+            ( readInfo.iterations != 1 || mappedInfo.superSampling != 2 ? 1 : 0 );
+         suite.AddCheck( "checkpoint/file/roundtrip_differences", static_cast<double>( differences ), 0.0, "entries" );
+      }
+
+      if ( suite.IsEnabled( "checkpoint/resume" ) )
+      {
+         constexpr size_t Cells = 32;
+         const auto genome = MakeBenchGenome();
+         RenderSettings settings;
+         settings.width = settings.height = 256;
+         settings.threads = 2;
+         settings.iterations = 1 << 24;
+         settings.checkpointPath = path;
+
+         //The final checkpoint of a render holds its histogram
+         auto render = [&]( uint64_t seed, bool isResumed )
+         {
+            std::remove( path.c_str() );
+            settings.seed = seed;
+            settings.resume = isResumed;
+            auto iterations = settings.iterations;
+            if ( isResumed )
+            {
+               settings.iterations = iterations / 2;
+               RenderHeadless( genome, settings );
+               settings.iterations = iterations;
+            }
+            const auto result = RenderHeadless( genome, settings );
+            HistogramFileInfo info;
+            const auto histogram = ReadHistogramFile( path, info );
+            if ( isResumed )
+            {
+               suite.AddCheck( "checkpoint/resume/iteration_error", static_cast<double>(
+                  std::max( result.iterations, iterations ) - std::min( result.iterations, iterations ) +
+                  std::max( info.iterations, iterations ) - std::min( info.iterations, iterations ) ), 0.0, "iterations" );
+            }
+            return CoarseDensity( histogram, Cells );
+         };
+         const auto reference = render( BenchSeed, false );
+         const auto noise = TotalVariationDistance( reference, render( BenchSeed + 1, false ) );
+         const auto resumed = TotalVariationDistance( reference, render( BenchSeed + 2, true ) );
+         suite.AddCheck( "checkpoint/resume/density_tv", resumed, 2.0 * noise + 0.005, "tv_distance" );
+      }
+      std::remove( path.c_str() );
+   }
+
+   //! \brief Distributed renders: merging the histogram files of the nodes, which has to give the sums of the
+   //!        histograms, and renders of 4 nodes as a stand-in for processes on several machines. Their merge has to
+   //!        do the full budget, no two nodes may draw the same numbers, and the density has to be within the noise
+   //!        of a render in one process
+   void BenchDistributed( BenchSuite& suite )
+   {
+      const auto& options = suite.GetOptions();
+      constexpr uint32_t Nodes = 4;
+      auto shardPath = []( size_t node ) { return "flames_bench_node" + std::to_string( node ) + ".hist"; };
+      std::vector<std::string> paths;
+      for ( uint32_t node = 0; node < Nodes; node++ ) paths.push_back( shardPath( node ) );
+
+      if ( suite.IsEnabled( "distributed/merge" ) )
+      {
+         const auto size = options.imageSize * 2;
+         Xoshiro128 rnd( BenchSeed );
+         std::vector<FlameHistogram_t> histograms;
+         HistogramFileInfo info;
+         info.superSampling = 2;
+         info.nodes = Nodes;
+         for ( uint32_t node = 0; node < Nodes; node++ )
+         {
+            histograms.emplace_back( size, size );
+            FillRandom( histograms.back(), rnd );
+            info.node = node;
+            WriteHistogramFile( paths[node], histograms.back(), info );
+         }
+
+         HistogramFileInfo mergedInfo;
+         for ( auto threads : { size_t( 1 ), options.maxThreads } )
+         {
+            const auto seconds = TimePerCall( options.minSeconds, [&]()
+            {
+               Sink = static_cast<float>( MergeHistogramFiles( paths, mergedInfo, threads ).GetCounts()[0] );
+            } );
+            suite.Add( "distributed/merge/threads_" + std::to_string( threads ), Nodes * size * size / seconds, "entries/s" );
+            if ( threads == options.maxThreads ) break;
+         }
+         const auto merged = MergeHistogramFiles( paths, mergedInfo, options.maxThreads );
+         MergeHistograms( histograms, options.maxThreads );
+         suite.AddCheck( "distributed/merge/sum_differences", static_cast<double>( CountDifferences( histograms[0], merged ) ), 0.0, "entries" );
+      }
+
+      if ( suite.IsEnabled( "distributed/render" ) )
+      {
+         constexpr size_t Cells = 32;
+         const auto genome = MakeBenchGenome();
+         RenderSettings settings;
+         settings.width = settings.height = 256;
+         settings.threads = 1;
+         settings.iterations = 1 << 24;
+         settings.resolve = false;
+         auto render = [&]( uint64_t seed )
+         {
+            settings.seed = seed;
+            settings.nodes = 1;
+            settings.node = 0;
+            settings.checkpointPath = paths[0];
+            RenderHeadless( genome, settings );
+            HistogramFileInfo info;
+            return ReadHistogramFile( paths[0], info );
+         };
+         const auto reference = CoarseDensity( render( BenchSeed ), Cells );
+         const auto noise = TotalVariationDistance( reference, CoarseDensity( render( BenchSeed + 1 ), Cells ) );
+
+         settings.seed = BenchSeed + 2;
+         settings.nodes = Nodes;
+         std::vector<FlameHistogram_t> shards;
+         for ( uint32_t node = 0; node < Nodes; node++ )
+         {
+            settings.node = node;
+            settings.checkpointPath = paths[node];
+            RenderHeadless( genome, settings );
+            HistogramFileInfo info;
+            shards.push_back( ReadHistogramFile( paths[node], info ) );
+         }
+         size_t identicalShards = 0;
+         for ( size_t a = 0; a < shards.size(); a++ )
+         {
+            for ( auto b = a + 1; b < shards.size(); b++ ) identicalShards += CountDifferences( shards[a], shards[b] ) ? 0 : 1;
+         }
+         suite.AddCheck( "distributed/render/identical_shards", static_cast<double>( identicalShards ), 0.0, "shards" );
+
+         HistogramFileInfo info;
+         const auto merged = MergeHistogramFiles( paths, info, options.maxThreads );
+         suite.AddCheck( "distributed/render/iteration_error", static_cast<double>(
+            std::max( info.iterations, settings.iterations ) - std::min( info.iterations, settings.iterations ) ), 0.0, "iterations" );
+         const auto distributed = TotalVariationDistance( reference, CoarseDensity( merged, Cells ) );
+         suite.AddCheck( "distributed/render/density_tv", distributed, 2.0 * noise + 0.005, "tv_distance" );
+      }
+      for ( const auto& path : paths ) std::remove( path.c_str() );
+   }
+
+   //! \brief Renders with the histogram in a file. With one thread the hits arrive in the same order as in memory,
+   //!        so the histograms have to be identical. Resolving band by band has to give the pixels of a complete
+   //!        resolve
+   void BenchOutOfCore( BenchSuite& suite )
+   {
+      const auto& options = suite.GetOptions();
+      const std::string path = "flames_bench_outofcore.hist";
+
+      if ( suite.IsEnabled( "outofcore/render" ) )
+      {
+         const auto genome = MakeBenchGenome();
+         RenderSettings settings;
+         settings.width = settings.height = options.imageSize;
+         settings.threads = 1;
+         settings.iterations = 1 << 24;
+         settings.seed = BenchSeed;
+         settings.resolve = false;
+         settings.checkpointPath = path;
+         auto render = [&]( bool isOutOfCore )
+         {
+            settings.outOfCore = isOutOfCore;
+            const auto result = RenderHeadless( genome, settings );
+            suite.Add( std::string( "outofcore/render/" ) + ( isOutOfCore ? "out_of_core" : "in_memory" ), result.GetIterationsPerSecond(), "iterations/s" );
+            HistogramFileInfo info;
+            return ReadHistogramFile( path, info );
+         };
+         const auto inMemory = render( false );
+         const auto outOfCore = render( true );
+         suite.AddCheck( "outofcore/render/histogram_differences", static_cast<double>( CountDifferences( inMemory, outOfCore ) ), 0.0, "entries" );
+      }
+
+      if ( suite.IsEnabled( "outofcore/resolve" ) )
+      {
+         constexpr size_t SuperSampling = 2;
+         constexpr size_t BandRows = 100;
+         Xoshiro128 rnd( BenchSeed );
+         FlameHistogram_t histogram( options.imageSize * SuperSampling, options.imageSize * SuperSampling );
+         FillRandom( histogram, rnd );
+         PixelFormat format;
+         format.type = PixelType::UInt16;
+         ImageBuffer complete( options.imageSize, options.imageSize, format );
+         histogram.Resolve( complete.GetView(), SuperSampling, options.maxThreads );
+
+         ImageBuffer band( options.imageSize, BandRows, format );
+         const auto maxCount = histogram.MaxCount( options.maxThreads );
+         size_t differences = 0;
+         const auto seconds = TimePerCall( options.minSeconds, [&]()
+         {
+            differences = 0;
+            for ( size_t row = 0; row < options.imageSize; row += BandRows )
+            {
+               auto view = band.GetView();
+               view.height = std::min( BandRows, options.imageSize - row );
+               histogram.ResolveRows( view, SuperSampling, row, maxCount, options.maxThreads );
+               const auto rowBytes = view.width * format.GetPixelBytes();
+               for ( size_t y = 0; y < view.height; y++ )
+               {
+                  differences += std::memcmp( view.data + y * view.stride, complete.GetView().GetPixel( 0, row + y ), rowBytes ) ? 1 : 0;
+               }
+            }
+         } );
+         suite.Add( "outofcore/resolve/bands", seconds * 1e3, "ms" );
+         suite.AddCheck( "outofcore/resolve/band_differences", static_cast<double>( differences ), 0.0, "rows" );
+      }
+      std::remove( path.c_str() );
+   }
+
+   //! \brief Plots the points of a real chaos game into a histogram, which shows how well the storage handles the
+   //!        scattered read-modify-writes of the iteration
+   template<typename _Histogram, typename... Args>
+   void BenchScatter( BenchSuite& suite, const std::string& storage, Args&&... histogramArgs )
+   {
+      const auto name = "scatter/" + storage;
+      if ( !suite.IsEnabled( name ) ) return;
+
+      const auto size = suite.GetOptions().imageSize * 2;
+      const auto genome = MakeBenchGenome();
+      constexpr size_t Points = 1 << 20;
+      std::vector<std::pair<uint32_t, uint32_t>> points;
+      std::vector<Color3_8> colors;
+      points.reserve( Points );
+      colors.reserve( Points );
+
+      Xoshiro128 rnd( BenchSeed );
+      cv::Point2f point( 0.1f, 0.2f );
+      while ( points.size() < Points )
+      {
+         const auto& function = genome.PickFunction( rnd() );
+         point = function( point );
+         if ( !std::isfinite( point.x ) || !std::isfinite( point.y ) ) point = { 0.1f, 0.2f };
+         const auto x = static_cast<int>( ( point.x + 1 ) * ( size / 2 ) );
+         const auto y = static_cast<int>( ( point.y + 1 ) * ( size / 2 ) );
+         if ( x < 0 || x >= static_cast<int>( size ) || y < 0 || y >= static_cast<int>( size ) ) continue;
+         points.emplace_back( x, y );
+         colors.push_back( function.GetColor() );
+      }
+
+      _Histogram histogram( size, size, std::forward<Args>( histogramArgs )... );
+      const auto seconds = TimePerCall( suite.GetOptions().minSeconds, [&]()
+      {
+         for ( size_t idx = 0; idx < Points; idx++ ) AddHit( histogram, points[idx].first, points[idx].second, colors[idx] );
+      } );
+      suite.Add( name, Points / seconds, "hits/s" );
+   }
+
+   template<typename _Histogram>
+   void BenchMerge( BenchSuite& suite, const std::string& storage )
+   {
+      const auto& options = suite.GetOptions();
+      const auto size = options.imageSize * 2;
+      constexpr size_t Histograms = 4;
+
+      for ( auto threads : { size_t( 1 ), options.maxThreads } )
+      {
+         const auto name = "merge/" + storage + "/threads_" + std::to_string( threads );
+         if ( suite.IsEnabled( name ) )
+         {
+            Xoshiro128 rnd( BenchSeed );
+            std::vector<_Histogram> histograms;
+            histograms.reserve( Histograms );
+            for ( size_t idx = 0; idx < Histograms; idx++ )
+            {
+               histograms.emplace_back( size, size );
+               FillRandom( histograms.back(), rnd );
+            }
+            const auto seconds = TimePerCall( options.minSeconds, [&]() { MergeHistograms( histograms, threads ); } );
+            suite.Add( name, ( Histograms - 1 ) * size * size / seconds, "entries/s" );
+         }
+         if ( threads == options.maxThreads ) break;
+      }
+   }
+
+   template<typename _Histogram>
+   void BenchResolve( BenchSuite& suite, const std::string& storage )
+   {
+      const auto& options = suite.GetOptions();
+      Xoshiro128 rnd( BenchSeed );
+
+      for ( size_t superSampling : { 1, 2, 4 } )
+      {
+         _Histogram histogram( options.imageSize * superSampling, options.imageSize * superSampling );
+         bool filled = false;
+         std::vector<Color3_8> colors( options.imageSize * options.imageSize );
+
+         for ( auto threads : { size_t( 1 ), options.maxThreads } )
+         {
+            const auto name = "resolve/" + storage + "/ss" + std::to_string( superSampling ) + "/threads_" + std::to_string( threads );
+            if ( suite.IsEnabled( name ) )
+            {
+               if ( !filled ) FillRandom( histogram, rnd );
+               filled = true;
+               const auto seconds = TimePerCall( options.minSeconds, [&]()
+               {
+                  histogram.Resolve( colors.begin(), colors.end(), superSampling, threads );
+               } );
+               suite.Add( name, seconds * 1e3, "ms" );
+            }
+            if ( threads == options.maxThreads ) break;
+         }
+      }
+   }
+
+   //! \brief Resolve of the flame histogram straight into images of different formats, against the resolve into
+   //!        colors followed by the copy into a BGR display buffer that it replaces
+   void BenchResolveFormats( BenchSuite& suite )
+   {
+      const auto& options = suite.GetOptions();
+      const size_t superSampling = 2;
+      const auto size = options.imageSize;
+      Xoshiro128 rnd( BenchSeed );
+      FlameHistogram_t histogram( size * superSampling, size * superSampling );
+      FillRandom( histogram, rnd );
+
+      const auto copyName = std::string( "resolve/planar_tiled/ss2/colors_and_copy_bgr8" );
+      if ( suite.IsEnabled( copyName ) )
+      {
+         std::vector<Color3_8> colors( size * size );
+         std::vector<uint8_t> display( size * size * 3 );
+         const auto seconds = TimePerCall( options.minSeconds, [&]()
+         {
+            histogram.Resolve( colors.begin(), colors.end(), superSampling, options.maxThreads );
+            auto pixel = display.data();
+            for ( auto& color : colors )
+            {
+               color.CopyToInverse( pixel );
+               pixel += 3;
+            }
+         } );
+         suite.Add( copyName, seconds * 1e3, "ms" );
+      }
+
+      struct Format
+      {
+         const char* name;
+         ChannelOrder order;
+         PixelType type;
+      };
+      for ( const auto& format : { Format{ "bgr8", ChannelOrder::Bgr, PixelType::UInt8 }, Format{ "rgba8", ChannelOrder::Rgba, PixelType::UInt8 },
+                                   Format{ "rgb16", ChannelOrder::Rgb, PixelType::UInt16 }, Format{ "rgb_float", ChannelOrder::Rgb, PixelType::Float } } )
+      {
+         const auto name = std::string( "resolve/planar_tiled/ss2/view_" ) + format.name;
+         if ( !suite.IsEnabled( name ) ) continue;
+
+         PixelFormat pixelFormat;
+         pixelFormat.order = format.order;
+         pixelFormat.type = format.type;
+         ImageBuffer image( size, size, pixelFormat );
+         const auto seconds = TimePerCall( options.minSeconds, [&]()
+         {
+            histogram.Resolve( image.GetView(), superSampling, options.maxThreads );
+         } );
+         suite.Add( name, seconds * 1e3, "ms" );
+      }
+   }
+
+   //! \brief Checks that hot entries keep gaining color: two histograms whose entry has 2^24 white hits each, as after
+   //!        a long or resumed render, get hits of one color and are added. The sums have to be those of all hits
+   void BenchColorSums( BenchSuite& suite )
+   {
+      const auto name = std::string( "histogram/color_sum_errors" );
+      if ( !suite.IsEnabled( name ) ) return;
+
+      const uint32_t hotCount = 1u << 24;
+      const uint32_t hits = 1000;
+      const Color3_8 color( 255, 1, 0 );
+      FlameHistogram_t first( 16, 16 ), second( 16, 16 );
+      const auto idx = first.GetLayout().GetIndex( 3, 5 );
+      for ( auto histogram : { &first, &second } )
+      {
+         histogram->GetCounts()[idx] = hotCount;
+         for ( size_t channel = 0; channel < FlameHistogram_t::Channels; channel++ ) histogram->GetColorSums( channel )[idx] = uint64_t( hotCount ) * 255;
+         histogram->MarkOccupied( idx, idx + 1 );
+      }
+      for ( uint32_t hit = 0; hit < hits; hit++ ) first.AddAt( idx, color );
+      AddHistogram( first, second );
+
+      const auto white = 2 * uint64_t( hotCount ) * 255;
+      const uint64_t expected[] = { white + hits * color.r, white + hits * color.g, white + hits * color.b };
+      size_t errors = first.GetCounts()[idx] == 2 * hotCount + hits ? 0 : 1;
+      for ( size_t channel = 0; channel < FlameHistogram_t::Channels; channel++ )
+      {
+         if ( first.GetColorSums( channel )[idx] != expected[channel] ) errors++;
+      }
+      suite.AddCheck( name, static_cast<double>( errors ), 0.0, "planes" );
+   }
+
+   //! \brief Runs the histogram benchmarks for every storage
+   void BenchHistograms( BenchSuite& suite )
+   {
+      BenchColorSums( suite );
+      BenchScatter<SimpleHistogram_t>( suite, "aos" );
+      BenchScatter<PlanarHistogram<LinearLayout>>( suite, "planar" );
+      BenchScatter<PlanarHistogram<TiledLayout>>( suite, "planar_tiled" );
+      //The default policy asks for transparent huge pages, the difference to regular pages is the cost of TLB misses
+      MemoryPolicy smallPages;
+      smallPages.hugePages = HugePages::None;
+      BenchScatter<PlanarHistogram<TiledLayout>>( suite, "planar_tiled_small_pages", smallPages );
+      MemoryPolicy hugePages;
+      hugePages.hugePages = HugePages::Explicit;
+      BenchScatter<PlanarHistogram<TiledLayout>>( suite, "planar_tiled_explicit_huge_pages", hugePages );
+      BenchMerge<SimpleHistogram_t>( suite, "aos" );
+      BenchMerge<PlanarHistogram<LinearLayout>>( suite, "planar" );
+      BenchMerge<PlanarHistogram<TiledLayout>>( suite, "planar_tiled" );
+      BenchResolve<SimpleHistogram_t>( suite, "aos" );
+      BenchResolve<PlanarHistogram<LinearLayout>>( suite, "planar" );
+      BenchResolve<PlanarHistogram<TiledLayout>>( suite, "planar_tiled" );
+      BenchResolveFormats( suite );
+   }
+}
+
+int main( int argc, char** argv )
+{
+   BenchOptions options;
+   std::vector<std::string> args( argv + 1, argv + argc );
+   for ( size_t idx = 0; idx + 1 < args.size(); idx += 2 )
+   {
+      const auto& arg = args[idx];
+      const auto& value = args[idx + 1];
+      if ( arg == "--filter" ) options.filter = value;
+      else if ( arg == "--min-time" ) options.minSeconds = std::stod( value );
+      else if ( arg == "--threads" ) options.maxThreads = std::max<size_t>( 1, std::stoul( value ) );
+      else if ( arg == "--size" ) options.imageSize = std::stoul( value );
+      else if ( arg == "--out" ) options.outPath = value;
+      else
+      {
+         std::cerr << "Unknown argument " << arg << std::endl;
+         return 1;
+      }
+   }
+
+   BenchSuite suite( options );
+   BenchVariations( suite );
+   BenchFunctionComplexity( suite );
+   BenchMath( suite );
+   BenchMathDensity( suite );
+   BenchRandom( suite );
+   BenchCalculatorScaling( suite );
+   BenchScheduler( suite );
+   BenchSymmetry( suite );
+   BenchConvergence( suite );
+   BenchConvergenceReset( suite );
+   BenchGenomeLoading( suite );
+   BenchGenomeSwap( suite );
+   BenchSnapshot( suite );
+   BenchCheckpoint( suite );
+   BenchDistributed( suite );
+   BenchOutOfCore( suite );
+   BenchHistograms( suite );
+
+   if ( options.outPath.empty() )
+   {
+      suite.WriteJson( std::cout );
+   }
+   else
+   {
+      std::ofstream file( options.outPath );
+      suite.WriteJson( file );
+   }
+   return suite.HasFailedChecks() ? 1 : 0;
+}
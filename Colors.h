@@ -1,6 +1,8 @@
 #pragma once
 #include <stdint.h>
 #include <type_traits>
+#include <cstring>
+#include <limits>
 
 #include "TypeUtil.h"
 
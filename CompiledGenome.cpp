@@ -0,0 +1,137 @@
+#include "CompiledGenome.h"
+#include <utility>
+
+namespace flame
+{
+   namespace
+   {
+      //Variations that have specialized kernels, identified by their position in this list
+      template<size_t Id>
+      struct KnownVariation;
+
+      template<>
+      struct KnownVariation<0>
+      {
+         static cv::Point2f Apply( const cv::Point2f& p ) { return impl::VariationLinear( p ); }
+      };
+
+      template<>
+      struct KnownVariation<1>
+      {
+         static cv::Point2f Apply( const cv::Point2f& p ) { return impl::VariationSpherical( p ); }
+      };
+
+      template<>
+      struct KnownVariation<2>
+      {
+         static cv::Point2f Apply( const cv::Point2f& p ) { return impl::VariationSinusoidal( p ); }
+      };
+
+      template<>
+      struct KnownVariation<3>
+      {
+         static cv::Point2f Apply( const cv::Point2f& p ) { return impl::VariationSwirl( p ); }
+      };
+
+      template<>
+      struct KnownVariation<4>
+      {
+         static cv::Point2f Apply( const cv::Point2f& p ) { return impl::VariationHeart( p ); }
+      };
+
+      constexpr size_t KnownVariationCount = 5;
+
+      //! \brief Returns the id of the given variation, or KnownVariationCount if it has no specialized kernels
+      size_t GetVariationId( Variations::Func_t func )
+      {
+         const Variations::Func_t known[] = {
+            Variations::Linear, Variations::Spherical, Variations::Sinusoidal, Variations::Swirl, Variations::Heart
+         };
+         for ( size_t id = 0; id < KnownVariationCount; id++ )
+         {
+            if ( known[id] == func ) return id;
+         }
+         return KnownVariationCount;
+      }
+
+      template<size_t Id>
+      cv::Point2f ApplyVariation( const cv::Point2f& p, const CompiledVariation& variation )
+      {
+         const auto& c = variation.coefficients;
+         return variation.weight * KnownVariation<Id>::Apply( { p.x * c.a + p.y * c.b + c.c, p.x * c.d + p.y * c.e + c.f } );
+      }
+
+      template<size_t... Ids>
+      cv::Point2f CompiledKernel( const cv::Point2f& point, const CompiledVariation* variations )
+      {
+         cv::Point2f ret;
+         size_t idx = 0;
+         //Braced initializers are evaluated in order, which unrolls the sum over the variations
+         const int unroll[] = { ( ret += ApplyVariation<Ids>( point, variations[idx++] ), 0 )... };
+         (void)unroll;
+         return ret;
+      }
+
+      //! \brief Decodes a combination (the variation ids as digits of a number in base KnownVariationCount, the
+      //!        first variation being the most significant digit) into the kernel for it
+      template<size_t Combination, size_t Remaining, size_t... Ids>
+      struct KernelForCombination
+      {
+         static CompiledKernel_t Get()
+         {
+            return KernelForCombination<Combination / KnownVariationCount, Remaining - 1, Combination % KnownVariationCount, Ids...>::Get();
+         }
+      };
+
+      template<size_t Combination, size_t... Ids>
+      struct KernelForCombination<Combination, 0, Ids...>
+      {
+         static CompiledKernel_t Get() { return CompiledKernel<Ids...>; }
+      };
+
+      template<size_t VariationCount, size_t... Combinations>
+      std::vector<CompiledKernel_t> MakeKernelTable( std::index_sequence<Combinations...> )
+      {
+         return{ KernelForCombination<Combinations, VariationCount>::Get()... };
+      }
+
+      //! \brief Kernels for every combination of known variations, indexed by the variation count - 1 and then
+      //!        by the combination
+      const std::vector<std::vector<CompiledKernel_t>>& GetKernelTables()
+      {
+         static const std::vector<std::vector<CompiledKernel_t>> tables = {
+            MakeKernelTable<1>( std::make_index_sequence<KnownVariationCount>() ),
+            MakeKernelTable<2>( std::make_index_sequence<KnownVariationCount * KnownVariationCount>() ),
+            MakeKernelTable<3>( std::make_index_sequence<KnownVariationCount * KnownVariationCount * KnownVariationCount>() )
+         };
+         static_assert( CompiledFunction::MaxSpecializedVariations == 3, "One kernel table per variation count" );
+         return tables;
+      }
+   }
+
+   CompiledFunction::CompiledFunction( const FlameFunction& function ) :
+      _kernel( nullptr ),
+      _variations(),
+      _function( &function )
+   {
+      const auto& variations = function.GetVariations();
+      if ( variations.empty() || variations.size() > MaxSpecializedVariations ) return;
+
+      size_t combination = 0;
+      for ( size_t idx = 0; idx < variations.size(); idx++ )
+      {
+         const auto id = GetVariationId( variations[idx].func );
+         if ( id == KnownVariationCount ) return;
+         combination = combination * KnownVariationCount + id;
+         _variations[idx] = { variations[idx].coefficients, variations[idx].weight };
+      }
+      _kernel = GetKernelTables()[variations.size() - 1][combination];
+   }
+
+   CompiledGenome::CompiledGenome( const FlameFunctionSet& functions ) :
+      _source( functions )
+   {
+      _functions.reserve( functions.GetFunctions().size() );
+      for ( const auto& pair : functions.GetFunctions() ) _functions.emplace_back( pair.second );
+   }
+}
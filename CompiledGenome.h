@@ -0,0 +1,69 @@
+#pragma once
+#include "FlameFunctions.h"
+#include <array>
+#include <vector>
+
+namespace flame
+{
+
+   //! \brief Affine transform and weight of one variation within a CompiledFunction
+   struct CompiledVariation
+   {
+      Coefficients coefficients;
+      float weight;
+   };
+
+   //! \brief Applies all variations of a compiled function to a point, with the affine transforms and the weighted
+   //!        sum inlined
+   using CompiledKernel_t = cv::Point2f( *)( const cv::Point2f& point, const CompiledVariation* variations );
+
+   //! \brief A FlameFunction that was turned into a kernel specialized for its combination of variations. This
+   //!        replaces one indirect call per variation with a single indirect call into straight-line code.
+   //!        Functions with more than MaxSpecializedVariations or unknown variations call the FlameFunction, which
+   //!        has to outlive the compiled function
+   class CompiledFunction
+   {
+   public:
+      static constexpr size_t MaxSpecializedVariations = 3;
+
+      explicit CompiledFunction( const FlameFunction& function );
+
+      cv::Point2f operator()( const cv::Point2f& point ) const
+      {
+         return _kernel ? _kernel( point, _variations.data() ) : ( *_function )( point );
+      }
+
+      //! \brief True if the function runs through a specialized kernel
+      bool IsSpecialized() const { return _kernel != nullptr; }
+
+      const Color3_8& GetColor() const { return _function->GetColor(); }
+      auto IsColorPreserving() const { return _function->IsColorPreserving(); }
+
+   private:
+      CompiledKernel_t _kernel;
+      std::array<CompiledVariation, MaxSpecializedVariations> _variations;
+      const FlameFunction* _function;
+   };
+
+   //! \brief All functions of a FlameFunctionSet as CompiledFunctions. FlameFunctionSet stays the authoring format,
+   //!        the compiled genome is built from it before iterating and has to be rebuilt after changes. The set has
+   //!        to outlive the compiled genome
+   class CompiledGenome
+   {
+   public:
+      explicit CompiledGenome( const FlameFunctionSet& functions );
+
+      //! \brief Picks a random function according to the probabilities, see FlameFunctionSet::PickFunctionIndex
+      const CompiledFunction& PickFunction( uint32_t draw ) const
+      {
+         return _functions[_source.PickFunctionIndex( draw )];
+      }
+
+      const auto& GetFunctions() const { return _functions; }
+
+   private:
+      const FlameFunctionSet& _source;
+      std::vector<CompiledFunction> _functions;
+   };
+
+}
@@ -0,0 +1,138 @@
+#include "Convergence.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+namespace flame
+{
+   namespace
+   {
+      constexpr float Ln2 = 0.693147181f;
+
+      //! \brief Counts below this use the exact variance
+      constexpr uint32_t SmallCounts = 32;
+
+      //! \brief Variance of log2( k ) for a Poisson distributed k with the given mean, where k = 0 resolves to 0 like
+      //!        k = 1. For large means it approaches 1 / ( mean * ln 2^2 ), but for small ones that is far too high:
+      //!        a pixel with a single hit is black, and one with a mean of 1 has a variance of 0.32 instead of 2.1
+      float LogPoissonVariance( uint32_t mean )
+      {
+         double sum = 0.0, sumSquares = 0.0;
+         auto logProbability = -static_cast<double>( mean );
+         for ( uint32_t k = 1; k < mean * 8 + 16; k++ )
+         {
+            logProbability += std::log( static_cast<double>( mean ) / k );
+            const auto value = std::log2( static_cast<double>( k ) );
+            sum += std::exp( logProbability ) * value;
+            sumSquares += std::exp( logProbability ) * value * value;
+         }
+         return static_cast<float>( sumSquares - sum * sum );
+      }
+
+      float VarianceOfLog2( uint32_t count )
+      {
+         static const auto smallCounts = []()
+         {
+            std::vector<float> variances( SmallCounts );
+            for ( uint32_t count = 1; count < SmallCounts; count++ ) variances[count] = LogPoissonVariance( count );
+            return variances;
+         }();
+         return count < SmallCounts ? smallCounts[count] : 1.f / ( count * Ln2 * Ln2 );
+      }
+   }
+
+   ConvergenceTracker::ConvergenceTracker( size_t width, size_t height, size_t superSampling, const ConvergenceSettings& settings ) :
+      _superSampling( superSampling ),
+      _settings( settings ),
+      _tiles( width, height, superSampling ),
+      _tileNoise( _tiles.GetTileCount(), 0.f ),
+      _isInRegion( _tiles.GetTileCount(), true ),
+      _maxCount( 0 )
+   {
+      const auto& region = settings.region;
+      if ( region.x1 <= region.x0 || region.y1 <= region.y0 ) return;
+
+      for ( size_t tile = 0; tile < _tiles.GetTileCount(); tile++ )
+      {
+         //Tiles are in histogram coordinates, the region in output pixels
+         const auto rect = _tiles.GetTileRect( tile );
+         _isInRegion[tile] = rect.x0 < region.x1 * superSampling && rect.x1 > region.x0 * superSampling &&
+                             rect.y0 < region.y1 * superSampling && rect.y1 > region.y0 * superSampling;
+      }
+   }
+
+   void ConvergenceTracker::Update( const FlameHistogram_t& histogram, const DirtyTiles* changes, size_t threadBudget )
+   {
+      _maxCount = std::max( _maxCount, changes ? changes->GetMaxCount() : histogram.MaxCount( threadBudget ) );
+
+      const auto ss = _superSampling;
+      const auto scale = 1.f / ( ss * ss );
+      ParallelFor( _tiles.GetTileCount(), threadBudget, [&]( size_t tile )
+      {
+         if ( changes && !changes->IsDirty( tile ) ) return;
+
+         const auto rect = _tiles.GetTileRect( tile );
+         double sumSquares = 0.0;
+         size_t pixels = 0;
+         for ( auto y = rect.y0; y < rect.y1; y += ss )
+         {
+            for ( auto x = rect.x0; x < rect.x1; x += ss )
+            {
+               //The variances of the subsamples add up
+               float variance = 0.f;
+               for ( auto ssy = y; ssy < y + ss; ssy++ )
+               {
+                  for ( auto ssx = x; ssx < x + ss; ssx++ )
+                  {
+                     const auto count = histogram.GetCount( ssx, ssy );
+                     if ( !count ) continue;
+                     //The resolve scales the average color, so brighter colors carry more of the noise
+                     const auto color = histogram.GetColor( ssx, ssy );
+                     const auto colorSquared = ( float( color.r ) * color.r + float( color.g ) * color.g + float( color.b ) * color.b ) / 3.f;
+                     variance += colorSquared * VarianceOfLog2( count );
+                  }
+               }
+               sumSquares += variance;
+               pixels++;
+            }
+         }
+         _tileNoise[tile] = pixels ? static_cast<float>( std::sqrt( sumSquares / pixels ) ) * scale : 0.f;
+      } );
+   }
+
+   void ConvergenceTracker::Reset()
+   {
+      _maxCount = 0;
+      std::fill( _tileNoise.begin(), _tileNoise.end(), 0.f );
+   }
+
+   float ConvergenceTracker::GetTileNoise( size_t tile ) const
+   {
+      const auto logMaxCount = std::log2( static_cast<float>( _maxCount ) );
+      return logMaxCount > 0.f ? _tileNoise[tile] / logMaxCount : 0.f;
+   }
+
+   float ConvergenceTracker::GetNoise() const
+   {
+      std::vector<float> noise;
+      noise.reserve( _tileNoise.size() );
+      for ( size_t tile = 0; tile < _tileNoise.size(); tile++ )
+      {
+         if ( _isInRegion[tile] && _tileNoise[tile] > 0.f ) noise.push_back( GetTileNoise( tile ) );
+      }
+      if ( noise.empty() || _maxCount < 2 ) return std::numeric_limits<float>::infinity();
+
+      const auto quantile = std::min( std::max( _settings.quantile, 0.f ), 1.f );
+      const auto nth = noise.begin() + static_cast<ptrdiff_t>( quantile * ( noise.size() - 1 ) );
+      std::nth_element( noise.begin(), nth, noise.end() );
+      return *nth;
+   }
+
+   uint64_t ConvergenceTracker::PredictIterations( uint64_t iterations ) const
+   {
+      const auto noise = GetNoise();
+      if ( !_settings.IsEnabled() || !std::isfinite( noise ) ) return iterations * 2;
+      const auto ratio = noise / _settings.targetNoise;
+      return static_cast<uint64_t>( iterations * static_cast<double>( ratio ) * ratio );
+   }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "PlanarHistogram.h"
+#include <vector>
+
+namespace flame
+{
+   //! \brief When a render counts as converged. The noise is the expected error of the resolved pixels in 8 bit
+   //!        levels, see ConvergenceTracker
+   struct ConvergenceSettings
+   {
+      //! \brief Noise that the render stops at, 0 disables the stopping
+      float targetNoise = 0.f;
+      //! \brief Share of the tiles with hits that have to be within the target. The rest, usually the sparse fringe
+      //!        of the attractor, may stay noisier
+      float quantile = 0.95f;
+      //! \brief Region of interest in output pixels, only the tiles that overlap it count. Empty for the whole image
+      TileRect region = { 0, 0, 0, 0 };
+
+      bool IsEnabled() const { return targetNoise > 0.f; }
+   };
+
+   //! \brief Estimates the noise of a histogram per tile of DirtyTiles from its hit counts. Counts are Poisson
+   //!        distributed, so log2( count ) has a standard deviation of about 1 / ( sqrt( count ) * ln 2 ), exact values
+   //!        are used for small counts. The resolve scales the average color of every subsample by
+   //!        log2( count ) / ( log2( maxCount ) * superSampling^2 ), the error of a channel follows from that. The
+   //!        noise of a tile is the root mean square over all of its pixels. Empty pixels count as exact: the sparse
+   //!        fringe of an attractor keeps gaining pixels with single hits, and an average over the pixels with hits
+   //!        only would barely fall with more iterations
+   class ConvergenceTracker
+   {
+   public:
+      //! \param width, height Size of the histogram
+      ConvergenceTracker( size_t width, size_t height, size_t superSampling, const ConvergenceSettings& settings );
+
+      //! \brief Estimates the noise of the tiles that changed again, all tiles without changes. Has to see every
+      //!        change of the histogram, i.e. be called after every snapshot, before the changes are resolved
+      void Update( const FlameHistogram_t& histogram, const DirtyTiles* changes = nullptr, size_t threadBudget = 1 );
+      //! \brief Forgets the estimate, for a histogram that was cleared or decayed. The highest count only grows
+      //!        between two resets, so the next Update has to be over the whole histogram
+      void Reset();
+
+      //! \brief Noise of a tile, 0 for tiles without hits
+      float GetTileNoise( size_t tile ) const;
+      //! \brief Noise at the quantile of the tiles in the region that have hits, infinite without hits
+      float GetNoise() const;
+      bool IsConverged() const { return _settings.IsEnabled() && GetNoise() <= _settings.targetNoise; }
+
+      //! \brief Iterations that are expected to bring the noise down to the target, from the iterations so far. The
+      //!        noise falls with the square root of the iterations
+      uint64_t PredictIterations( uint64_t iterations ) const;
+
+      const DirtyTiles& GetTiles() const { return _tiles; }
+   private:
+      const size_t _superSampling;
+      const ConvergenceSettings _settings;
+      DirtyTiles _tiles;
+      //! \brief Noise of every tile without the 1 / log2( maxCount ) factor, which changes with every snapshot
+      std::vector<float> _tileNoise;
+      //! \brief Whether the tile overlaps the region of interest
+      std::vector<bool> _isInRegion;
+      uint32_t _maxCount;
+   };
+}
@@ -0,0 +1,212 @@
+#pragma once
+#include "SimdVec.h"
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+
+namespace flame
+{
+   //! \brief Precision of the math functions that the variations use
+   enum class MathPrecision
+   {
+      //! \brief Standard library for single points, Cephes polynomials (within 2 ulp) for batches
+      Exact,
+      //! \brief Lower degree polynomials and refined hardware estimates, see fastmath. For previews and drafts. Only
+      //!        the batch kernels use it, single points iterate with latency bound dependency chains, where the
+      //!        standard library was as fast in flames_bench
+      Fast
+   };
+
+   //! \brief Fast approximations of the functions that the variations need. They work on every vector type of
+   //!        SimdVec.h, and on floats. The error bounds are absolute and come from the Remez fits of the
+   //!        polynomials; flames_bench measures them (math/...)
+   namespace fastmath
+   {
+      //! \brief 1 / v from the hardware estimate and one Newton-Raphson step, relative error within 2e-7
+      template<typename Vec>
+      Vec Reciprocal( const Vec& v )
+      {
+         using namespace simd;
+         const auto estimate = ReciprocalEstimate( v );
+         return estimate * ( Vec::Broadcast( 2.f ) - v * estimate );
+      }
+
+      //! \brief Square root from the reciprocal square root estimate and one Newton-Raphson step, relative error within
+      //!        3e-7. Returns 0 for v <= 0
+      template<typename Vec>
+      Vec Sqrt( const Vec& v )
+      {
+         using namespace simd;
+         auto r = ReciprocalSqrtEstimate( v );
+         r = r * ( Vec::Broadcast( 1.5f ) - Vec::Broadcast( 0.5f ) * v * r * r );
+         return Select( v > Vec::Broadcast( 0.f ), v * r, Vec::Broadcast( 0.f ) );
+      }
+
+      //Single floats have no estimate instructions, so the exact operations are the fast ones
+      template<>
+      inline simd::VecScalar Reciprocal<simd::VecScalar>( const simd::VecScalar& v ) { return{ 1.f / v.v }; }
+
+      template<>
+      inline simd::VecScalar Sqrt<simd::VecScalar>( const simd::VecScalar& v ) { return{ v.v > 0.f ? std::sqrt( v.v ) : 0.f }; }
+
+      //! \brief Largest argument of SinCos that the reduction with two constants handles, larger ones (e.g. the
+      //!        unbounded r^2 of swirl) take the exact path
+      constexpr float SinCosRange = 1024.f;
+      //! \brief Bound of the reduced argument of SinCos, like simd::SinCos has. It is a bit beyond pi/4, because the
+      //!        rounded quadrant of arguments close to the border between two quadrants can be the neighbouring one
+      constexpr float SinCosMaxReduced = 0.7855f;
+
+      //! \brief Sine and cosine. Reduction to [-pi/4, pi/4] with two constants, then a degree 5 polynomial for the
+      //!        sine (error 3e-6) and a degree 6 polynomial for the cosine (error 1e-7). Both results use both
+      //!        polynomials depending on the quadrant, so both are within 3e-6. The reduction is exact enough for
+      //!        |v| <= SinCosRange, lanes beyond it get the results of simd::SinCos
+      template<typename Vec>
+      void SinCos( const Vec& v, Vec& s, Vec& c )
+      {
+         using namespace simd;
+         const auto quadrant = Round( v * Vec::Broadcast( 0.636619772f ) );
+         auto r = v - quadrant * Vec::Broadcast( 1.5703125f );
+         r = r - quadrant * Vec::Broadcast( 4.838267948966e-4f );
+         r = Min( Max( r, Vec::Broadcast( -SinCosMaxReduced ) ), Vec::Broadcast( SinCosMaxReduced ) );
+
+         const auto r2 = r * r;
+         const auto sinPoly = r + r * r2 * ( Vec::Broadcast( -0.166647993f ) + r2 * Vec::Broadcast( 8.181713063e-3f ) );
+         auto cosPoly = Vec::Broadcast( -1.364234833e-3f );
+         cosPoly = cosPoly * r2 + Vec::Broadcast( 4.166050344e-2f );
+         cosPoly = cosPoly * r2 - Vec::Broadcast( 0.4999997976f );
+         cosPoly = cosPoly * r2 + Vec::Broadcast( 1.f );
+
+         //Quadrant modulo 4, see simd::SinCos
+         const auto q = quadrant - Vec::Broadcast( 4.f ) * Floor( quadrant * Vec::Broadcast( 0.25f ) );
+         const auto qOdd = ( q - Vec::Broadcast( 2.f ) * Floor( q * Vec::Broadcast( 0.5f ) ) ) > Vec::Broadcast( 0.5f );
+         const auto sinNegative = q > Vec::Broadcast( 1.5f );
+         const auto cosNegative = ( q > Vec::Broadcast( 0.5f ) ) & ( q < Vec::Broadcast( 2.5f ) );
+
+         const auto sinBase = Select( qOdd, cosPoly, sinPoly );
+         const auto cosBase = Select( qOdd, sinPoly, cosPoly );
+         s = Select( sinNegative, -sinBase, sinBase );
+         c = Select( cosNegative, -cosBase, cosBase );
+
+         //Large arguments are rare, the exact path only runs for batches that have one
+         const auto isOutOfRange = Abs( v ) > Vec::Broadcast( SinCosRange );
+         if ( AnyTrue( isOutOfRange ) )
+         {
+            Vec exactS, exactC;
+            simd::SinCos( v, exactS, exactC );
+            s = Select( isOutOfRange, exactS, s );
+            c = Select( isOutOfRange, exactC, c );
+         }
+      }
+
+      inline uint32_t FloatBits( float v )
+      {
+         uint32_t bits;
+         std::memcpy( &bits, &v, sizeof( bits ) );
+         return bits;
+      }
+
+      inline float BitsFloat( uint32_t bits )
+      {
+         float v;
+         std::memcpy( &v, &bits, sizeof( v ) );
+         return v;
+      }
+
+      //! \brief Same as above with an integer quadrant, rounding floats is a library call on SSE2. The range check
+      //!        comes first, so that the quadrant always fits into an int
+      template<>
+      inline void SinCos<simd::VecScalar>( const simd::VecScalar& v, simd::VecScalar& s, simd::VecScalar& c )
+      {
+         if ( !( std::abs( v.v ) <= SinCosRange ) )
+         {
+            simd::SinCos( v, s, c );
+            return;
+         }
+         const auto scaled = v.v * 0.636619772f;
+         const auto quadrant = static_cast<int>( scaled + ( scaled < 0.f ? -0.5f : 0.5f ) );
+         auto r = v.v - quadrant * 1.5703125f;
+         r = r - quadrant * 4.838267948966e-4f;
+         r = std::min( std::max( r, -SinCosMaxReduced ), SinCosMaxReduced );
+
+         const auto r2 = r * r;
+         const auto sinPoly = r + r * r2 * ( -0.166647993f + r2 * 8.181713063e-3f );
+         const auto cosPoly = ( ( -1.364234833e-3f * r2 + 4.166050344e-2f ) * r2 - 0.4999997976f ) * r2 + 1.f;
+
+         //Sign flips through the sign bit, random quadrants would mispredict branches
+         const bool odd = ( quadrant & 1 ) != 0;
+         auto sinBits = FloatBits( odd ? cosPoly : sinPoly ) ^ ( static_cast<uint32_t>( quadrant & 2 ) << 30 );
+         auto cosBits = FloatBits( odd ? sinPoly : cosPoly ) ^ ( static_cast<uint32_t>( ( quadrant + 1 ) & 2 ) << 30 );
+         s.v = BitsFloat( sinBits );
+         c.v = BitsFloat( cosBits );
+      }
+
+      template<typename Vec>
+      Vec Sin( const Vec& v )
+      {
+         Vec s, c;
+         fastmath::SinCos( v, s, c );
+         return s;
+      }
+
+      template<typename Vec>
+      Vec Cos( const Vec& v )
+      {
+         Vec s, c;
+         fastmath::SinCos( v, s, c );
+         return c;
+      }
+
+      //! \brief Arcus tangent. Arguments above 1 are mirrored with atan(x) = pi/2 - atan(1/x), then a degree 9
+      //!        odd polynomial over [0, 1] gives an error of 4.7e-5
+      template<typename Vec>
+      Vec Atan( const Vec& v )
+      {
+         using namespace simd;
+         const auto x = Abs( v );
+         const auto isBig = x > Vec::Broadcast( 1.f );
+         const auto t = Select( isBig, fastmath::Reciprocal( x ), x );
+
+         const auto t2 = t * t;
+         auto poly = Vec::Broadcast( 2.546897200e-2f );
+         poly = poly * t2 - Vec::Broadcast( 9.585334006e-2f );
+         poly = poly * t2 + Vec::Broadcast( 0.188191451f );
+         poly = poly * t2 - Vec::Broadcast( 0.332401368f );
+         poly = poly * t2 + Vec::Broadcast( 0.999992449f );
+         poly = poly * t;
+
+         const auto result = Select( isBig, Vec::Broadcast( 1.570796327f ) - poly, poly );
+         return Select( v < Vec::Broadcast( 0.f ), -result, result );
+      }
+
+      //The simd namespace has exact overloads for VecScalar, which the template arguments rule out
+      inline float Reciprocal( float v ) { return fastmath::Reciprocal<simd::VecScalar>( { v } ).v; }
+      inline float Sqrt( float v ) { return fastmath::Sqrt<simd::VecScalar>( { v } ).v; }
+      inline float Sin( float v ) { return fastmath::Sin<simd::VecScalar>( { v } ).v; }
+      inline float Cos( float v ) { return fastmath::Cos<simd::VecScalar>( { v } ).v; }
+      inline float Atan( float v ) { return fastmath::Atan<simd::VecScalar>( { v } ).v; }
+   }
+
+   //! \brief The math functions of one precision, for kernels that are instantiated per precision
+   template<MathPrecision Precision>
+   struct MathFunctions;
+
+   template<>
+   struct MathFunctions<MathPrecision::Exact>
+   {
+      template<typename Vec> static Vec Divide( const Vec& l, const Vec& r ) { return l / r; }
+      template<typename Vec> static Vec Sqrt( const Vec& v ) { return simd::Sqrt( v ); }
+      template<typename Vec> static Vec Sin( const Vec& v ) { return simd::Sin( v ); }
+      template<typename Vec> static Vec Atan( const Vec& v ) { return simd::Atan( v ); }
+      template<typename Vec> static void SinCos( const Vec& v, Vec& s, Vec& c ) { simd::SinCos( v, s, c ); }
+   };
+
+   template<>
+   struct MathFunctions<MathPrecision::Fast>
+   {
+      template<typename Vec> static Vec Divide( const Vec& l, const Vec& r ) { return l * fastmath::Reciprocal<Vec>( r ); }
+      template<typename Vec> static Vec Sqrt( const Vec& v ) { return fastmath::Sqrt<Vec>( v ); }
+      template<typename Vec> static Vec Sin( const Vec& v ) { return fastmath::Sin<Vec>( v ); }
+      template<typename Vec> static Vec Atan( const Vec& v ) { return fastmath::Atan<Vec>( v ); }
+      template<typename Vec> static void SinCos( const Vec& v, Vec& s, Vec& c ) { fastmath::SinCos<Vec>( v, s, c ); }
+   };
+}
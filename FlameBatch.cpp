@@ -0,0 +1,186 @@
+#include "FlameBatch.h"
+#include "FlameBatchKernels.h"
+#include <algorithm>
+
+#if defined(FLAME_SIMD_SSE2) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace flame
+{
+   simd::SimdLevel simd::DetectSimdLevel()
+   {
+#if defined(FLAME_SIMD_SSE2) && defined(_MSC_VER)
+      int info[4];
+      __cpuid( info, 0 );
+      const auto maxLeaf = info[0];
+      __cpuid( info, 1 );
+      const auto hasFma = ( info[2] & ( 1 << 12 ) ) != 0;
+      const auto osUsesXSave = ( info[2] & ( 1 << 27 ) ) != 0;
+      const auto hasAvx = ( info[2] & ( 1 << 28 ) ) != 0;
+      //The OS has to save the YMM registers on context switches as well
+      if ( maxLeaf >= 7 && hasFma && osUsesXSave && hasAvx && ( _xgetbv( 0 ) & 0x6 ) == 0x6 )
+      {
+         __cpuidex( info, 7, 0 );
+         if ( info[1] & ( 1 << 5 ) ) return SimdLevel::Avx2;
+      }
+      return SimdLevel::Sse2;
+#elif defined(FLAME_SIMD_SSE2) && defined(__GNUC__)
+      __builtin_cpu_init();
+      if ( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) ) return SimdLevel::Avx2;
+      return SimdLevel::Sse2;
+#else
+      return SimdLevel::Scalar;
+#endif
+   }
+
+   BatchVariation_t BatchKernels::Find( Variations::Func_t variation ) const
+   {
+      if ( variation == Variations::Linear ) return linear;
+      if ( variation == Variations::Spherical ) return spherical;
+      if ( variation == Variations::Sinusoidal ) return sinusoidal;
+      if ( variation == Variations::Swirl ) return swirl;
+      if ( variation == Variations::Heart ) return heart;
+      return nullptr;
+   }
+
+   const BatchKernels& GetBatchKernels()
+   {
+      return GetBatchKernels( simd::SimdLevel::Avx2 );
+   }
+
+   const BatchKernels& GetBatchKernels( simd::SimdLevel level )
+   {
+      return GetBatchKernels( level, MathPrecision::Exact );
+   }
+
+   const BatchKernels& GetBatchKernels( simd::SimdLevel level, MathPrecision precision )
+   {
+      static const auto supportedLevel = simd::DetectSimdLevel();
+      static const BatchKernels scalarKernels[] = {
+         impl::MakeBatchKernels<simd::VecScalar, MathPrecision::Exact>( "Scalar", simd::SimdLevel::Scalar ),
+         impl::MakeBatchKernels<simd::VecScalar, MathPrecision::Fast>( "Scalar fast", simd::SimdLevel::Scalar )
+      };
+#ifdef FLAME_SIMD_SSE2
+      static const BatchKernels sseKernels[] = {
+         impl::MakeBatchKernels<simd::VecSse, MathPrecision::Exact>( "SSE2", simd::SimdLevel::Sse2 ),
+         impl::MakeBatchKernels<simd::VecSse, MathPrecision::Fast>( "SSE2 fast", simd::SimdLevel::Sse2 )
+      };
+#endif
+      const auto precisionIdx = static_cast<size_t>( precision );
+
+      if ( level > supportedLevel ) level = supportedLevel;
+      if ( level == simd::SimdLevel::Avx2 )
+      {
+         if ( auto avxKernels = impl::GetBatchKernelsAvx2( precision ) ) return *avxKernels;
+         level = simd::SimdLevel::Sse2;
+      }
+#ifdef FLAME_SIMD_SSE2
+      if ( level == simd::SimdLevel::Sse2 ) return sseKernels[precisionIdx];
+#endif
+      return scalarKernels[precisionIdx];
+   }
+
+   WalkerBatch::WalkerBatch( const FlameFunctionSet& functions, const BatchKernels& kernels, const Xoshiro128& rnd ) :
+      _kernels( kernels ),
+      _rnd( rnd ),
+      _escapes( 0 ),
+      _x( Size ),
+      _y( Size ),
+      _colors( Size ),
+      _offsets( functions.GetFunctions().size() + 1 ),
+      _order( Size ),
+      _groupX( Size + kernels.laneWidth ),
+      _groupY( Size + kernels.laneWidth ),
+      _accX( Size + kernels.laneWidth ),
+      _accY( Size + kernels.laneWidth )
+   {
+      _functions.reserve( functions.GetFunctions().size() );
+      for ( const auto& pair : functions.GetFunctions() )
+      {
+         CompiledFunction compiled;
+         compiled.function = &pair.second;
+         for ( const auto& funcData : pair.second.GetVariations() )
+         {
+            compiled.variations.push_back( { kernels.Find( funcData.func ), funcData.func, funcData.coefficients, funcData.weight } );
+         }
+         _functions.push_back( std::move( compiled ) );
+      }
+
+      for ( size_t walker = 0; walker < Size; walker++ ) Respawn( walker );
+   }
+
+   void WalkerBatch::Step( const uint32_t* functionIndices )
+   {
+      //Counting sort of the walkers by their function
+      std::fill( _offsets.begin(), _offsets.end(), 0 );
+      for ( size_t walker = 0; walker < Size; walker++ ) _offsets[functionIndices[walker] + 1]++;
+      for ( size_t func = 1; func < _offsets.size(); func++ ) _offsets[func] += _offsets[func - 1];
+      for ( size_t walker = 0; walker < Size; walker++ ) _order[_offsets[functionIndices[walker]]++] = static_cast<uint32_t>( walker );
+
+      //The sort moved every offset to the end of its group, so the groups are [offset[func-1], offset[func])
+      uint32_t groupBegin = 0;
+      for ( size_t func = 0; func < _functions.size(); func++ )
+      {
+         const auto groupEnd = _offsets[func];
+         const auto count = static_cast<size_t>( groupEnd - groupBegin );
+         const auto paddedCount = ( ( count + _kernels.laneWidth - 1 ) / _kernels.laneWidth ) * _kernels.laneWidth;
+         const auto* order = _order.data() + groupBegin;
+         groupBegin = groupEnd;
+         if ( !count ) continue;
+
+         for ( size_t idx = 0; idx < count; idx++ )
+         {
+            _groupX[idx] = _x[order[idx]];
+            _groupY[idx] = _y[order[idx]];
+         }
+         std::fill( _groupX.begin() + count, _groupX.begin() + paddedCount, 0.f );
+         std::fill( _groupY.begin() + count, _groupY.begin() + paddedCount, 0.f );
+         std::fill( _accX.begin(), _accX.begin() + paddedCount, 0.f );
+         std::fill( _accY.begin(), _accY.begin() + paddedCount, 0.f );
+
+         const auto& compiled = _functions[func];
+         for ( const auto& variation : compiled.variations )
+         {
+            if ( variation.kernel )
+            {
+               variation.kernel( _groupX.data(), _groupY.data(), _accX.data(), _accY.data(), paddedCount,
+                                 variation.coefficients, variation.weight );
+               continue;
+            }
+
+            //Variation without batch kernel, evaluate it lane by lane
+            const auto& c = variation.coefficients;
+            for ( size_t idx = 0; idx < count; idx++ )
+            {
+               const auto x = _groupX[idx];
+               const auto y = _groupY[idx];
+               auto p = variation.func( { x * c.a + y * c.b + c.c, x * c.d + y * c.e + c.f } );
+               _accX[idx] += variation.weight * p.x;
+               _accY[idx] += variation.weight * p.y;
+            }
+         }
+
+         const auto isColorPreserving = compiled.function->IsColorPreserving();
+         for ( size_t idx = 0; idx < count; idx++ )
+         {
+            const auto walker = order[idx];
+            _x[walker] = _accX[idx];
+            _y[walker] = _accY[idx];
+            if ( !isColorPreserving ) _colors[walker] = compiled.function->GetColor();
+            if ( !std::isfinite( _x[walker] ) || !std::isfinite( _y[walker] ) )
+            {
+               Respawn( walker );
+               _escapes++;
+            }
+         }
+      }
+   }
+
+   void WalkerBatch::Respawn( size_t walker )
+   {
+      _x[walker] = ToMinusOneOne( _rnd() );
+      _y[walker] = ToMinusOneOne( _rnd() );
+   }
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "FlameFunctions.h"
+#include "SimdVec.h"
+#include "MathUtil.h"
+#include "FastMath.h"
+#include <vector>
+
+namespace flame
+{
+   //! \brief Applies the affine transform and one variation to a batch of points and adds the weighted result to
+   //!        the accumulators. The count has to be a multiple of the lane width of the kernel set
+   using BatchVariation_t = void( *)( const float* inX, const float* inY, float* accX, float* accY, size_t count,
+                                      const Coefficients& coefficients, float weight );
+
+   //! \brief Set of batch variation kernels for one instruction set and math precision
+   struct BatchKernels
+   {
+      const char* name;
+      simd::SimdLevel level;
+      MathPrecision precision;
+      size_t laneWidth;
+      BatchVariation_t linear;
+      BatchVariation_t spherical;
+      BatchVariation_t sinusoidal;
+      BatchVariation_t swirl;
+      BatchVariation_t heart;
+
+      //! \brief Returns the batch kernel for the given variation, or nullptr if there is none
+      BatchVariation_t Find( Variations::Func_t variation ) const;
+   };
+
+   //! \brief Returns the kernels for the best instruction set that this build and the executing CPU support
+   const BatchKernels& GetBatchKernels();
+
+   //! \brief Returns the kernels for the given instruction set. Falls back to the next lower instruction set if the
+   //!        requested one is not supported by this build or by the executing CPU
+   const BatchKernels& GetBatchKernels( simd::SimdLevel level );
+
+   //! \brief Returns the kernels for the given instruction set and math precision, with the same fallback as above
+   const BatchKernels& GetBatchKernels( simd::SimdLevel level, MathPrecision precision );
+
+   namespace impl
+   {
+      //! \brief Returns the AVX2 kernels, or nullptr if the build has no AVX2 support
+      const BatchKernels* GetBatchKernelsAvx2( MathPrecision precision );
+   }
+
+   //! \brief Structure of arrays state of independent chaos game walkers that are advanced together. Each step
+   //!        groups the walkers by the function they picked and runs the batch kernels over each group
+   class WalkerBatch
+   {
+   public:
+      static constexpr size_t Size = 256;
+
+      //! \param rnd Generator for the starting points of the walkers
+      WalkerBatch( const FlameFunctionSet& functions, const BatchKernels& kernels, const Xoshiro128& rnd );
+
+      //! \brief Advances every walker by one iteration
+      //! \param functionIndices Index of the function that each walker applies. Has to contain Size entries
+      void Step( const uint32_t* functionIndices );
+
+      float GetX( size_t walker ) const { return _x[walker]; }
+      float GetY( size_t walker ) const { return _y[walker]; }
+      const Color3_8& GetColor( size_t walker ) const { return _colors[walker]; }
+      //! \brief Number of times that a walker escaped to NaN or infinity and was respawned
+      uint64_t GetEscapes() const { return _escapes; }
+
+   private:
+      struct CompiledVariation
+      {
+         BatchVariation_t kernel;
+         Variations::Func_t func;
+         Coefficients coefficients;
+         float weight;
+      };
+
+      struct CompiledFunction
+      {
+         std::vector<CompiledVariation> variations;
+         const FlameFunction* function;
+      };
+
+      //! \brief Moves a walker that escaped to infinity back to a random starting point
+      void Respawn( size_t walker );
+
+      const BatchKernels& _kernels;
+      std::vector<CompiledFunction> _functions;
+      Xoshiro128 _rnd;
+      uint64_t _escapes;
+
+      std::vector<float> _x, _y;
+      std::vector<Color3_8> _colors;
+
+      //Scratch buffers for grouping the walkers by function
+      std::vector<uint32_t> _offsets, _order;
+      std::vector<float> _groupX, _groupY, _accX, _accY;
+   };
+}
@@ -0,0 +1,23 @@
+//This translation unit is compiled with AVX2 enabled (/arch:AVX2 or -mavx2 -mfma). Its code must only run after
+//simd::DetectSimdLevel() reported AVX2 support
+#include "FlameBatchKernels.h"
+
+namespace flame
+{
+   namespace impl
+   {
+      const BatchKernels* GetBatchKernelsAvx2( MathPrecision precision )
+      {
+#ifdef FLAME_SIMD_AVX2
+         static const BatchKernels kernels[] = {
+            MakeBatchKernels<simd::VecAvx2, MathPrecision::Exact>( "AVX2", simd::SimdLevel::Avx2 ),
+            MakeBatchKernels<simd::VecAvx2, MathPrecision::Fast>( "AVX2 fast", simd::SimdLevel::Avx2 )
+         };
+         return &kernels[static_cast<size_t>( precision )];
+#else
+         (void)precision;
+         return nullptr;
+#endif
+      }
+   }
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include "FlameBatch.h"
+#include "SimdVec.h"
+#include "FastMath.h"
+
+//Templated batch kernels. Only include this in the translation units that instantiate a kernel set
+
+namespace flame
+{
+   namespace impl
+   {
+      struct BatchOpLinear
+      {
+         template<typename Vec>
+         static void Apply( const Vec& x, const Vec& y, Vec& outX, Vec& outY )
+         {
+            outX = x;
+            outY = y;
+         }
+      };
+
+      template<MathPrecision Precision>
+      struct BatchOpSpherical
+      {
+         template<typename Vec>
+         static void Apply( const Vec& x, const Vec& y, Vec& outX, Vec& outY )
+         {
+            const auto rSqrInv = MathFunctions<Precision>::Divide( Vec::Broadcast( 1.f ), x * x + y * y );
+            outX = x * rSqrInv;
+            outY = y * rSqrInv;
+         }
+      };
+
+      template<MathPrecision Precision>
+      struct BatchOpSinusoidal
+      {
+         template<typename Vec>
+         static void Apply( const Vec& x, const Vec& y, Vec& outX, Vec& outY )
+         {
+            outX = MathFunctions<Precision>::Sin( x );
+            outY = MathFunctions<Precision>::Sin( y );
+         }
+      };
+
+      template<MathPrecision Precision>
+      struct BatchOpSwirl
+      {
+         template<typename Vec>
+         static void Apply( const Vec& x, const Vec& y, Vec& outX, Vec& outY )
+         {
+            Vec sinR, cosR;
+            MathFunctions<Precision>::SinCos( x * x + y * y, sinR, cosR );
+            outX = x * sinR - y * cosR;
+            outY = x * cosR + y * sinR;
+         }
+      };
+
+      template<MathPrecision Precision>
+      struct BatchOpHeart
+      {
+         template<typename Vec>
+         static void Apply( const Vec& x, const Vec& y, Vec& outX, Vec& outY )
+         {
+            using Math = MathFunctions<Precision>;
+            const auto r = Math::Sqrt( x * x + y * y );
+            const auto thetaR = Math::Atan( Math::Divide( x, y ) ) * r;
+            Vec sinT, cosT;
+            Math::SinCos( thetaR, sinT, cosT );
+            outX = r * sinT;
+            outY = -r * cosT;
+         }
+      };
+
+      //! \brief Affine transform, variation and weighted accumulation fused into one pass over the batch
+      template<typename Vec, typename Op>
+      void BatchVariation( const float* inX, const float* inY, float* accX, float* accY, size_t count,
+                           const Coefficients& coefficients, float weight )
+      {
+         const auto a = Vec::Broadcast( coefficients.a );
+         const auto b = Vec::Broadcast( coefficients.b );
+         const auto c = Vec::Broadcast( coefficients.c );
+         const auto d = Vec::Broadcast( coefficients.d );
+         const auto e = Vec::Broadcast( coefficients.e );
+         const auto f = Vec::Broadcast( coefficients.f );
+         const auto w = Vec::Broadcast( weight );
+
+         for ( size_t idx = 0; idx < count; idx += Vec::Width )
+         {
+            const auto x = Vec::Load( inX + idx );
+            const auto y = Vec::Load( inY + idx );
+            Vec vx, vy;
+            Op::Apply( x * a + y * b + c, x * d + y * e + f, vx, vy );
+            Vec::Store( accX + idx, Vec::Load( accX + idx ) + vx * w );
+            Vec::Store( accY + idx, Vec::Load( accY + idx ) + vy * w );
+         }
+      }
+
+      template<typename Vec, MathPrecision Precision>
+      BatchKernels MakeBatchKernels( const char* name, simd::SimdLevel level )
+      {
+         return{
+            name,
+            level,
+            Precision,
+            Vec::Width,
+            BatchVariation<Vec, BatchOpLinear>,
+            BatchVariation<Vec, BatchOpSpherical<Precision>>,
+            BatchVariation<Vec, BatchOpSinusoidal<Precision>>,
+            BatchVariation<Vec, BatchOpSwirl<Precision>>,
+            BatchVariation<Vec, BatchOpHeart<Precision>>
+         };
+      }
+   }
+}
@@ -1,86 +1,599 @@
 #include "FlameCalculator.h"
-#include <random>
+#include "FlameBatch.h"
+#include "CompiledGenome.h"
+#include "Trace.h"
+#include <stdexcept>
+#include <array>
 #include <opencv2/core/mat.hpp>
 
 namespace flame
 {
-   FlameCalculator::FlameCalculator( const FlameFunctionSet& functions, size_t width, size_t height, size_t superSampling ) :
-      _functions( functions ),
-      _histogram( width * superSampling, height * superSampling ),
+   namespace
+   {
+      //How many iterations are done between two checks for a snapshot request
+      constexpr auto IterationGranularity = 2 << 14;
+      //ScatterMode::Auto bins the hits of histograms with more entries than this. Their planes (4MB here) no longer
+      //fit into the L2 cache, from there on binning was faster in flames_bench
+      constexpr size_t BinnedScatterThreshold = 512 * 512;
+      //How many hits ahead AddHits prefetches the histogram entries
+      constexpr size_t PrefetchDistance = 8;
+
+      //! \brief Stream for calculators that were not given one, so that they don't all draw the same numbers
+      uint32_t NextDefaultStream()
+      {
+         static std::atomic<uint32_t> nextStream( 0 );
+         return nextStream++;
+      }
+   }
+
+   //! \brief The single walker of IterationMode::Scalar
+   struct FlameCalculator::ScalarWalker
+   {
+      ScalarWalker( const FlameFunctionSet& functions, uint64_t seed, uint32_t stream ) :
+         rnd( seed, stream ),
+         genome( functions )
+      {
+         point = { ToMinusOneOne( rnd() ), ToMinusOneOne( rnd() ) };
+      }
+
+      Xoshiro128 rnd;
+      const CompiledGenome genome;
+      cv::Point2f point;
+      Color3_8 lastColor;
+   };
+
+   //! \brief The walkers of IterationMode::Batch
+   struct FlameCalculator::BatchWalkers
+   {
+      BatchWalkers( const FlameFunctionSet& functions, MathPrecision precision, uint64_t seed, uint32_t stream ) :
+         walkers( functions, GetBatchKernels( simd::SimdLevel::Avx2, precision ), Xoshiro128( seed, stream ) ),
+         rnd( seed, stream )
+      {
+      }
+
+      WalkerBatch walkers;
+      Xoshiro128Lanes<8> rnd;
+      std::array<uint32_t, WalkerBatch::Size> draws;
+      std::array<uint32_t, WalkerBatch::Size> functionIndices;
+   };
+
+   FlameCalculator::FlameCalculator( const FlameFunctionSet& functions, size_t width, size_t height, size_t superSampling,
+                                     IterationMode mode, ScatterMode scatter, MathPrecision precision, const MemoryPolicy& memory ) :
+      _genomeHandle( nullptr ),
+      _functions( &functions ),
+      _genomeVersion( 0 ),
+      _bufferGenome(),
+      _snapshotGenome( 0 ),
+      _sharedHistogram( nullptr ),
+      _shard( 0 ),
+      _outOfCoreHistogram( nullptr ),
+      _histogramWidth( width * superSampling ),
+      _histogramHeight( height * superSampling ),
+      _layout( _histogramWidth, _histogramHeight ),
       _superSampling( superSampling ),
-      _isRunning( false )
+      _mode( mode ),
+      _precision( precision ),
+      _seed( 0 ),
+      _stream( NextDefaultStream() ),
+      _isRunning( false ),
+      _isIterating( false ),
+      _iterations( 0 ),
+      _iterationBudget( 0 ),
+      _chunkHits(),
+      _requestedEpoch( 0 ),
+      _acknowledgedEpoch( 0 ),
+      _workerEpoch( 0 ),
+      _epochIterations( 0 )
    {
+      _buffers.reserve( 2 );
+      for ( auto idx = 0; idx < 2; idx++ ) _buffers.emplace_back( _histogramWidth, _histogramHeight, memory );
+      Initialize( scatter );
    }
 
-   void FlameCalculator::Start()
+   FlameCalculator::FlameCalculator( const FlameFunctionSet& functions, SharedHistogram& sharedHistogram, size_t superSampling,
+                                     IterationMode mode, ScatterMode scatter, MathPrecision precision ) :
+      _genomeHandle( nullptr ),
+      _functions( &functions ),
+      _genomeVersion( 0 ),
+      _bufferGenome(),
+      _snapshotGenome( 0 ),
+      _sharedHistogram( &sharedHistogram ),
+      _shard( sharedHistogram.AssignShard() ),
+      _outOfCoreHistogram( nullptr ),
+      _histogramWidth( sharedHistogram.GetWidth() ),
+      _histogramHeight( sharedHistogram.GetHeight() ),
+      _layout( _histogramWidth, _histogramHeight ),
+      _superSampling( superSampling ),
+      _mode( mode ),
+      _precision( precision ),
+      _seed( 0 ),
+      _stream( NextDefaultStream() ),
+      _isRunning( false ),
+      _isIterating( false ),
+      _iterations( 0 ),
+      _iterationBudget( 0 ),
+      _chunkHits(),
+      _requestedEpoch( 0 ),
+      _acknowledgedEpoch( 0 ),
+      _workerEpoch( 0 ),
+      _epochIterations( 0 )
    {
-      if ( _isRunning ) throw std::exception( "Can't start FlameCalculator twice!" );
-      _isRunning = true;
+      Initialize( scatter );
+   }
+
+   FlameCalculator::FlameCalculator( const FlameFunctionSet& functions, OutOfCoreHistogram& outOfCoreHistogram, size_t superSampling,
+                                     IterationMode mode, MathPrecision precision ) :
+      _genomeHandle( nullptr ),
+      _functions( &functions ),
+      _genomeVersion( 0 ),
+      _bufferGenome(),
+      _snapshotGenome( 0 ),
+      _sharedHistogram( nullptr ),
+      _shard( 0 ),
+      _outOfCoreHistogram( &outOfCoreHistogram ),
+      _histogramWidth( outOfCoreHistogram.GetWidth() ),
+      _histogramHeight( outOfCoreHistogram.GetHeight() ),
+      _layout( _histogramWidth, _histogramHeight ),
+      _superSampling( superSampling ),
+      _mode( mode ),
+      _precision( precision ),
+      _seed( 0 ),
+      _stream( NextDefaultStream() ),
+      _isRunning( false ),
+      _isIterating( false ),
+      _iterations( 0 ),
+      _iterationBudget( 0 ),
+      _chunkHits(),
+      _requestedEpoch( 0 ),
+      _acknowledgedEpoch( 0 ),
+      _workerEpoch( 0 ),
+      _epochIterations( 0 )
+   {
+      Initialize( ScatterMode::Binned );
+   }
+
+   FlameCalculator::FlameCalculator( const GenomeHandle& genome, size_t width, size_t height, size_t superSampling,
+                                     IterationMode mode, ScatterMode scatter, MathPrecision precision, const MemoryPolicy& memory ) :
+      FlameCalculator( genome.Get()->functions, width, height, superSampling, mode, scatter, precision, memory )
+   {
+      _genomeHandle = &genome;
+      UseGenome( genome.Get() );
+      _bufferGenome[0] = _bufferGenome[1] = _genome->number;
+   }
+
+   FlameCalculator::FlameCalculator( const GenomeHandle& genome, SharedHistogram& sharedHistogram, size_t superSampling,
+                                     IterationMode mode, ScatterMode scatter, MathPrecision precision ) :
+      FlameCalculator( genome.Get()->functions, sharedHistogram, superSampling, mode, scatter, precision )
+   {
+      _genomeHandle = &genome;
+      UseGenome( genome.Get() );
+      _bufferGenome[0] = _bufferGenome[1] = _genome->number;
+   }
+
+   void FlameCalculator::Initialize( ScatterMode scatter )
+   {
+      if ( scatter == ScatterMode::Auto )
+      {
+         scatter = _layout.GetStorageSize() > BinnedScatterThreshold ? ScatterMode::Binned : ScatterMode::Direct;
+      }
+      if ( scatter == ScatterMode::Binned ) _binner = std::make_unique<HitBinner>( _layout.GetStorageSize() );
+      BuildPlotSymmetries();
+
+      _dirtyTiles.reserve( 2 );
+      for ( auto idx = 0; idx < 2; idx++ ) _dirtyTiles.emplace_back( _histogramWidth, _histogramHeight, _superSampling );
+      _mergedTileHits.resize( _dirtyTiles[0].GetTileCount() );
+      ActivateEpoch( 0 );
+   }
+
+   void FlameCalculator::BuildPlotSymmetries()
+   {
+      //Plot() maps the pixels of even extents onto each other, the signed permutations keep that range only on square
+      //ones. ToPixel() also accepts the last column or row of an odd extent, which has no image inside, so odd sizes
+      //take the matrix path
+      const auto isEven = _histogramWidth % 2 == 0 && _histogramHeight % 2 == 0;
+      const auto isSquare = _histogramWidth == _histogramHeight;
+      _plotSymmetries.clear();
+      for ( const auto& transform : MakeSymmetryGroup( _functions->GetPlotSymmetries() ) )
+      {
+         const auto isUnit = []( float v ) { return v == -1.f || v == 0.f || v == 1.f; };
+         PlotSymmetry symmetry;
+         symmetry.transform = transform;
+         symmetry.isPixelExact = isEven && isUnit( transform.a ) && isUnit( transform.b ) && isUnit( transform.d ) &&
+            isUnit( transform.e ) && ( isSquare || ( transform.b == 0.f && transform.d == 0.f ) );
+         symmetry.xx = static_cast<int>( transform.a );
+         symmetry.xy = static_cast<int>( transform.b );
+         symmetry.yx = static_cast<int>( transform.d );
+         symmetry.yy = static_cast<int>( transform.e );
+         _plotSymmetries.push_back( symmetry );
+      }
+   }
+
+   void FlameCalculator::UseGenome( GenomeHandle::VersionPtr genome )
+   {
+      _functions = &genome->functions;
+      _genome = std::move( genome );
+      BuildPlotSymmetries();
+      //The walkers start over like those of a new calculator with the same seed, so a swap plots the same hits as
+      //a restart with the new version would
+      _scalarWalker.reset();
+      _batchWalkers.reset();
+      _genomeVersion.store( _genome->number, std::memory_order_release );
+   }
+
+   void FlameCalculator::DiscardStaleHits( uint32_t epoch )
+   {
+      const auto buffer = epoch & 1;
+      const auto version = _genomeVersion.load( std::memory_order_relaxed );
+      if ( _bufferGenome[buffer] == version ) return;
+
+      //Only the dirty tiles can have hits, the rest of the buffer is clear already
+      auto& tiles = _dirtyTiles[buffer];
+      for ( size_t tile = 0; tile < tiles.GetTileCount(); tile++ )
+      {
+         if ( !tiles.IsDirty( tile ) ) continue;
+         if ( !_buffers.empty() ) _buffers[buffer].Clear( tiles.GetTileRect( tile ) );
+         tiles.ResetTile( tile );
+      }
+      _bufferGenome[buffer] = version;
+   }
+
+   FlameCalculator::~FlameCalculator()
+   {
+      Stop();
+   }
+
+   void FlameCalculator::SetSeed( uint64_t seed, uint32_t stream )
+   {
+      if ( _isRunning ) throw std::runtime_error( "Can't seed a running FlameCalculator!" );
+      _seed = seed;
+      _stream = stream;
+      _scalarWalker.reset();
+      _batchWalkers.reset();
+   }
+
+   void FlameCalculator::Start( uint64_t iterationBudget )
+   {
+      BeginIterating( iterationBudget );
       _executor = std::thread( [this]() { Iterate(); } );
    }
 
+   void FlameCalculator::Start( TaskScheduler& scheduler, uint64_t iterationBudget, TaskPriority priority )
+   {
+      BeginIterating( iterationBudget );
+      SubmitChunk( scheduler, priority );
+   }
+
+   void FlameCalculator::BeginIterating( uint64_t iterationBudget )
+   {
+      if ( _isRunning ) throw std::runtime_error( "Can't start FlameCalculator twice!" );
+      _iterationBudget = iterationBudget ? _iterations + iterationBudget : 0;
+      _isRunning = true;
+      //A snapshot that found the calculator idle switches the epoch on behalf of the worker, which has to be done
+      //before the worker starts switching on its own
+      std::lock_guard<std::mutex> guard( _snapshotMutex );
+      _isIterating = true;
+   }
+
    void FlameCalculator::Stop()
    {
       if ( !_isRunning ) return;
       _isRunning = false;
-      _executor.join();
+      Wait();
+   }
+
+   void FlameCalculator::Wait()
+   {
+      {
+         std::unique_lock<std::mutex> lock( _finishMutex );
+         _finished.wait( lock, [this]() { return !_isIterating.load(); } );
+      }
+      if ( _executor.joinable() ) _executor.join();
+      _isRunning = false;
    }
 
-   void FlameCalculator::TakeSnapshot(SimpleHistogram_t& otherHistogram) const
+   void FlameCalculator::Flush( FlameHistogram_t& snapshot )
    {
+      if ( _isIterating ) throw std::runtime_error( "Can't flush a running FlameCalculator!" );
+      if ( _outOfCoreHistogram ) return;
+      //Deferred tiles can be left in both buffers
+      TakeSnapshot( snapshot );
+      TakeSnapshot( snapshot );
+   }
+
+   SnapshotLatency FlameCalculator::TakeSnapshot( FlameHistogram_t& snapshot, DirtyTiles* changes, float minRelativeChange,
+                                                  uint64_t genomeVersion )
+   {
+      if ( _outOfCoreHistogram ) throw std::runtime_error( "Out-of-core FlameCalculators have no snapshots!" );
+      const auto locking = Trace::Clock_t::now();
       std::lock_guard<std::mutex> guard( _snapshotMutex );
-      _histogram.CopyTo( otherHistogram );
+      const auto start = Trace::Clock_t::now();
+
+      //A snapshot of another version starts out without the hits of this calculator
+      if ( genomeVersion != _snapshotGenome )
+      {
+         std::fill( _mergedTileHits.begin(), _mergedTileHits.end(), 0 );
+         _snapshotGenome = genomeVersion;
+      }
+
+      const auto nextEpoch = _requestedEpoch.load() + 1;
+      _requestedEpoch.store( nextEpoch, std::memory_order_release );
+
+      //The worker switches at its next chunk boundary. If it is not iterating, nobody writes to the buffers and
+      //the switch can be done on its behalf
+      while ( _acknowledgedEpoch.load( std::memory_order_acquire ) != nextEpoch )
+      {
+         if ( !_isIterating )
+         {
+            ActivateEpoch( nextEpoch );
+            break;
+         }
+         std::this_thread::yield();
+      }
+      const auto handedOff = Trace::Clock_t::now();
+
+      //Only the dirty tiles are merged. Tiles that are deferred keep their hits in the buffer, the worker continues
+      //adding to them once it switches back to it. With a shared histogram only the change tracking is buffered,
+      //the dirty tiles are copied from the shared histogram
+      auto retired = _buffers.empty() ? nullptr : &_buffers[( nextEpoch - 1 ) & 1];
+      auto& retiredTiles = _dirtyTiles[( nextEpoch - 1 ) & 1];
+      //Hits of another version stay where they are. The worker drops them once it switches back to the buffer if
+      //they are outdated, newer ones wait for a snapshot of their version
+      const auto isOtherGenome = genomeVersion && _bufferGenome[( nextEpoch - 1 ) & 1] != genomeVersion;
+      for ( size_t tile = 0; tile < retiredTiles.GetTileCount(); tile++ )
+      {
+         const auto hits = retiredTiles.GetHits( tile );
+         if ( isOtherGenome || !hits || hits < minRelativeChange * _mergedTileHits[tile] ) continue;
+
+         const auto rect = retiredTiles.GetTileRect( tile );
+         uint32_t maxCount;
+         if ( _sharedHistogram )
+         {
+            maxCount = _sharedHistogram->CopyTo( snapshot, rect );
+         }
+         else
+         {
+            maxCount = AddHistogram( snapshot, *retired, rect );
+            retired->Clear( rect );
+         }
+         retiredTiles.ResetTile( tile );
+         _mergedTileHits[tile] += hits;
+
+         if ( changes )
+         {
+            changes->MarkTile( tile );
+            changes->RaiseMaxCount( maxCount );
+         }
+      }
+      const auto merged = Trace::Clock_t::now();
+
+      //Still under the lock, which makes this the only writer of the snapshot side counters
+      _counters.lockWaits.Add( start - locking );
+      _counters.handoffs.Add( handedOff - start );
+      _counters.merges.Add( merged - handedOff );
+      _counters.lockHolds.Add( merged - start );
+      if ( Trace::IsEnabled() )
+      {
+         Trace::Record( "handoff", "snapshot", start, handedOff );
+         Trace::Record( "merge", "snapshot", handedOff, merged );
+      }
+
+      return{
+         std::chrono::duration_cast<std::chrono::microseconds>( handedOff - start ),
+         std::chrono::duration_cast<std::chrono::microseconds>( merged - handedOff ),
+         _epochIterations
+      };
    }
 
    void FlameCalculator::Iterate()
    {
-      //std::random_device rnd;
-      XorShiftRnd rnd;
-      std::uniform_real_distribution<float> zeroOneDistribution( 0.f, 1.f );
-      std::uniform_real_distribution<float> minusOneOneDistribution( -1.f, 1.f );
+      while ( IterateChunk() ) {}
+      FinishIterating();
+   }
 
-      cv::Point2f point = { minusOneOneDistribution( rnd ), minusOneOneDistribution( rnd ) };
-      Color3_8 lastColor;
+   void FlameCalculator::SubmitChunk( TaskScheduler& scheduler, TaskPriority priority )
+   {
+      scheduler.Submit( [this, &scheduler, priority]()
+      {
+         if ( IterateChunk() ) SubmitChunk( scheduler, priority );
+         else FinishIterating();
+      }, priority );
+   }
 
-      //How many iterations are done within each critical section
-      constexpr auto IterationGranularity = 2 << 14;
+   bool FlameCalculator::IterateChunk()
+   {
+      if ( !_isRunning ) return false;
+
+      BeginChunk();
+      const auto chunkSize = NextChunkSize( _mode == IterationMode::Batch ? WalkerBatch::Size : 1 );
+      if ( !chunkSize ) return false;
+
+      TraceScope trace( "iterate", "calculator" );
+      const auto start = Trace::Clock_t::now();
+      _chunkHits[0] = _chunkHits[1] = 0;
+      if ( _mode == IterationMode::Batch ) IterateBatch( chunkSize );
+      else IterateScalar( chunkSize );
+      if ( !_outOfCoreHistogram ) FlushHits();
+      _iterations += chunkSize;
+
+      _counters.iterations.Add( chunkSize );
+      _counters.rejected.Add( _chunkHits[0] );
+      _counters.plotted.Add( _chunkHits[1] );
+      _counters.chunks.Add( Trace::Clock_t::now() - start );
+      return true;
+   }
+
+   void FlameCalculator::FinishIterating()
+   {
+      if ( _outOfCoreHistogram ) FlushHits();
+      //Notified under the lock, Wait may destroy the calculator as soon as it sees the flag
+      std::lock_guard<std::mutex> guard( _finishMutex );
+      _isIterating = false;
+      _finished.notify_all();
+   }
 
-      while ( _isRunning )
+   void FlameCalculator::BeginChunk()
+   {
+      const auto requestedEpoch = _requestedEpoch.load( std::memory_order_acquire );
+      if ( requestedEpoch != _workerEpoch ) ActivateEpoch( requestedEpoch );
+
+      if ( _genomeHandle && _genomeHandle->GetVersion() != _genomeVersion.load( std::memory_order_relaxed ) )
+      {
+         auto genome = _genomeHandle->Get();
+         if ( genome->number == _genomeVersion.load( std::memory_order_relaxed ) ) return;
+         UseGenome( std::move( genome ) );
+         DiscardStaleHits( _workerEpoch );
+      }
+   }
+
+   void FlameCalculator::ActivateEpoch( uint32_t epoch )
+   {
+      DiscardStaleHits( epoch );
+      _workerEpoch = epoch;
+      _epochIterations = _iterations.load( std::memory_order_relaxed );
+      _activeHistogram = _buffers.empty() ? nullptr : &_buffers[epoch & 1];
+      _activeDirtyTiles = &_dirtyTiles[epoch & 1];
+      _acknowledgedEpoch.store( epoch, std::memory_order_release );
+   }
+
+   uint64_t FlameCalculator::NextChunkSize( uint64_t step ) const
+   {
+      uint64_t chunk = IterationGranularity;
+      if ( _iterationBudget )
       {
-         _snapshotMutex.lock();
+         chunk = std::min( chunk, _iterationBudget - std::min( _iterationBudget, _iterations.load() ) );
+      }
+      return ( ( chunk + step - 1 ) / step ) * step;
+   }
+
+   void FlameCalculator::IterateScalar( uint64_t iterations )
+   {
+      if ( !_scalarWalker ) _scalarWalker = std::make_unique<ScalarWalker>( *_functions, _seed, _stream );
+      auto& walker = *_scalarWalker;
 
-         for ( auto i = 0; i < IterationGranularity; i++ )
+      uint64_t escapes = 0;
+      for ( uint64_t i = 0; i < iterations; i++ )
+      {
+         auto& rndFunction = walker.genome.PickFunction( walker.rnd() );
+         walker.point = rndFunction( walker.point );
+         if ( !std::isfinite( walker.point.x ) || !std::isfinite( walker.point.y ) )
          {
-            auto& rndFunction = RandomFunction( zeroOneDistribution( rnd ) );
-            point = rndFunction( point );            
+            //Moved back to a random point like the walkers of a WalkerBatch, a NaN would never leave again
+            walker.point = { ToMinusOneOne( walker.rnd() ), ToMinusOneOne( walker.rnd() ) };
+            escapes++;
+         }
 
-            auto hx = static_cast<int>( ( point.x + 1 ) * ( _histogram.GetWidth() / 2 ) );
-            auto hy = static_cast<int>( ( point.y + 1 ) * ( _histogram.GetHeight() / 2 ) );
+         auto& curColor = rndFunction.IsColorPreserving() ? walker.lastColor : rndFunction.GetColor();
+         Plot( walker.point.x, walker.point.y, curColor );
+         walker.lastColor = curColor;
+      }
+      _counters.escapes.Add( escapes );
+   }
 
-            if ( hx < 0 || hx >= _histogram.GetWidth() || hy < 0 || hy >= _histogram.GetHeight() ) continue;
+   void FlameCalculator::IterateBatch( uint64_t iterations )
+   {
+      if ( !_batchWalkers ) _batchWalkers = std::make_unique<BatchWalkers>( *_functions, _precision, _seed, _stream );
+      auto& batch = *_batchWalkers;
+      auto& walkers = batch.walkers;
+      const auto escapes = walkers.GetEscapes();
 
-            auto& histogramEntry = _histogram[{hx, hy}];
-            histogramEntry.count++;
+      for ( uint64_t i = 0; i < iterations; i += WalkerBatch::Size )
+      {
+         batch.rnd.Fill( batch.draws.data(), batch.draws.size() );
+         for ( size_t walker = 0; walker < WalkerBatch::Size; walker++ )
+         {
+            batch.functionIndices[walker] = static_cast<uint32_t>( _functions->PickFunctionIndex( batch.draws[walker] ) );
+         }
+
+         walkers.Step( batch.functionIndices.data() );
 
-            auto& curColor = rndFunction.IsColorPreserving() ? lastColor : rndFunction.GetColor();
-            histogramEntry.color = histogramEntry.color.BlendWith( curColor, 0.5f );
-            lastColor = curColor;
+         for ( size_t walker = 0; walker < WalkerBatch::Size; walker++ )
+         {
+            Plot( walkers.GetX( walker ), walkers.GetY( walker ), walkers.GetColor( walker ) );
          }
+      }
+      _counters.escapes.Add( walkers.GetEscapes() - escapes );
+   }
 
-         _snapshotMutex.unlock();
+   bool FlameCalculator::ToPixel( float x, float y, int& hx, int& hy )
+   {
+      hx = static_cast<int>( ( x + 1 ) * ( _histogramWidth / 2 ) );
+      hy = static_cast<int>( ( y + 1 ) * ( _histogramHeight / 2 ) );
+      const auto isInside = hx >= 0 && hx < static_cast<int>( _histogramWidth ) && hy >= 0 && hy < static_cast<int>( _histogramHeight );
+      _chunkHits[isInside]++;
+      return isInside;
+   }
 
-         //std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+   void FlameCalculator::Plot( float x, float y, const Color3_8& color )
+   {
+      int hx, hy;
+      const auto isInside = ToPixel( x, y, hx, hy );
+      if ( isInside ) PlotPixel( hx, hy, color );
+
+      for ( const auto& symmetry : _plotSymmetries )
+      {
+         if ( symmetry.isPixelExact )
+         {
+            //Mirrors and quarter turns map [-1,1]^2 onto itself, so only points inside have images inside
+            _chunkHits[isInside]++;
+            if ( !isInside ) continue;
+            //Twice the pixel centers relative to the center of the extent are odd integers, which the signed
+            //permutation maps onto each other. Only used for even extents
+            const auto extentX = static_cast<int>( _histogramWidth );
+            const auto extentY = static_cast<int>( _histogramHeight );
+            const auto cx = 2 * hx + 1 - extentX;
+            const auto cy = 2 * hy + 1 - extentY;
+            PlotPixel( ( symmetry.xx * cx + symmetry.xy * cy + extentX - 1 ) / 2,
+                       ( symmetry.yx * cx + symmetry.yy * cy + extentY - 1 ) / 2, color );
+         }
+         else
+         {
+            const auto& c = symmetry.transform;
+            int sx, sy;
+            if ( ToPixel( x * c.a + y * c.b, x * c.d + y * c.e, sx, sy ) ) PlotPixel( sx, sy, color );
+         }
+      }
+   }
+
+   void FlameCalculator::PlotPixel( int hx, int hy, const Color3_8& color )
+   {
+      _activeDirtyTiles->Mark( hx, hy );
+      const auto idx = _layout.GetIndex( hx, hy );
+      if ( _binner )
+      {
+         _binner->Add( idx, color, [this]( size_t regionStart, const BinnedHit* hits, size_t count ) { AddHits( regionStart, hits, count ); } );
       }
+      else if ( _sharedHistogram ) _sharedHistogram->AddAt( _shard, idx, color );
+      else _activeHistogram->AddAt( idx, color );
    }
 
-   const FlameFunction& FlameCalculator::RandomFunction( float uniformRnd ) const
+   void FlameCalculator::AddHits( size_t regionStart, const BinnedHit* hits, size_t count )
    {
-      auto accum = 0.f;
-      for ( auto& func : _functions.GetFunctions() )
+      if ( _outOfCoreHistogram )
+      {
+         _outOfCoreHistogram->AddHits( regionStart, hits, count );
+         return;
+      }
+
+      if ( _sharedHistogram )
+      {
+         for ( size_t hit = 0; hit < count; hit++ )
+         {
+            if ( hit + PrefetchDistance < count ) _sharedHistogram->Prefetch( _shard, regionStart + hits[hit + PrefetchDistance].offset );
+            _sharedHistogram->AddAt( _shard, regionStart + hits[hit].offset, hits[hit].color );
+         }
+         return;
+      }
+
+      auto& histogram = *_activeHistogram;
+      for ( size_t hit = 0; hit < count; hit++ )
       {
-         accum += func.first;
-         if ( uniformRnd < accum ) return func.second;
+         if ( hit + PrefetchDistance < count ) histogram.Prefetch( regionStart + hits[hit + PrefetchDistance].offset );
+         histogram.AddAt( regionStart + hits[hit].offset, hits[hit].color );
       }
-      return _functions.GetFunctions().back().second;
+   }
+
+   void FlameCalculator::FlushHits()
+   {
+      if ( _binner ) _binner->Flush( [this]( size_t regionStart, const BinnedHit* hits, size_t count ) { AddHits( regionStart, hits, count ); } );
    }
 }
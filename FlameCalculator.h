@@ -1,37 +1,254 @@
 #pragma once
-#include "Histogram.h"
+#include "PlanarHistogram.h"
+#include "SharedHistogram.h"
+#include "OutOfCoreHistogram.h"
+#include "HitBinner.h"
 #include "FlameFunctions.h"
+#include "GenomeHandle.h"
+#include "FastMath.h"
+#include "Parallel.h"
+#include "Stats.h"
 #include <thread>
+#include <memory>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
+#include <chrono>
 
 namespace flame
 {
+
+   //! \brief How a FlameCalculator advances the chaos game
+   enum class IterationMode
+   {
+      //! \brief One walker, one function call per iteration
+      Scalar,
+      //! \brief A WalkerBatch of independent walkers, evaluated with the best SIMD kernels of the executing CPU
+      Batch
+   };
    
-   //! \brief Performs the calculations for a fractal flame into a histogram. This is done on a unique thread
+   //! \brief How a FlameCalculator writes its hits into the histogram
+   enum class ScatterMode
+   {
+      //! \brief Binned for histograms that are too big for the caches, direct otherwise
+      Auto,
+      //! \brief Every hit is added right away
+      Direct,
+      //! \brief Hits are collected per region of the histogram by a HitBinner and added in batches
+      Binned
+   };
+
+   //! \brief Timings of a single snapshot
+   struct SnapshotLatency
+   {
+      //! \brief Time until the worker switched to its other buffer
+      std::chrono::microseconds handoff;
+      //! \brief Time to add the retired buffer to the snapshot
+      std::chrono::microseconds merge;
+      //! \brief Iterations of the calculator whose hits are in the snapshot now. Exact unless tiles were deferred,
+      //!        see minRelativeChange of TakeSnapshot
+      uint64_t iterations;
+   };
+
+   //! \brief Performs the calculations for a fractal flame into a histogram. This is done on a unique thread, or in
+   //!        chunks on the workers of a TaskScheduler
    class FlameCalculator
    {
    public:
       using Ptr = std::unique_ptr<FlameCalculator>;
 
-      FlameCalculator( const FlameFunctionSet& functions, size_t width, size_t height, size_t superSampling );
+      //! \param precision Math of the batch kernels, IterationMode::Scalar always uses the exact math
+      //! \param memory Placement of the buffers. By default their pages land on the NUMA node of the worker that
+      //!        iterates, if the calculator mostly runs on the same one (see SchedulerSettings::pinThreads)
+      FlameCalculator( const FlameFunctionSet& functions, size_t width, size_t height, size_t superSampling,
+                       IterationMode mode = IterationMode::Batch, ScatterMode scatter = ScatterMode::Auto,
+                       MathPrecision precision = MathPrecision::Exact, const MemoryPolicy& memory = MemoryPolicy() );
+      //! \brief Creates a calculator that plots into one shard of the given shared histogram instead of its own
+      //!        buffers. Snapshots then copy the sum of all shards, so only the tiles change tracking is per
+      //!        calculator. The shared histogram has to outlive the calculator
+      FlameCalculator( const FlameFunctionSet& functions, SharedHistogram& sharedHistogram, size_t superSampling,
+                       IterationMode mode = IterationMode::Batch, ScatterMode scatter = ScatterMode::Auto,
+                       MathPrecision precision = MathPrecision::Exact );
+      //! \brief Creates a calculator that adds its hits straight to an out-of-core histogram. The hits are always
+      //!        binned, and the bins are kept from chunk to chunk until they are full, so the batches are as large as
+      //!        they get. Everything is in the histogram once the calculator stopped iterating, there are no
+      //!        snapshots. The histogram has to outlive the calculator
+      FlameCalculator( const FlameFunctionSet& functions, OutOfCoreHistogram& outOfCoreHistogram, size_t superSampling,
+                       IterationMode mode = IterationMode::Batch, MathPrecision precision = MathPrecision::Exact );
+      //! \brief Creates a calculator that follows the versions of the genome: every new version is picked up at the
+      //!        next chunk boundary, the walkers then start over and the hits of older versions are dropped from the
+      //!        buffers, which are reused as they are. The handle has to outlive the calculator
+      FlameCalculator( const GenomeHandle& genome, size_t width, size_t height, size_t superSampling,
+                       IterationMode mode = IterationMode::Batch, ScatterMode scatter = ScatterMode::Auto,
+                       MathPrecision precision = MathPrecision::Exact, const MemoryPolicy& memory = MemoryPolicy() );
+      //! \brief Creates a calculator that follows the versions of the genome and plots into a shared histogram. The
+      //!        calculator only drops its own tiles change tracking, the shared histogram has to be cleared once all
+      //!        of its calculators moved to the new version (see GetGenomeVersion)
+      FlameCalculator( const GenomeHandle& genome, SharedHistogram& sharedHistogram, size_t superSampling,
+                       IterationMode mode = IterationMode::Batch, ScatterMode scatter = ScatterMode::Auto,
+                       MathPrecision precision = MathPrecision::Exact );
+      //! \brief Stops iterating
+      ~FlameCalculator();
+
+      //! \brief Selects the random numbers of the calculator, has to be called before Start. Calculators with the
+      //!        same seed, stream, functions, settings and budget produce the same hits. Without a call, the
+      //!        calculators of a process get the streams 0, 1, 2, ... of seed 0 in the order they are created
+      //! \param stream Independent stream of the seed, e.g. the index of the calculator within a render
+      void SetSeed( uint64_t seed, uint32_t stream );
 
-      void Start();
+      //! \brief Starts iterating on the calculator's own thread
+      //! \param iterationBudget Number of iterations after which the calculator stops on its own, 0 for no limit.
+      //!        The budget is rounded up to whole steps of the iteration mode
+      void Start( uint64_t iterationBudget = 0 );
+      //! \brief Starts iterating on the workers of the scheduler, one task per chunk of iterations. Every chunk
+      //!        queues the next one, so snapshots have to wait until a worker picks it up. The scheduler has to
+      //!        outlive the iteration
+      void Start( TaskScheduler& scheduler, uint64_t iterationBudget = 0, TaskPriority priority = TaskPriority::Normal );
       void Stop();
+      //! \brief Blocks until the iteration budget is used up. Must not be called by a task of the scheduler that
+      //!        the calculator runs on
+      void Wait();
+
+      //! \brief Adds every hit that is not part of a snapshot yet to the given histogram. The calculator must not
+      //!        be iterating anymore. Does nothing for an out-of-core histogram, which has all hits already
+      void Flush( FlameHistogram_t& snapshot );
+
+      //! \brief Number of iterations done so far, updated after every chunk
+      uint64_t GetIterations() const { return _iterations; }
+      //! \brief Counters and timings so far, the worker side ones are updated after every chunk. Can be called
+      //!        while iterating
+      CalculatorStats GetStats() const { return _counters.Get(); }
+      //! \brief Version of the GenomeHandle that the worker iterates, 0 for a fixed genome. Can be called while
+      //!        iterating
+      uint64_t GetGenomeVersion() const { return _genomeVersion.load( std::memory_order_acquire ); }
 
-      void TakeSnapshot(SimpleHistogram_t& otherHistogram) const;
+      //! \brief Adds all hits since the last snapshot to the given histogram. The worker is never blocked by this:
+      //!        it writes into one of two buffers and switches to the other one at its next chunk boundary, after
+      //!        which the dirty tiles of the retired buffer are added to the snapshot and cleared. The same snapshot
+      //!        histogram (which may be shared by multiple calculators) has to be passed every time
+      //! \param snapshot Histogram that accumulates the hits
+      //! \param changes Optional, receives the tiles of the snapshot that changed (see Histogram::ResolveChanges)
+      //! \param minRelativeChange Tiles whose new hits are fewer than this fraction of the hits this calculator
+      //!        already merged for them stay in the buffer until they have enough. 0 merges every dirty tile
+      //! \param genomeVersion Version of the GenomeHandle that the snapshot holds the hits of, only hits of this
+      //!        version are merged. The worker drops the hits of older versions. 0 merges the hits of any version
+      //!        Throws for calculators of an out-of-core histogram
+      SnapshotLatency TakeSnapshot( FlameHistogram_t& snapshot, DirtyTiles* changes = nullptr, float minRelativeChange = 0.f,
+                                    uint64_t genomeVersion = 0 );
    private:
+      struct ScalarWalker;
+      struct BatchWalkers;
+
       void Iterate();
+      //! \brief Queues the next chunk on the scheduler
+      void SubmitChunk( TaskScheduler& scheduler, TaskPriority priority );
+      //! \brief Runs one chunk of iterations, returns false without iterating if the calculator is done
+      bool IterateChunk();
+      void FinishIterating();
+
+      //! \brief Common part of the Start overloads
+      void BeginIterating( uint64_t iterationBudget );
+      //! \brief Called by the worker before each chunk of iterations, switches buffers if a snapshot was requested
+      void BeginChunk();
+      //! \brief Makes the buffers of the given epoch the ones that the worker writes to
+      void ActivateEpoch( uint32_t epoch );
+      void Initialize( ScatterMode scatter );
+      //! \brief Switches to the given version of the genome: the walkers start over on the next chunk and the plot
+      //!        symmetries are built again
+      void UseGenome( GenomeHandle::VersionPtr genome );
+      void BuildPlotSymmetries();
+      //! \brief Drops the hits of the buffer of the given epoch if they belong to an older genome version. Only
+      //!        called by the side that owns the buffer
+      void DiscardStaleHits( uint32_t epoch );
+      //! \brief Number of iterations for the next chunk, a multiple of step. 0 once the budget is used up
+      uint64_t NextChunkSize( uint64_t step ) const;
+      void IterateScalar( uint64_t iterations );
+      void IterateBatch( uint64_t iterations );
 
-      const FlameFunction& RandomFunction( float uniformRnd ) const;
+      //! \brief Adds a hit at the given point (in [-1,1]^2) to the histogram, or to the binner. With plot symmetries,
+      //!        the images of the point are added as well
+      void Plot( float x, float y, const Color3_8& color );
+      //! \brief Histogram coordinates of a point, returns false if they are outside of the histogram. Counts the
+      //!        hit as plotted or rejected
+      bool ToPixel( float x, float y, int& hx, int& hy );
+      void PlotPixel( int hx, int hy, const Color3_8& color );
+      //! \brief Adds hits of the region of the HitBinner that starts at regionStart to the active histogram,
+      //!        prefetching a few hits ahead
+      void AddHits( size_t regionStart, const BinnedHit* hits, size_t count );
+      //! \brief Adds all hits that wait in the binner, has to be called before the next chunk can switch buffers.
+      //!        With an out-of-core histogram only once the iteration stops
+      void FlushHits();
 
-      const FlameFunctionSet& _functions;
-      SimpleHistogram_t _histogram;
+      //! \brief Null for a fixed genome
+      const GenomeHandle* _genomeHandle;
+      //! \brief Keeps the version that _functions belongs to alive, null for a fixed genome
+      GenomeHandle::VersionPtr _genome;
+      const FlameFunctionSet* _functions;
+      //! \brief Version that the worker iterates, written by the worker only
+      std::atomic<uint64_t> _genomeVersion;
+      //! \brief Genome version of the hits in each buffer, owned like the buffers themselves
+      uint64_t _bufferGenome[2];
+      //! \brief Genome version of the snapshot that _mergedTileHits belongs to
+      uint64_t _snapshotGenome;
+      //! \brief Double buffer, the worker writes into _buffers[epoch & 1]. Empty if a shared histogram is used
+      std::vector<FlameHistogram_t> _buffers;
+      SharedHistogram* _sharedHistogram;
+      size_t _shard;
+      OutOfCoreHistogram* _outOfCoreHistogram;
+      const size_t _histogramWidth, _histogramHeight;
+      const FlameHistogram_t::Layout_t _layout;
+      //! \brief Only used with ScatterMode::Binned
+      std::unique_ptr<HitBinner> _binner;
+
+      //! \brief Element of the group of SymmetryMode::Plot symmetries
+      struct PlotSymmetry
+      {
+         Coefficients transform;
+         //! \brief Mirrors on even sized histograms and quarter turns on even sized square ones map pixels onto
+         //!        pixels. Then the integer entries of the transform are applied to the pixel of the point, instead of
+         //!        transforming the point
+         bool isPixelExact;
+         int xx, xy, yx, yy;
+      };
+      //! \brief The identity is not part of it, empty without plot symmetries
+      std::vector<PlotSymmetry> _plotSymmetries;
+      std::vector<DirtyTiles> _dirtyTiles;
+      FlameHistogram_t* _activeHistogram;
+      DirtyTiles* _activeDirtyTiles;
+      //! \brief Hits per tile that were added to the snapshot so far
+      std::vector<uint64_t> _mergedTileHits;
       const size_t _superSampling;
+      const IterationMode _mode;
+      const MathPrecision _precision;
+      uint64_t _seed;
+      uint32_t _stream;
+      //! \brief Chaos game of the iteration mode, carries over from chunk to chunk and from Start to Start
+      std::unique_ptr<ScalarWalker> _scalarWalker;
+      std::unique_ptr<BatchWalkers> _batchWalkers;
 
       std::thread _executor;
-      mutable std::mutex _snapshotMutex;
+      //! \brief Signals the end of the iteration to Wait
+      std::mutex _finishMutex;
+      std::condition_variable _finished;
+      //! \brief Serializes snapshots and the start of the iteration, never taken by the worker
+      std::mutex _snapshotMutex;
       std::atomic_bool _isRunning;
+      std::atomic_bool _isIterating;
+      std::atomic<uint64_t> _iterations;
+      uint64_t _iterationBudget;
+      CalculatorCounters _counters;
+      //! \brief Hits of the current chunk, published to the counters at its end. Indexed by whether the hit was
+      //!        inside of the histogram
+      uint64_t _chunkHits[2];
+
+      //! \brief Epoch that the snapshot side asks the worker to switch to
+      std::atomic<uint32_t> _requestedEpoch;
+      //! \brief Epoch that the worker is writing to
+      std::atomic<uint32_t> _acknowledgedEpoch;
+      //! \brief Worker-local copy of the acknowledged epoch
+      uint32_t _workerEpoch;
+      //! \brief Iterations when the worker switched to its epoch, owned like the buffers
+      uint64_t _epochIterations;
    };
 
 }
@@ -1,4 +1,6 @@
 #include "FlameFunctions.h"
+#include <algorithm>
+#include <cmath>
 
 namespace flame
 {
@@ -43,6 +45,61 @@ namespace flame
       {
          return MakeRotationFunction( 2.0994f );
       }
+
+      //! \brief Linear part of l after r
+      Coefficients ComposeLinear( const Coefficients& l, const Coefficients& r )
+      {
+         return Coefficients::Build( l.a * r.a + l.b * r.d, l.a * r.b + l.b * r.e, 0,
+                                     l.d * r.a + l.e * r.d, l.d * r.b + l.e * r.e, 0 );
+      }
+
+      bool IsSameLinear( const Coefficients& l, const Coefficients& r )
+      {
+         constexpr float Tolerance = 1e-3f;
+         return std::abs( l.a - r.a ) < Tolerance && std::abs( l.b - r.b ) < Tolerance &&
+            std::abs( l.d - r.d ) < Tolerance && std::abs( l.e - r.e ) < Tolerance;
+      }
+
+      float SnapToUnit( float v )
+      {
+         constexpr float Tolerance = 1e-5f;
+         for ( auto unit : { -1.f, 0.f, 1.f } )
+         {
+            if ( std::abs( v - unit ) < Tolerance ) return unit;
+         }
+         return v;
+      }
+   }
+
+   std::vector<Coefficients> MakeSymmetryGroup( const std::vector<Symmetry>& generators )
+   {
+      //Mirrors and rotations by fractions of a full turn always generate a finite group, the limit only guards
+      //against rounding errors that would make the closure grow forever
+      constexpr size_t MaxGroupSize = 256;
+
+      std::vector<Coefficients> generatorMaps;
+      for ( auto symmetry : generators )
+      {
+         for ( const auto& function : MakeSymmetryFunction( symmetry ) ) generatorMaps.push_back( function.GetVariations()[0].coefficients );
+      }
+
+      std::vector<Coefficients> group = { Coefficients::Build( 1, 0, 0, 0, 1, 0 ) };
+      for ( size_t idx = 0; idx < group.size() && group.size() < MaxGroupSize; idx++ )
+      {
+         for ( const auto& generator : generatorMaps )
+         {
+            const auto element = ComposeLinear( generator, group[idx] );
+            const auto isKnown = std::any_of( group.begin(), group.end(), [&]( const Coefficients& c ) { return IsSameLinear( c, element ); } );
+            if ( !isKnown ) group.push_back( element );
+         }
+      }
+
+      group.erase( group.begin() );
+      for ( auto& element : group )
+      {
+         for ( auto& v : element.data ) v = SnapToUnit( v );
+      }
+      return group;
    }
 
    std::vector<FlameFunction> MakeSymmetryFunction( Symmetry symmetry )
@@ -75,4 +132,41 @@ namespace flame
       default: return{};
       }
    }
+
+   void FlameFunctionSet::BuildAliasTable()
+   {
+      //Vose's alias method: every column holds the probability mass of its own function plus a remainder of one
+      //other function, so that all columns are equally likely
+      const auto count = _functions.size();
+      _aliasTable.assign( count, { 0, 0 } );
+      if ( !count ) return;
+
+      auto sumOfProbabilities = 0.0;
+      for ( const auto& pair : _functions ) sumOfProbabilities += pair.first;
+
+      std::vector<double> scaled( count );
+      std::vector<uint32_t> small, large;
+      for ( size_t idx = 0; idx < count; idx++ )
+      {
+         scaled[idx] = _functions[idx].first * count / sumOfProbabilities;
+         ( scaled[idx] < 1.0 ? small : large ).push_back( static_cast<uint32_t>( idx ) );
+      }
+
+      constexpr auto ThresholdScale = 4294967296.0;
+      while ( !small.empty() && !large.empty() )
+      {
+         const auto smallIdx = small.back();
+         const auto largeIdx = large.back();
+         small.pop_back();
+         large.pop_back();
+
+         _aliasTable[smallIdx] = { static_cast<uint32_t>( scaled[smallIdx] * ThresholdScale ), largeIdx };
+         scaled[largeIdx] += scaled[smallIdx] - 1.0;
+         ( scaled[largeIdx] < 1.0 ? small : large ).push_back( largeIdx );
+      }
+
+      //Whatever is left has a probability of 1 up to rounding errors
+      for ( auto idx : large ) _aliasTable[idx] = { UINT32_MAX, idx };
+      for ( auto idx : small ) _aliasTable[idx] = { UINT32_MAX, idx };
+   }
 }
@@ -3,6 +3,8 @@
 #include <opencv2/core/core.hpp>
 #include "Colors.h"
 #include <numeric>
+#include <vector>
+#include <cassert>
 
 namespace flame
 {
@@ -35,7 +37,7 @@ namespace flame
 
       inline cv::Point2f VariationHeart( const cv::Point2f& p )
       {
-         auto r = std::sqrtf( p.x * p.x + p.y * p.y );
+         auto r = std::sqrt( p.x * p.x + p.y * p.y );
          auto theta = std::atan( p.x / p.y );
          return{ r * std::sin( theta * r ), -r * std::cos( theta * r ) };
       }
@@ -104,6 +106,20 @@ namespace flame
          _isColorPreserving = false;
       }
 
+      //! \brief Creates a function that preserves the color of the points
+      explicit FlameFunction( std::vector<FuncData> variations ) :
+         _variations( std::move( variations ) ),
+         _isColorPreserving( true )
+      {
+      }
+
+      FlameFunction( std::vector<FuncData> variations, const Color3_8& color ) :
+         _variations( std::move( variations ) ),
+         _color( color ),
+         _isColorPreserving( false )
+      {
+      }
+
       FlameFunction( const FlameFunction& ) = default;
       FlameFunction( FlameFunction&& ) = default;
 
@@ -119,6 +135,9 @@ namespace flame
          return ret;
       }
 
+      //! \brief Returns the variations of this function with their coefficients and weights
+      const auto& GetVariations() const { return _variations; }
+
       const Color3_8& GetColor() const { return _color; }
       auto IsColorPreserving() const { return _isColorPreserving; }
 
@@ -142,6 +161,22 @@ namespace flame
 
    std::vector<FlameFunction> MakeSymmetryFunction( Symmetry symmetry );
 
+   //! \brief How FlameFunctionSet::AddSymmetries applies symmetries
+   enum class SymmetryMode
+   {
+      //! \brief Rotations and mirrors join the functions of the chaos game and take their share of the iterations
+      Functions,
+      //! \brief Every hit is plotted once per element of the symmetry group, see FlameCalculator. The functions keep
+      //!        the whole iteration budget. The image is the exactly symmetric union of the images of the attractor
+      //!        of the functions, which looks a little different from Functions, where the symmetries also feed
+      //!        back into the functions
+      Plot
+   };
+
+   //! \brief Returns the linear maps (c and f are 0) of all elements of the group that the given symmetries
+   //!        generate, except the identity. Entries that are within rounding of -1, 0 or 1 are exactly that
+   std::vector<Coefficients> MakeSymmetryGroup( const std::vector<Symmetry>& generators );
+
    //! \brief Stores multiple functions and their probabilities
    class FlameFunctionSet
    {
@@ -149,13 +184,46 @@ namespace flame
       //! \brief Returns pairs of functions and their probabilities
       const auto& GetFunctions() const { return _functions; }
 
+      //! \brief Picks the index of a random function according to the probabilities in constant time, using a
+      //!        Walker/Vose alias table. The high bits of the product draw * N select the column, the low bits
+      //!        decide between the column and its alias
+      //! \param draw Uniformly distributed 32-bit random number
+      size_t PickFunctionIndex( uint32_t draw ) const
+      {
+         assert( !_aliasTable.empty() );
+         const auto product = static_cast<uint64_t>( draw ) * _aliasTable.size();
+         const auto& entry = _aliasTable[static_cast<size_t>( product >> 32 )];
+         return static_cast<uint32_t>( product ) < entry.threshold ? static_cast<size_t>( product >> 32 ) : entry.alias;
+      }
+
+      const FlameFunction& PickFunction( uint32_t draw ) const
+      {
+         return _functions[PickFunctionIndex( draw )].second;
+      }
+
       void AddFunction( FlameFunction&& function, float probability )
       {
          _functions.emplace_back( probability, std::move( function ) );
+         BuildAliasTable();
       }
 
-      void AddSymmetries( std::initializer_list<Symmetry> symmetries )
+      //! \brief Adds functions with their probabilities and normalizes the probabilities, which builds the alias
+      //!        table only once for all of them
+      void AddFunctions( std::vector<std::pair<float, FlameFunction>>&& functions )
       {
+         _functions.reserve( _functions.size() + functions.size() );
+         for ( auto& pair : functions ) _functions.emplace_back( pair.first, std::move( pair.second ) );
+         NormalizeProbabilities();
+      }
+
+      void AddSymmetries( std::initializer_list<Symmetry> symmetries, SymmetryMode mode = SymmetryMode::Functions )
+      {
+         if ( mode == SymmetryMode::Plot )
+         {
+            _plotSymmetries.insert( _plotSymmetries.end(), symmetries );
+            return;
+         }
+
          NormalizeProbabilities();
          auto symmetriesCount = std::accumulate(symmetries.begin(), symmetries.end(), 1, [](auto base, Symmetry sym)
          {
@@ -181,6 +249,7 @@ namespace flame
                _functions.emplace_back( symmetryProbability, std::move(symFunc) );
             }            
          }
+         BuildAliasTable();
       }
 
       //! \brief Normalizes the probabilities of all functions so that they sum up to 1
@@ -192,10 +261,26 @@ namespace flame
          } );
          auto invProbabilities = 1.f / sumOfProbabilities;
          for ( auto& pair : _functions ) pair.first *= invProbabilities;
+         BuildAliasTable();
       }
+
+      //! \brief Symmetries that were added with SymmetryMode::Plot, the generators of the group
+      const std::vector<Symmetry>& GetPlotSymmetries() const { return _plotSymmetries; }
    private:
+      //! \brief Rebuilds the alias table from the current probabilities, has to be called after every change
+      void BuildAliasTable();
+
+      struct AliasEntry
+      {
+         //! \brief The column is picked if the low 32 bits of the draw are below this, otherwise the alias is
+         uint32_t threshold;
+         uint32_t alias;
+      };
+
       using Pair_t = std::pair<float, FlameFunction>;
       std::vector<Pair_t> _functions;
+      std::vector<AliasEntry> _aliasTable;
+      std::vector<Symmetry> _plotSymmetries;
    };
 
 }
@@ -0,0 +1,93 @@
+#include "FramePipeline.h"
+
+namespace flame
+{
+   FramePipeline::FramePipeline( size_t width, size_t height, size_t superSampling, const PixelFormat& format, Present_t present ) :
+      _superSampling( superSampling ),
+      _present( std::move( present ) ),
+      _buffers{ { width / superSampling, height / superSampling, format }, { width / superSampling, height / superSampling, format } },
+      _missingTiles{ { width, height, superSampling }, { width, height, superSampling } },
+      _presented( NoFrame ),
+      _queued( NoFrame ),
+      _isRunning( true )
+   {
+      for ( auto& missing : _missingTiles ) missing.MarkAll();
+      _presenter = std::thread( [this]() { Present(); } );
+   }
+
+   FramePipeline::~FramePipeline()
+   {
+      {
+         std::lock_guard<std::mutex> guard( _mutex );
+         _isRunning = false;
+      }
+      _frameChanged.notify_all();
+      _presenter.join();
+   }
+
+   bool FramePipeline::IsRunning() const
+   {
+      std::lock_guard<std::mutex> guard( _mutex );
+      return _isRunning;
+   }
+
+   bool FramePipeline::Submit( FlameHistogram_t& histogram, DirtyTiles& changes, size_t threadBudget )
+   {
+      size_t target;
+      {
+         //Without a queued frame, only the presented buffer is in use
+         std::unique_lock<std::mutex> lock( _mutex );
+         _frameChanged.wait( lock, [this]() { return !_isRunning || _queued == NoFrame; } );
+         if ( !_isRunning ) return false;
+         target = _presented == 0 ? 1 : 0;
+      }
+
+      auto& missing = _missingTiles[target];
+      auto& otherMissing = _missingTiles[1 - target];
+      for ( size_t tile = 0; tile < changes.GetTileCount(); tile++ )
+      {
+         //The tiles that are missing here went into the other buffer with the previous frame
+         if ( changes.IsDirty( tile ) ) otherMissing.MarkTile( tile );
+         if ( missing.IsDirty( tile ) ) changes.MarkTile( tile );
+      }
+      missing.Clear();
+
+      //A complete resolve moved the normalization, which the other buffer lacks everywhere
+      if ( histogram.ResolveChanges( _buffers[target].GetView(), _superSampling, changes, threadBudget ) ) otherMissing.MarkAll();
+
+      {
+         std::lock_guard<std::mutex> guard( _mutex );
+         _queued = target;
+      }
+      _frameChanged.notify_all();
+      return true;
+   }
+
+   void FramePipeline::Present()
+   {
+      std::unique_lock<std::mutex> lock( _mutex );
+      while ( true )
+      {
+         _frameChanged.wait( lock, [this]() { return !_isRunning || _queued != NoFrame || _presented != NoFrame; } );
+         if ( !_isRunning ) return;
+
+         if ( _queued != NoFrame )
+         {
+            _presented = _queued;
+            _queued = NoFrame;
+            _frameChanged.notify_all();
+         }
+         const auto frame = _buffers[_presented].GetView();
+
+         lock.unlock();
+         const auto keepRunning = _present( frame );
+         lock.lock();
+
+         if ( !keepRunning )
+         {
+            _isRunning = false;
+            _frameChanged.notify_all();
+         }
+      }
+   }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "PlanarHistogram.h"
+#include "ImageView.h"
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace flame
+{
+   //! \brief Presents frames on a thread of its own while the next frame is resolved. Frames are resolved straight
+   //!        into one of two buffers, the presenter shows the newest one until the next arrives, so resolving frame
+   //!        N + 1 overlaps presenting frame N. Every buffer only gets the tiles that changed since it was resolved
+   //!        the last time: the changes of its own frame and of the frame before, which went into the other buffer
+   class FramePipeline
+   {
+   public:
+      //! \brief Called on the presenter thread with the newest frame, again and again until a newer one arrives, so
+      //!        it can also pace the presenter and poll for input. Returns false to stop the pipeline
+      using Present_t = std::function<bool( const ImageView& frame )>;
+
+      //! \param width, height Size of the histograms that are resolved
+      FramePipeline( size_t width, size_t height, size_t superSampling, const PixelFormat& format, Present_t present );
+      //! \brief Stops the presenter after its current call
+      ~FramePipeline();
+
+      FramePipeline( const FramePipeline& ) = delete;
+      FramePipeline& operator=( const FramePipeline& ) = delete;
+
+      //! \brief Resolves the changes of the histogram into the free buffer and passes it to the presenter, see
+      //!        FlameHistogram_t::ResolveChanges. Waits until the presenter took the previous frame
+      //! \returns False once the presenter stopped, the frame is then dropped
+      bool Submit( FlameHistogram_t& histogram, DirtyTiles& changes, size_t threadBudget = 1 );
+
+      bool IsRunning() const;
+   private:
+      static constexpr size_t Buffers = 2;
+      static constexpr size_t NoFrame = Buffers;
+
+      void Present();
+
+      const size_t _superSampling;
+      const Present_t _present;
+      ImageBuffer _buffers[Buffers];
+      //! \brief Tiles that changed since the buffer was resolved the last time
+      DirtyTiles _missingTiles[Buffers];
+
+      mutable std::mutex _mutex;
+      std::condition_variable _frameChanged;
+      //! \brief Buffer that the presenter shows and the one that waits for it, NoFrame if there is none
+      size_t _presented;
+      size_t _queued;
+      bool _isRunning;
+      std::thread _presenter;
+   };
+}
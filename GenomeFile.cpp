@@ -0,0 +1,560 @@
+#include "GenomeFile.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+namespace flame
+{
+   namespace
+   {
+      struct NamedVariation
+      {
+         const char* name;
+         Variations::Func_t func;
+      };
+
+      //The position in this list is the id that HashGenome uses, new variations go to the end
+      const NamedVariation KnownVariations[] = {
+         { "linear", Variations::Linear },
+         { "spherical", Variations::Spherical },
+         { "sinusoidal", Variations::Sinusoidal },
+         { "swirl", Variations::Swirl },
+         { "heart", Variations::Heart }
+      };
+
+      struct NamedSymmetry
+      {
+         const char* name;
+         Symmetry symmetry;
+      };
+
+      const NamedSymmetry KnownSymmetries[] = {
+         { "mirror_x", Symmetry::MirrorX },
+         { "mirror_y", Symmetry::MirrorY },
+         { "rotate180", Symmetry::Rotate180 },
+         { "rotate120", Symmetry::Rotate120 },
+         { "rotate90", Symmetry::Rotate90 },
+         { "rotate72", Symmetry::Rotate72 },
+         { "rotate60", Symmetry::Rotate60 }
+      };
+
+      const NamedVariation* FindVariation( const std::string& name )
+      {
+         for ( const auto& variation : KnownVariations )
+         {
+            if ( name == variation.name ) return &variation;
+         }
+         return nullptr;
+      }
+
+      const NamedVariation* FindVariation( Variations::Func_t func )
+      {
+         for ( const auto& variation : KnownVariations )
+         {
+            if ( func == variation.func ) return &variation;
+         }
+         return nullptr;
+      }
+
+      const char* GetSymmetryName( Symmetry symmetry )
+      {
+         for ( const auto& known : KnownSymmetries )
+         {
+            if ( known.symmetry == symmetry ) return known.name;
+         }
+         return nullptr;
+      }
+
+      [[noreturn]] void Fail( size_t line, const std::string& message )
+      {
+         throw GenomeError( "Genome line " + std::to_string( line ) + ": " + message );
+      }
+
+      float ParseFloat( const std::string& token, size_t line )
+      {
+         char* end;
+         const auto value = std::strtof( token.c_str(), &end );
+         if ( token.empty() || *end != '\0' || !std::isfinite( value ) ) Fail( line, "'" + token + "' is not a finite number" );
+         return value;
+      }
+
+      uint8_t ParseColorComponent( const std::string& token, size_t line )
+      {
+         const auto value = ParseFloat( token, line );
+         if ( value < 0.f || value > 255.f || value != std::floor( value ) ) Fail( line, "color components are integers from 0 to 255" );
+         return static_cast<uint8_t>( value );
+      }
+
+      //! \brief Parses an integer within [min, max]. flam3 writes some of them as floats, so they are parsed as floats
+      int ParseInteger( const std::string& token, size_t line, int min, int max, const std::string& what )
+      {
+         const auto value = ParseFloat( token, line );
+         //Checked before the conversion, which is undefined for floats beyond the range of int
+         if ( value < min || value > max || value != std::floor( value ) )
+         {
+            Fail( line, what + " '" + token + "' is not an integer from " + std::to_string( min ) + " to " + std::to_string( max ) );
+         }
+         return static_cast<int>( value );
+      }
+
+      void SplitWhitespace( const std::string& text, std::vector<std::string>& tokens )
+      {
+         tokens.clear();
+         size_t pos = 0;
+         while ( pos < text.size() )
+         {
+            while ( pos < text.size() && std::isspace( static_cast<unsigned char>( text[pos] ) ) ) pos++;
+            const auto begin = pos;
+            while ( pos < text.size() && !std::isspace( static_cast<unsigned char>( text[pos] ) ) ) pos++;
+            if ( pos > begin ) tokens.emplace_back( text, begin, pos - begin );
+         }
+      }
+
+      //! \brief A function while it is parsed
+      struct PendingFunction
+      {
+         size_t line;
+         float probability;
+         bool hasColor;
+         Color3_8 color;
+         std::vector<FuncData> variations;
+      };
+
+      struct PendingSymmetry
+      {
+         Symmetry symmetry;
+         SymmetryMode mode;
+      };
+
+      //! \brief Validates the parsed genome and turns it into a FlameFunctionSet with normalized probabilities
+      FlameFunctionSet BuildGenome( std::vector<PendingFunction>& functions, const std::vector<PendingSymmetry>& symmetries )
+      {
+         if ( functions.empty() ) throw GenomeError( "Genome has no functions" );
+         double probabilitySum = 0.0;
+         for ( const auto& function : functions )
+         {
+            if ( function.variations.empty() ) Fail( function.line, "function has no variations" );
+            if ( function.probability < 0.f ) Fail( function.line, "probabilities must not be negative" );
+            probabilitySum += function.probability;
+         }
+         if ( probabilitySum <= 0.0 ) throw GenomeError( "Genome has no function with a probability above 0" );
+
+         std::vector<std::pair<float, FlameFunction>> built;
+         built.reserve( functions.size() );
+         for ( auto& function : functions )
+         {
+            if ( function.hasColor ) built.emplace_back( function.probability, FlameFunction( std::move( function.variations ), function.color ) );
+            else built.emplace_back( function.probability, FlameFunction( std::move( function.variations ) ) );
+         }
+         FlameFunctionSet set;
+         set.AddFunctions( std::move( built ) );
+         for ( const auto& symmetry : symmetries ) set.AddSymmetries( { symmetry.symmetry }, symmetry.mode );
+         return set;
+      }
+
+      FlameFunctionSet ParseGenomeText( const std::string& text )
+      {
+         std::vector<PendingFunction> functions;
+         std::vector<PendingSymmetry> symmetries;
+         std::vector<std::string> tokens;
+
+         size_t lineNumber = 0;
+         size_t lineBegin = 0;
+         while ( lineBegin < text.size() )
+         {
+            auto lineEnd = text.find( '\n', lineBegin );
+            if ( lineEnd == std::string::npos ) lineEnd = text.size();
+            lineNumber++;
+            auto line = text.substr( lineBegin, lineEnd - lineBegin );
+            lineBegin = lineEnd + 1;
+
+            const auto comment = line.find( '#' );
+            if ( comment != std::string::npos ) line.resize( comment );
+            SplitWhitespace( line, tokens );
+            if ( tokens.empty() ) continue;
+
+            const auto& keyword = tokens[0];
+            if ( keyword == "function" )
+            {
+               if ( tokens.size() != 2 && tokens.size() != 6 ) Fail( lineNumber, "expected function <probability> [color <r> <g> <b>]" );
+               PendingFunction function = { lineNumber, ParseFloat( tokens[1], lineNumber ), false, Color3_8(), {} };
+               if ( tokens.size() == 6 )
+               {
+                  if ( tokens[2] != "color" ) Fail( lineNumber, "expected color after the probability" );
+                  function.hasColor = true;
+                  function.color = Color3_8( ParseColorComponent( tokens[3], lineNumber ), ParseColorComponent( tokens[4], lineNumber ),
+                                             ParseColorComponent( tokens[5], lineNumber ) );
+               }
+               functions.push_back( std::move( function ) );
+            }
+            else if ( keyword == "variation" )
+            {
+               if ( functions.empty() ) Fail( lineNumber, "variation outside of a function" );
+               if ( tokens.size() != 9 ) Fail( lineNumber, "expected variation <name> <weight> <a> <b> <c> <d> <e> <f>" );
+               const auto variation = FindVariation( tokens[1] );
+               if ( !variation ) Fail( lineNumber, "unknown variation '" + tokens[1] + "'" );
+
+               FuncData data;
+               data.func = variation->func;
+               data.weight = ParseFloat( tokens[2], lineNumber );
+               for ( size_t idx = 0; idx < 6; idx++ ) data.coefficients.data[idx] = ParseFloat( tokens[3 + idx], lineNumber );
+               functions.back().variations.push_back( data );
+            }
+            else if ( keyword == "symmetry" )
+            {
+               if ( tokens.size() != 2 && !( tokens.size() == 3 && tokens[2] == "plot" ) ) Fail( lineNumber, "expected symmetry <name> [plot]" );
+               const auto known = std::find_if( std::begin( KnownSymmetries ), std::end( KnownSymmetries ),
+                                                [&]( const NamedSymmetry& s ) { return tokens[1] == s.name; } );
+               if ( known == std::end( KnownSymmetries ) ) Fail( lineNumber, "unknown symmetry '" + tokens[1] + "'" );
+               symmetries.push_back( { known->symmetry, tokens.size() == 3 ? SymmetryMode::Plot : SymmetryMode::Functions } );
+            }
+            else Fail( lineNumber, "unknown statement '" + keyword + "'" );
+         }
+         return BuildGenome( functions, symmetries );
+      }
+
+      //! \brief Start tag or empty element of an XML document
+      struct XmlTag
+      {
+         std::string name;
+         std::vector<std::pair<std::string, std::string>> attributes;
+         size_t line;
+      };
+
+      //! \brief Finds the next start tag at or after pos, skipping declarations, comments and end tags. This is
+      //!        just enough XML for flam3 files, entities in attribute values are not decoded
+      bool NextXmlTag( const std::string& text, size_t& pos, XmlTag& tag )
+      {
+         while ( ( pos = text.find( '<', pos ) ) != std::string::npos )
+         {
+            if ( text.compare( pos, 4, "<!--" ) == 0 )
+            {
+               pos = text.find( "-->", pos );
+               if ( pos == std::string::npos ) return false;
+               continue;
+            }
+            if ( pos + 1 < text.size() && ( text[pos + 1] == '?' || text[pos + 1] == '!' || text[pos + 1] == '/' ) )
+            {
+               pos++;
+               continue;
+            }
+
+            tag.line = 1 + std::count( text.begin(), text.begin() + pos, '\n' );
+            tag.attributes.clear();
+            auto cursor = pos + 1;
+            const auto nameEnd = text.find_first_of( " \t\r\n/>", cursor );
+            if ( nameEnd == std::string::npos ) return false;
+            tag.name = text.substr( cursor, nameEnd - cursor );
+            cursor = nameEnd;
+
+            while ( true )
+            {
+               cursor = text.find_first_not_of( " \t\r\n", cursor );
+               if ( cursor == std::string::npos ) Fail( tag.line, "unterminated tag <" + tag.name + ">" );
+               if ( text[cursor] == '>' || text[cursor] == '/' ) break;
+
+               const auto equals = text.find( '=', cursor );
+               if ( equals == std::string::npos || equals + 1 >= text.size() ) Fail( tag.line, "malformed attribute in <" + tag.name + ">" );
+               auto name = text.substr( cursor, equals - cursor );
+               name.erase( name.find_last_not_of( " \t\r\n" ) + 1 );
+               const auto quoteBegin = text.find_first_not_of( " \t\r\n", equals + 1 );
+               if ( quoteBegin == std::string::npos || ( text[quoteBegin] != '"' && text[quoteBegin] != '\'' ) )
+               {
+                  Fail( tag.line, "attribute " + name + " of <" + tag.name + "> has no quoted value" );
+               }
+               const auto quoteEnd = text.find( text[quoteBegin], quoteBegin + 1 );
+               if ( quoteEnd == std::string::npos ) Fail( tag.line, "unterminated value of attribute " + name );
+               tag.attributes.emplace_back( std::move( name ), text.substr( quoteBegin + 1, quoteEnd - quoteBegin - 1 ) );
+               cursor = quoteEnd + 1;
+            }
+            pos = cursor;
+            return true;
+         }
+         return false;
+      }
+
+      //! \brief Fully saturated color for a palette index in [0, 1]
+      Color3_8 HueRamp( float index )
+      {
+         const auto h = ( index - std::floor( index ) ) * 6.f;
+         const auto sector = static_cast<int>( h ) % 6;
+         const auto rising = static_cast<uint8_t>( ( h - std::floor( h ) ) * 255.f );
+         const auto falling = static_cast<uint8_t>( 255 - rising );
+         switch ( sector )
+         {
+         case 0: return Color3_8( 255, rising, 0 );
+         case 1: return Color3_8( falling, 255, 0 );
+         case 2: return Color3_8( 0, 255, rising );
+         case 3: return Color3_8( 0, falling, 255 );
+         case 4: return Color3_8( rising, 0, 255 );
+         default: return Color3_8( 255, 0, falling );
+         }
+      }
+
+      FlameFunctionSet ParseFlam3Text( const std::string& text )
+      {
+         //Attributes of xforms that have no effect here
+         const char* const IgnoredAttributes[] = {
+            "symmetry", "color_speed", "animate", "opacity", "name", "chaos", "plotmode", "var_color", "motion_frequency", "motion_function"
+         };
+
+         std::vector<PendingFunction> functions;
+         std::vector<float> colorIndices;
+         std::vector<PendingSymmetry> symmetries;
+         std::vector<Color3_8> palette;
+         std::vector<std::string> tokens;
+
+         size_t pos = 0;
+         size_t flames = 0;
+         XmlTag tag;
+         while ( NextXmlTag( text, pos, tag ) )
+         {
+            if ( tag.name == "flame" )
+            {
+               //Files with several flames only load the first one
+               if ( ++flames > 1 ) break;
+            }
+            else if ( tag.name == "finalxform" ) Fail( tag.line, "final xforms are not supported" );
+            else if ( tag.name == "xform" )
+            {
+               PendingFunction function = { tag.line, 0.f, true, Color3_8(), {} };
+               Coefficients coefficients = Coefficients::Build( 1, 0, 0, 0, 1, 0 );
+               float colorIndex = 0.f;
+               std::vector<std::pair<Variations::Func_t, float>> variations;
+
+               for ( const auto& attribute : tag.attributes )
+               {
+                  const auto& name = attribute.first;
+                  SplitWhitespace( attribute.second, tokens );
+                  if ( name == "weight" && tokens.size() == 1 ) function.probability = ParseFloat( tokens[0], tag.line );
+                  else if ( name == "color" && !tokens.empty() ) colorIndex = ParseFloat( tokens[0], tag.line );
+                  else if ( name == "coefs" || name == "post" )
+                  {
+                     if ( tokens.size() != 6 ) Fail( tag.line, name + " needs 6 values" );
+                     float flam3[6];
+                     for ( size_t idx = 0; idx < 6; idx++ ) flam3[idx] = ParseFloat( tokens[idx], tag.line );
+                     //flam3 stores the columns of the matrix: x' = c0 x + c2 y + c4, y' = c1 x + c3 y + c5
+                     const auto transform = Coefficients::Build( flam3[0], flam3[2], flam3[4], flam3[1], flam3[3], flam3[5] );
+                     if ( name == "coefs" ) coefficients = transform;
+                     else if ( transform.a != 1.f || transform.b != 0.f || transform.c != 0.f || transform.d != 0.f ||
+                               transform.e != 1.f || transform.f != 0.f )
+                     {
+                        Fail( tag.line, "post transforms are not supported" );
+                     }
+                  }
+                  else if ( const auto variation = FindVariation( name ) )
+                  {
+                     if ( tokens.size() != 1 ) Fail( tag.line, "variation " + name + " needs one weight" );
+                     const auto weight = ParseFloat( tokens[0], tag.line );
+                     if ( weight != 0.f ) variations.emplace_back( variation->func, weight );
+                  }
+                  else if ( std::none_of( std::begin( IgnoredAttributes ), std::end( IgnoredAttributes ),
+                                          [&]( const char* ignored ) { return name == ignored; } ) )
+                  {
+                     Fail( tag.line, "unsupported variation or attribute '" + name + "'" );
+                  }
+               }
+
+               //All variations of an xform share its affine transform
+               for ( const auto& variation : variations ) function.variations.push_back( { variation.first, coefficients, variation.second } );
+               functions.push_back( std::move( function ) );
+               colorIndices.push_back( colorIndex );
+            }
+            else if ( tag.name == "color" )
+            {
+               size_t index = palette.size();
+               Color3_8 color;
+               for ( const auto& attribute : tag.attributes )
+               {
+                  SplitWhitespace( attribute.second, tokens );
+                  if ( attribute.first == "index" && tokens.size() == 1 ) index = static_cast<size_t>( ParseInteger( tokens[0], tag.line, 0, 255, "palette index" ) );
+                  else if ( attribute.first == "rgb" && tokens.size() == 3 )
+                  {
+                     color = Color3_8( ParseColorComponent( tokens[0], tag.line ), ParseColorComponent( tokens[1], tag.line ),
+                                       ParseColorComponent( tokens[2], tag.line ) );
+                  }
+               }
+               if ( palette.size() <= index ) palette.resize( index + 1 );
+               palette[index] = color;
+            }
+            else if ( tag.name == "symmetry" )
+            {
+               int kind = 0;
+               for ( const auto& attribute : tag.attributes )
+               {
+                  if ( attribute.first == "kind" ) kind = ParseInteger( attribute.second, tag.line, -6, 6, "symmetry kind" );
+               }
+               //Negative kinds are the dihedral groups, which add a mirror to the rotations
+               if ( kind < 0 ) symmetries.push_back( { Symmetry::MirrorX, SymmetryMode::Functions } );
+               switch ( std::abs( kind ) )
+               {
+               case 1: break;
+               case 2: symmetries.push_back( { Symmetry::Rotate180, SymmetryMode::Functions } ); break;
+               case 3: symmetries.push_back( { Symmetry::Rotate120, SymmetryMode::Functions } ); break;
+               case 4: symmetries.push_back( { Symmetry::Rotate90, SymmetryMode::Functions } ); break;
+               case 5: symmetries.push_back( { Symmetry::Rotate72, SymmetryMode::Functions } ); break;
+               case 6: symmetries.push_back( { Symmetry::Rotate60, SymmetryMode::Functions } ); break;
+               default: Fail( tag.line, "symmetry kind " + std::to_string( kind ) + " is not supported" );
+               }
+            }
+         }
+         if ( !flames ) throw GenomeError( "No <flame> element found" );
+
+         for ( size_t idx = 0; idx < functions.size(); idx++ )
+         {
+            const auto index = std::min( std::max( colorIndices[idx], 0.f ), 1.f );
+            functions[idx].hasColor = true;
+            functions[idx].color = palette.empty() ? HueRamp( index )
+                                                   : palette[std::min( static_cast<size_t>( index * ( palette.size() - 1 ) + 0.5f ), palette.size() - 1 )];
+         }
+         return BuildGenome( functions, symmetries );
+      }
+
+      std::string ReadStream( std::istream& stream )
+      {
+         std::ostringstream content;
+         content << stream.rdbuf();
+         return content.str();
+      }
+
+      std::string ReadFile( const std::string& path )
+      {
+         std::ifstream file( path, std::ios::binary );
+         if ( !file ) throw GenomeError( "Can't open genome file " + path );
+         return ReadStream( file );
+      }
+
+      //! \brief flam3 files are XML, genome files can't start with <
+      bool IsFlam3( const std::string& content )
+      {
+         const auto first = content.find_first_not_of( " \t\r\n" );
+         return first != std::string::npos && content[first] == '<';
+      }
+
+      FlameFunctionSet ParseContent( const std::string& content )
+      {
+         return IsFlam3( content ) ? ParseFlam3Text( content ) : ParseGenomeText( content );
+      }
+
+      //! \brief 64 bit FNV-1a
+      class Fnv1a
+      {
+      public:
+         void Add( const void* data, size_t size )
+         {
+            auto bytes = static_cast<const uint8_t*>( data );
+            for ( size_t idx = 0; idx < size; idx++ ) _hash = ( _hash ^ bytes[idx] ) * 1099511628211ull;
+         }
+
+         template<typename T>
+         void Add( const T& value ) { Add( &value, sizeof( value ) ); }
+
+         uint64_t Get() const { return _hash; }
+
+      private:
+         uint64_t _hash = 14695981039346656037ull;
+      };
+   }
+
+   FlameFunctionSet ParseGenome( std::istream& stream )
+   {
+      return ParseGenomeText( ReadStream( stream ) );
+   }
+
+   FlameFunctionSet ParseFlam3( std::istream& stream )
+   {
+      return ParseFlam3Text( ReadStream( stream ) );
+   }
+
+   FlameFunctionSet LoadGenome( const std::string& path )
+   {
+      return ParseContent( ReadFile( path ) );
+   }
+
+   void WriteGenome( std::ostream& stream, const FlameFunctionSet& functions )
+   {
+      const auto precision = stream.precision( std::numeric_limits<float>::max_digits10 );
+      for ( const auto& pair : functions.GetFunctions() )
+      {
+         const auto& function = pair.second;
+         stream << "function " << pair.first;
+         if ( !function.IsColorPreserving() )
+         {
+            const auto& color = function.GetColor();
+            stream << " color " << static_cast<int>( color.r ) << " " << static_cast<int>( color.g ) << " " << static_cast<int>( color.b );
+         }
+         stream << "\n";
+
+         for ( const auto& variation : function.GetVariations() )
+         {
+            const auto named = FindVariation( variation.func );
+            if ( !named ) throw GenomeError( "The genome uses a variation that has no name" );
+            stream << "   variation " << named->name << " " << variation.weight;
+            for ( auto v : variation.coefficients.data ) stream << " " << v;
+            stream << "\n";
+         }
+      }
+      for ( auto symmetry : functions.GetPlotSymmetries() ) stream << "symmetry " << GetSymmetryName( symmetry ) << " plot\n";
+      stream.precision( precision );
+   }
+
+   uint64_t HashGenome( const FlameFunctionSet& functions )
+   {
+      Fnv1a hash;
+      hash.Add( functions.GetFunctions().size() );
+      for ( const auto& pair : functions.GetFunctions() )
+      {
+         const auto& function = pair.second;
+         hash.Add( pair.first );
+         hash.Add( function.IsColorPreserving() );
+         if ( !function.IsColorPreserving() ) hash.Add( function.GetColor() );
+         hash.Add( function.GetVariations().size() );
+         for ( const auto& variation : function.GetVariations() )
+         {
+            //Function pointers differ between builds, the position in the list of known variations does not
+            const auto named = FindVariation( variation.func );
+            hash.Add( named ? static_cast<size_t>( named - KnownVariations ) : reinterpret_cast<size_t>( variation.func ) );
+            hash.Add( variation.coefficients.data );
+            hash.Add( variation.weight );
+         }
+      }
+      for ( auto symmetry : functions.GetPlotSymmetries() ) hash.Add( symmetry );
+      return hash.Get();
+   }
+
+   GenomeCache::EntryPtr GenomeCache::Load( const std::string& path )
+   {
+      return Parse( ReadFile( path ) );
+   }
+
+   GenomeCache::EntryPtr GenomeCache::Parse( const std::string& content )
+   {
+      Fnv1a contentHash;
+      contentHash.Add( content.data(), content.size() );
+      {
+         std::lock_guard<std::mutex> lock( _mutex );
+         const auto found = _byContent.find( contentHash.Get() );
+         if ( found != _byContent.end() ) return found->second;
+      }
+
+      //Parsed without the lock, so that threads can load different genomes at the same time
+      auto entry = std::make_shared<const Entry>( ParseContent( content ) );
+
+      std::lock_guard<std::mutex> lock( _mutex );
+      const auto known = _byGenome.emplace( entry->hash, entry ).first->second;
+      _byContent.emplace( contentHash.Get(), known );
+      return known;
+   }
+
+   size_t GenomeCache::GetSize() const
+   {
+      std::lock_guard<std::mutex> lock( _mutex );
+      return _byGenome.size();
+   }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include "FlameFunctions.h"
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+//Genome files: a FlameFunctionSet as text, one statement per line, # starts a comment
+//
+//   function <probability> [color <r> <g> <b>]
+//   variation <name> <weight> <a> <b> <c> <d> <e> <f>
+//   symmetry <name> [plot]
+//
+//Variations belong to the function above them. Variation names are linear, spherical, sinusoidal, swirl and heart,
+//symmetry names mirror_x, mirror_y, rotate180, rotate120, rotate90, rotate72 and rotate60. Functions without a color
+//preserve the color of the points. Symmetries use SymmetryMode::Functions unless they are followed by plot
+
+namespace flame
+{
+   //! \brief Thrown for genomes that are malformed or invalid, the message names the line
+   class GenomeError : public std::runtime_error
+   {
+   public:
+      using std::runtime_error::runtime_error;
+   };
+
+   //! \brief Parses and validates a genome file. The probabilities are normalized
+   FlameFunctionSet ParseGenome( std::istream& stream );
+
+   //! \brief Imports the subset of flam3 XML that maps onto FlameFunctionSet: xforms with weight, coefs, color and
+   //!        the variations above, and symmetry elements of kind 2 to 6 (negative kinds add a mirror). The colors
+   //!        are looked up in the palette of the flame, or on a hue ramp if it has none. Post transforms, final
+   //!        xforms and other variations are rejected with a GenomeError
+   FlameFunctionSet ParseFlam3( std::istream& stream );
+
+   //! \brief Loads a genome file or a flam3 file, which is told apart by its content
+   FlameFunctionSet LoadGenome( const std::string& path );
+
+   //! \brief Writes the genome in the format that ParseGenome reads. Symmetries that were added with
+   //!        SymmetryMode::Functions are written as the functions that they added
+   void WriteGenome( std::ostream& stream, const FlameFunctionSet& functions );
+
+   //! \brief Hash of everything that changes the flame: variations, coefficients, weights, colors, probabilities
+   //!        and plot symmetries
+   uint64_t HashGenome( const FlameFunctionSet& functions );
+
+   //! \brief Parsed and validated genomes, so that jobs over many genomes (or many renders of one) read and parse
+   //!        each file once. Entries are looked up by a hash of the file content first, then by the hash of the genome,
+   //!        which shares one entry between files that differ only in formatting. Thread safe
+   class GenomeCache
+   {
+   public:
+      struct Entry
+      {
+         explicit Entry( FlameFunctionSet&& functions ) :
+            functions( std::move( functions ) ),
+            hash( HashGenome( this->functions ) )
+         {
+         }
+
+         const FlameFunctionSet functions;
+         const uint64_t hash;
+      };
+      using EntryPtr = std::shared_ptr<const Entry>;
+
+      //! \brief Returns the entry for a genome or flam3 file, loading it on the first request
+      EntryPtr Load( const std::string& path );
+      //! \brief Returns the entry for the content of a genome or flam3 file
+      EntryPtr Parse( const std::string& content );
+
+      //! \brief Number of distinct genomes in the cache
+      size_t GetSize() const;
+
+   private:
+      mutable std::mutex _mutex;
+      std::unordered_map<uint64_t, EntryPtr> _byContent;
+      std::unordered_map<uint64_t, EntryPtr> _byGenome;
+   };
+}
@@ -0,0 +1,21 @@
+#include "GenomeHandle.h"
+
+namespace flame
+{
+   GenomeHandle::GenomeHandle( FlameFunctionSet functions ) :
+      _current( new Version{ std::move( functions ), 1, Clock_t::now() } ),
+      _version( 1 )
+   {
+   }
+
+   uint64_t GenomeHandle::Publish( FlameFunctionSet functions )
+   {
+      std::lock_guard<std::mutex> guard( _publishMutex );
+      const auto number = _version.load( std::memory_order_relaxed ) + 1;
+      //Built in place, the members are const and would be copied
+      VersionPtr version( new Version{ std::move( functions ), number, Clock_t::now() } );
+      std::atomic_store( &_current, version );
+      _version.store( number, std::memory_order_relaxed );
+      return number;
+   }
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "FlameFunctions.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+namespace flame
+{
+   //! \brief Genome that can be replaced while FlameCalculators iterate it. Every Publish makes a new immutable
+   //!        version, readers poll the version number with a relaxed load at their chunk boundaries and only take
+   //!        the version itself when the number changed. A replaced version lives on until its last reader lets go
+   //!        of it, so publishing never waits for the readers
+   class GenomeHandle
+   {
+   public:
+      using Clock_t = std::chrono::steady_clock;
+
+      struct Version
+      {
+         const FlameFunctionSet functions;
+         //! \brief Starts at 1 and grows with every Publish
+         const uint64_t number;
+         //! \brief When the version was published, for the latency until its first frame
+         const Clock_t::time_point published;
+      };
+      using VersionPtr = std::shared_ptr<const Version>;
+
+      //! \brief Publishes the given genome as version 1
+      explicit GenomeHandle( FlameFunctionSet functions );
+
+      GenomeHandle( const GenomeHandle& ) = delete;
+      GenomeHandle& operator=( const GenomeHandle& ) = delete;
+
+      //! \brief Replaces the genome, readers pick it up at their next check. Thread safe
+      //! \returns Number of the new version
+      uint64_t Publish( FlameFunctionSet functions );
+
+      //! \brief The newest version
+      VersionPtr Get() const { return std::atomic_load( &_current ); }
+      //! \brief Number of the newest version, cheap enough to poll. It may run ahead of Get for a moment, readers
+      //!        take the number of the version they got instead
+      uint64_t GetVersion() const { return _version.load( std::memory_order_relaxed ); }
+   private:
+      //! \brief Serializes publishers, so that the numbers grow in the order of the versions
+      std::mutex _publishMutex;
+      VersionPtr _current;
+      std::atomic<uint64_t> _version;
+   };
+}
@@ -0,0 +1,301 @@
+#include "HeadlessRenderer.h"
+#include "HistogramFile.h"
+#include "OutOfCoreHistogram.h"
+#include "GenomeFile.h"
+#include "Trace.h"
+#include <cmath>
+#include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace flame
+{
+   RenderResult RenderHeadless( const FlameFunctionSet& functions, const RenderSettings& settings, TaskScheduler* scheduler )
+   {
+      const auto start = std::chrono::high_resolution_clock::now();
+      if ( settings.node >= settings.nodes )
+      {
+         throw std::runtime_error( "Node " + std::to_string( settings.node ) + " of " + std::to_string( settings.nodes ) + " nodes!" );
+      }
+
+      const auto threads = std::max<size_t>( settings.threads, 1 );
+      std::unique_ptr<TaskScheduler> ownScheduler;
+      if ( !scheduler )
+      {
+         SchedulerSettings schedulerSettings;
+         schedulerSettings.threads = threads;
+         schedulerSettings.pinThreads = settings.pinThreads;
+         ownScheduler = std::make_unique<TaskScheduler>( schedulerSettings );
+         scheduler = ownScheduler.get();
+      }
+      const auto budget = settings.GetNodeBudget();
+      const auto histogramWidth = settings.width * settings.superSampling;
+      const auto histogramHeight = settings.height * settings.superSampling;
+
+      //A resumed render starts from the histogram of the checkpoint and continues its streams
+      HistogramFileInfo checkpoint;
+      checkpoint.genomeHash = HashGenome( functions );
+      checkpoint.width = histogramWidth;
+      checkpoint.height = histogramHeight;
+      checkpoint.superSampling = settings.superSampling;
+      checkpoint.seed = settings.seed;
+      checkpoint.node = settings.node;
+      checkpoint.nodes = settings.nodes;
+      if ( settings.outOfCore && settings.checkpointPath.empty() ) throw std::runtime_error( "Out-of-core renders need a checkpoint path!" );
+
+      //An out-of-core histogram is the checkpoint file itself, under another name until the render is done. A render
+      //that is killed doesn't leave a checkpoint behind whose hits don't match its iterations, but its part file. That
+      //has all hits of the checkpoint it started from and some of its own, so it is resumed instead of the checkpoint
+      const auto partPath = settings.checkpointPath + ".part";
+      const auto isResumingPart = settings.resume && settings.outOfCore && std::ifstream( partPath ).good();
+      const auto& resumePath = isResumingPart ? partPath : settings.checkpointPath;
+      const auto isResuming = settings.resume && !settings.checkpointPath.empty() && std::ifstream( resumePath ).good();
+      std::unique_ptr<FlameHistogram_t> ownHistogram;
+      if ( isResuming && settings.outOfCore ) checkpoint = ReadHistogramFileInfo( resumePath );
+      else if ( isResuming ) ownHistogram = std::make_unique<FlameHistogram_t>( ReadHistogramFile( resumePath, checkpoint, settings.memory ) );
+      if ( isResuming )
+      {
+         CheckHistogramFile( checkpoint, HashGenome( functions ), histogramWidth, histogramHeight, settings.superSampling,
+                             settings.node, settings.nodes );
+      }
+      const auto resumedIterations = checkpoint.iterations;
+      const auto streamBlock = size_t( checkpoint.segments++ ) * settings.nodes + settings.node;
+
+      std::unique_ptr<OutOfCoreHistogram> outOfCore;
+      if ( settings.outOfCore )
+      {
+         //The header of the part file counts the segment before it adds any hits, with the iterations it started
+         //from. A render that resumes the part file then draws other streams, and its iterations are a lower bound
+         if ( !isResuming ) CreateHistogramFile( partPath, checkpoint );
+         else
+         {
+            if ( !isResumingPart ) MoveHistogramFile( settings.checkpointPath, partPath );
+            WriteHistogramFileInfo( partPath, checkpoint );
+         }
+         outOfCore = std::make_unique<OutOfCoreHistogram>( partPath );
+      }
+      else if ( !ownHistogram )
+      {
+         ownHistogram = std::make_unique<FlameHistogram_t>( histogramWidth, histogramHeight, settings.memory );
+      }
+      auto& histogram = outOfCore ? outOfCore->GetHistogram() : *ownHistogram;
+
+      std::unique_ptr<SharedHistogram> sharedHistogram;
+      if ( settings.histogramShards && !outOfCore )
+      {
+         sharedHistogram = std::make_unique<SharedHistogram>( settings.width * settings.superSampling,
+                                                              settings.height * settings.superSampling,
+                                                              std::min( settings.histogramShards, threads ) );
+      }
+
+      std::vector<FlameCalculator::Ptr> calculators;
+      for ( size_t idx = 0; idx < threads; idx++ )
+      {
+         if ( outOfCore )
+         {
+            calculators.push_back( std::make_unique<FlameCalculator>( functions, *outOfCore, settings.superSampling, settings.mode,
+                                                                      settings.precision ) );
+         }
+         else if ( sharedHistogram )
+         {
+            calculators.push_back( std::make_unique<FlameCalculator>( functions, *sharedHistogram, settings.superSampling, settings.mode,
+                                                                      ScatterMode::Auto, settings.precision ) );
+         }
+         else
+         {
+            calculators.push_back( std::make_unique<FlameCalculator>( functions, settings.width, settings.height,
+                                                                      settings.superSampling, settings.mode, ScatterMode::Auto,
+                                                                      settings.precision, settings.memory ) );
+         }
+         calculators[idx]->SetSeed( settings.seed, static_cast<uint32_t>( idx + ( streamBlock << 16 ) ) );
+      }
+
+      //The reporter reads the calculators while they iterate, and the final stats once they are gone
+      std::vector<CalculatorStats> finalStats( threads );
+      auto isFinished = false;
+      StatDuration resolveTime;
+      StatDuration checkpointTime;
+      StatsReporter reporter( settings.statsFormat );
+      if ( settings.statsOut )
+      {
+         for ( size_t idx = 0; idx < threads; idx++ )
+         {
+            reporter.AddCalculator( "calculator/" + std::to_string( idx ), [&, idx]()
+            {
+               return isFinished ? finalStats[idx] : calculators[idx]->GetStats();
+            } );
+         }
+         reporter.AddDuration( "resolve", resolveTime );
+         reporter.AddDuration( "checkpoint", checkpointTime );
+         reporter.Start( *settings.statsOut, settings.statsInterval );
+      }
+
+      RenderResult result;
+      result.resumedIterations = resumedIterations;
+
+      //Snapshots go into the histogram from the phases of the convergence and from the checkpoints, one at a time.
+      //The iterations in the histogram are exact, the snapshots don't defer tiles
+      std::mutex histogramMutex;
+      std::vector<uint64_t> snapshotIterations( threads, 0 );
+      auto takeSnapshots = [&]( DirtyTiles* changes )
+      {
+         for ( size_t idx = 0; idx < threads; idx++ ) snapshotIterations[idx] = calculators[idx]->TakeSnapshot( histogram, changes ).iterations;
+      };
+      auto writeCheckpoint = [&]()
+      {
+         TraceScope trace( "checkpoint", "render" );
+         const auto checkpointStart = Trace::Clock_t::now();
+         checkpoint.iterations = resumedIterations;
+         for ( auto iterations : snapshotIterations ) checkpoint.iterations += iterations;
+         try
+         {
+            if ( outOfCore )
+            {
+               //Unmapped first, the header only gets the iterations once all of their hits are in the file
+               outOfCore.reset();
+               WriteHistogramFileInfo( partPath, checkpoint );
+               MoveHistogramFile( partPath, settings.checkpointPath );
+            }
+            else WriteHistogramFile( settings.checkpointPath, histogram, checkpoint );
+         }
+         catch ( const HistogramFileError& error )
+         {
+            //The render goes on, a later checkpoint may succeed
+            result.checkpointError = error.what();
+         }
+         checkpointTime.Add( Trace::Clock_t::now() - checkpointStart );
+      };
+
+      //The checkpoints are written on a thread of their own, the calculators only hand over their buffers. An
+      //out-of-core render has its histogram in the file already, its checkpoint is only complete at the end
+      std::mutex checkpointMutex;
+      std::condition_variable checkpointStopped;
+      auto isCheckpointStopping = false;
+      std::thread checkpointer;
+      if ( !settings.checkpointPath.empty() && settings.checkpointInterval.count() > 0 && !outOfCore )
+      {
+         checkpointer = std::thread( [&]()
+         {
+            std::unique_lock<std::mutex> lock( checkpointMutex );
+            while ( !checkpointStopped.wait_for( lock, settings.checkpointInterval, [&]() { return isCheckpointStopping; } ) )
+            {
+               std::lock_guard<std::mutex> guard( histogramMutex );
+               takeSnapshots( nullptr );
+               writeCheckpoint();
+            }
+         } );
+      }
+
+      //Runs all calculators until they did the given number of iterations more, the first one takes the remainder.
+      //Returns the iterations of all calculators so far, including those of the checkpoint
+      auto runPhase = [&]( uint64_t phase )
+      {
+         for ( size_t idx = 0; idx < threads; idx++ )
+         {
+            const auto share = phase / threads + ( idx == 0 ? phase % threads : 0 );
+            //A budget of 0 would not stop
+            if ( share ) calculators[idx]->Start( *scheduler, share, settings.priority );
+         }
+         uint64_t iterations = resumedIterations;
+         for ( auto& calc : calculators )
+         {
+            calc->Wait();
+            iterations += calc->GetIterations();
+         }
+         return iterations;
+      };
+
+      //The noise falls with the square root of the iterations, the merge of the nodes has nodes times those of one
+      auto convergence = settings.convergence;
+      convergence.targetNoise *= std::sqrt( static_cast<float>( settings.nodes ) );
+      ConvergenceTracker tracker( histogramWidth, histogramHeight, settings.superSampling, convergence );
+      result.iterations = resumedIterations;
+      const auto remaining = budget - std::min( budget, resumedIterations );
+
+      if ( settings.convergence.IsEnabled() )
+      {
+         //Every phase ends with a snapshot, whose changes update the noise estimate. The first phase gives every
+         //pixel a few hits, the next ones aim a little past the predicted iterations, but at most double them. A
+         //resumed render starts from the noise of the checkpoint
+         DirtyTiles changes( histogramWidth, histogramHeight, settings.superSampling );
+         if ( isResuming ) scheduler->Run( [&]() { tracker.Update( histogram, nullptr, scheduler->GetThreadCount() + 1 ); } );
+         auto phase = tracker.IsConverged() ? 0 : std::min( remaining, std::max<uint64_t>( budget / 64, settings.width * settings.height ) );
+         while ( phase )
+         {
+            result.iterations = runPhase( phase );
+            if ( outOfCore )
+            {
+               //The calculators added all of their hits when they stopped, but tracked no changes
+               scheduler->Run( [&]() { tracker.Update( histogram, nullptr, scheduler->GetThreadCount() + 1 ); } );
+            }
+            else
+            {
+               std::lock_guard<std::mutex> guard( histogramMutex );
+               takeSnapshots( &changes );
+               scheduler->Run( [&]() { tracker.Update( histogram, &changes, scheduler->GetThreadCount() + 1 ); } );
+            }
+            changes.Clear();
+            if ( tracker.IsConverged() || result.iterations >= budget ) break;
+
+            const auto predicted = tracker.PredictIterations( result.iterations ) * 11 / 10;
+            phase = predicted > result.iterations ? predicted - result.iterations : result.iterations / 8;
+            phase = std::min( { std::max( phase, result.iterations / 8 ), result.iterations, budget - result.iterations } );
+         }
+      }
+      else
+      {
+         result.iterations = runPhase( remaining );
+      }
+
+      if ( checkpointer.joinable() )
+      {
+         {
+            std::lock_guard<std::mutex> guard( checkpointMutex );
+            isCheckpointStopping = true;
+         }
+         checkpointStopped.notify_all();
+         checkpointer.join();
+      }
+      reporter.Stop();
+      for ( size_t idx = 0; idx < threads; idx++ )
+      {
+         calculators[idx]->Flush( histogram );
+         snapshotIterations[idx] = calculators[idx]->GetIterations();
+         finalStats[idx] = calculators[idx]->GetStats();
+         result.stats += finalStats[idx];
+         //Free the buffers right away, the resolve needs the memory more
+         calculators[idx].reset();
+      }
+      isFinished = true;
+      //The final checkpoint can be resumed with a larger budget, or resolved again
+      if ( !settings.checkpointPath.empty() && !outOfCore ) writeCheckpoint();
+
+      //Renders with a fixed budget still report their noise
+      if ( !settings.convergence.IsEnabled() )
+      {
+         scheduler->Run( [&]() { tracker.Update( histogram, nullptr, scheduler->GetThreadCount() + 1 ); } );
+      }
+      result.noise = tracker.GetNoise();
+      result.isConverged = tracker.IsConverged();
+
+      if ( settings.resolve )
+      {
+         result.image = ImageBuffer( settings.width, settings.height, settings.format );
+         TraceScope trace( "resolve", "render" );
+         const auto resolveStart = Trace::Clock_t::now();
+         scheduler->Run( [&]()
+         {
+            histogram.Resolve( result.image.GetView(), settings.superSampling, scheduler->GetThreadCount() + 1 );
+         } );
+         resolveTime.Add( Trace::Clock_t::now() - resolveStart );
+      }
+      result.resolve = resolveTime.Get();
+      if ( outOfCore ) writeCheckpoint();
+      result.checkpoints = checkpointTime.Get();
+      if ( settings.statsOut ) reporter.Dump( *settings.statsOut );
+
+      result.wallTime = std::chrono::high_resolution_clock::now() - start;
+      return result;
+   }
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include "FlameCalculator.h"
+#include "Convergence.h"
+#include "ImageView.h"
+#include "Parallel.h"
+#include "Stats.h"
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace flame
+{
+   //! \brief Settings of a headless render
+   struct RenderSettings
+   {
+      size_t width = 1024;
+      size_t height = 1024;
+      size_t superSampling = 2;
+      //! \brief Number of calculators, and of workers if the render creates its own scheduler
+      size_t threads = HardwareThreads();
+      //! \brief Pins the workers of the render's own scheduler, see SchedulerSettings
+      bool pinThreads = false;
+      //! \brief Priority of the iteration tasks on a shared scheduler
+      TaskPriority priority = TaskPriority::Normal;
+      //! \brief Iterations per output pixel, only used if iterations is 0
+      double samplesPerPixel = 1000.0;
+      //! \brief Total number of iterations over all threads
+      uint64_t iterations = 0;
+      IterationMode mode = IterationMode::Batch;
+      //! \brief Fast math trades a little accuracy of the variations for speed, see MathPrecision
+      MathPrecision precision = MathPrecision::Exact;
+      //! \brief Number of shards of a SharedHistogram that all threads plot into, 0 gives every thread its own
+      //!        histograms. Fewer shards need less memory, more shards less contention
+      size_t histogramShards = 0;
+      //! \brief Placement of the buffers of the calculators, see MemoryPolicy. Ignored with histogram shards
+      MemoryPolicy memory;
+      //! \brief Calculator i draws stream i of the seed. Renders with the same seed, threads, mode and budget are
+      //!        identical, unless several threads share a shard, the order of their additions varies. Resumed renders
+      //!        and nodes draw stream i + 65536 * ( n * nodes + node ) instead, where n counts the renders that the
+      //!        checkpoint went through
+      uint64_t seed = 0;
+      //! \brief Stops the render once the noise estimate reaches the target. The iteration budget is then the
+      //!        maximum, the render runs in phases whose sizes follow the predicted iterations
+      ConvergenceSettings convergence;
+      //! \brief Receives stats dumps of the calculators every statsInterval and a final one after the resolve, see
+      //!        StatsReporter. nullptr for none
+      std::ostream* statsOut = nullptr;
+      StatsFormat statsFormat = StatsFormat::Json;
+      std::chrono::milliseconds statsInterval{ 1000 };
+      //! \brief Pixel format of the resolved image, e.g. the one of the file it is written to
+      PixelFormat format;
+      //! \brief Writes the histogram to this file every checkpointInterval and once the iteration is done, see
+      //!        WriteHistogramFile. The calculators keep iterating while a checkpoint is written. Empty for none
+      std::string checkpointPath;
+      std::chrono::seconds checkpointInterval{ 300 };
+      //! \brief Continues from the checkpoint file if there is one, and starts a new render otherwise, so that a
+      //!        render that was killed can be restarted as it is. The iterations of the checkpoint count towards the
+      //!        budget. The genome and the size of the checkpoint have to be those of the render
+      bool resume = false;
+      //! \brief Node of a distributed render, and the number of nodes. Every node renders its share of the budget
+      //!        into the checkpoint file, which MergeHistogramFiles sums with those of the other nodes. The target
+      //!        noise is the one of the merged image, the nodes stop at the noise that gives it
+      uint32_t node = 0;
+      uint32_t nodes = 1;
+      //! \brief Resolves the image, which the nodes of a distributed render leave to the merge
+      bool resolve = true;
+      //! \brief Keeps the histogram in the checkpoint file instead of memory, see OutOfCoreHistogram. The size of
+      //!        the render is then limited by the disk, but it only has a checkpoint once it is done, until then the
+      //!        file has the suffix ".part". Resuming prefers the part file of a render that was killed over the
+      //!        checkpoint, it has the hits of the checkpoint and some more. Its iterations are only those of the
+      //!        checkpoint, so the render does a bit more than its budget. Histogram shards and the memory policy are
+      //!        ignored
+      bool outOfCore = false;
+
+      //! \brief Total number of iterations that the settings ask for
+      uint64_t GetIterationBudget() const
+      {
+         return iterations ? iterations : static_cast<uint64_t>( samplesPerPixel * width * height );
+      }
+
+      //! \brief Share of the budget of this node, node 0 takes the remainder
+      uint64_t GetNodeBudget() const
+      {
+         const auto budget = GetIterationBudget();
+         return budget / nodes + ( node == 0 ? budget % nodes : 0 );
+      }
+   };
+
+   //! \brief Resolved image and statistics of a headless render
+   struct RenderResult
+   {
+      //! \brief Empty if the settings don't resolve
+      ImageBuffer image;
+      uint64_t iterations;
+      std::chrono::duration<double> wallTime;
+      //! \brief Noise estimate of the final histogram, see ConvergenceTracker
+      float noise;
+      //! \brief Whether the render stopped because it reached the target noise
+      bool isConverged;
+      //! \brief Iterations of the checkpoint that the render resumed from, 0 for a new render
+      uint64_t resumedIterations;
+      //! \brief Why the last checkpoint that failed was not written, empty if all of them were
+      std::string checkpointError;
+      //! \brief Sum of the stats of all calculators
+      CalculatorStats stats;
+      DurationStats resolve;
+      DurationStats checkpoints;
+
+      double GetIterationsPerSecond() const { return iterations / wallTime.count(); }
+   };
+
+   //! \brief Renders the given functions without any display. The calculators run until the sample budget is used
+   //!        up or the render converged, their histograms are collected and resolved with all threads. Throws a
+   //!        HistogramFileError if the checkpoint to resume from doesn't fit the render, and a std::runtime_error
+   //!        for a node that is not one of the nodes or an out-of-core render without a checkpoint path
+   //! \param scheduler Runs the iteration and the resolve, shared with other renders. Without one the render
+   //!        creates its own with settings.threads workers
+   RenderResult RenderHeadless( const FlameFunctionSet& functions, const RenderSettings& settings, TaskScheduler* scheduler = nullptr );
+}
@@ -1,9 +1,13 @@
 #pragma once
 #include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
 #include "Colors.h"
 #include <vector>
 #include <algorithm>
 #include "MathUtil.h"
+#include "Parallel.h"
 
 namespace flame
 {
@@ -17,6 +21,81 @@ namespace flame
       uint8_t  unused;
    };
 
+   //! \brief Rectangle [x0,x1) x [y0,y1) in histogram coordinates
+   struct TileRect
+   {
+      size_t x0, y0, x1, y1;
+   };
+
+   //! \brief Splits a histogram into square tiles of the given edge length, the tiles at the right and bottom border
+   //!        may be smaller
+   class TileGrid
+   {
+   public:
+      TileGrid( size_t width, size_t height, size_t tileEdge ) :
+         _width( width ),
+         _height( height ),
+         _tileEdge( tileEdge ),
+         _tilesX( ( width + tileEdge - 1 ) / tileEdge ),
+         _tilesY( ( height + tileEdge - 1 ) / tileEdge )
+      {
+      }
+
+      size_t GetTileCount() const { return _tilesX * _tilesY; }
+      size_t GetTileIndex( size_t x, size_t y ) const { return ( y / _tileEdge ) * _tilesX + x / _tileEdge; }
+
+      TileRect GetTileRect( size_t tile ) const
+      {
+         const auto tx = tile % _tilesX;
+         const auto ty = tile / _tilesX;
+         return{ tx * _tileEdge, ty * _tileEdge, std::min( ( tx + 1 ) * _tileEdge, _width ), std::min( ( ty + 1 ) * _tileEdge, _height ) };
+      }
+
+   private:
+      size_t _width, _height;
+      size_t _tileEdge;
+      size_t _tilesX, _tilesY;
+   };
+
+   //! \brief Counts how many hits each tile of a histogram received since it was last reset. A tile covers
+   //!        TileSize x TileSize output pixels, i.e. TileSize * superSampling histogram entries in each direction,
+   //!        so that tiles never split a supersampled pixel
+   class DirtyTiles : public TileGrid
+   {
+   public:
+      static constexpr size_t TileSize = 32;
+
+      DirtyTiles( size_t width, size_t height, size_t superSampling ) :
+         TileGrid( width, height, TileSize * superSampling ),
+         _hits( GetTileCount(), 0 ),
+         _maxCount( 0 )
+      {
+      }
+
+      //! \brief Records a hit at the given histogram coordinates
+      void Mark( size_t x, size_t y ) { _hits[GetTileIndex( x, y )]++; }
+      void MarkTile( size_t tile ) { _hits[tile] = std::max( _hits[tile], 1u ); }
+      void MarkAll() { for ( size_t tile = 0; tile < _hits.size(); tile++ ) MarkTile( tile ); }
+
+      void ResetTile( size_t tile ) { _hits[tile] = 0; }
+      void Clear()
+      {
+         std::fill( _hits.begin(), _hits.end(), 0 );
+         _maxCount = 0;
+      }
+
+      bool IsDirty( size_t tile ) const { return _hits[tile] != 0; }
+      uint32_t GetHits( size_t tile ) const { return _hits[tile]; }
+
+      //! \brief Highest histogram count within the dirty tiles, as reported through RaiseMaxCount
+      uint32_t GetMaxCount() const { return _maxCount; }
+      void RaiseMaxCount( uint32_t count ) { _maxCount = std::max( _maxCount, count ); }
+
+   private:
+      std::vector<uint32_t> _hits;
+      uint32_t _maxCount;
+   };
+
    template<typename _EntryType>
    class Histogram
    {
@@ -34,7 +113,7 @@ namespace flame
       _EntryType& operator[]( const std::pair<size_t, size_t>& idx )
       {
 #ifdef _DEBUG
-         if ( idx.first >= _width || idx.second >= _height ) throw std::exception( "Index out of bounds!" );
+         if ( idx.first >= _width || idx.second >= _height ) throw std::runtime_error( "Index out of bounds!" );
 #endif
          return _entries[( idx.second * _width ) + idx.first];
       }
@@ -44,34 +123,80 @@ namespace flame
          return _entries[idx];
       }
 
+      const _EntryType& operator[]( size_t idx ) const
+      {
+         return _entries[idx];
+      }
+
       void Clear()
       {
-         for ( auto& entry : _entries )
+         std::fill( _entries.begin(), _entries.end(), _EntryType::Blank() );
+         _resolvedMaxCount = 0;
+      }
+
+      //! \brief Clears all entries within the given rectangle
+      void Clear( const TileRect& rect )
+      {
+         for ( auto y = rect.y0; y < rect.y1; y++ )
          {
-            entry = _EntryType::Blank();
+            std::fill( _entries.begin() + y * _width + rect.x0, _entries.begin() + y * _width + rect.x1, _EntryType::Blank() );
          }
       }
 
       //! \brief Copies the content of this histogram to the given other histogram
       void CopyTo( Histogram& other ) const
       {
-         if ( _width != other._width || _height != other._height ) throw std::exception( "Size mismatch!" );
+         if ( _width != other._width || _height != other._height ) throw std::runtime_error( "Size mismatch!" );
          auto thisPtr = _entries.data();
          auto otherPtr = other._entries.data();
          std::memcpy( otherPtr, thisPtr, _width * _height * sizeof( _EntryType ) );
       }
 
       //! \brief Resolves the histogram into a range of colors. The range has to be big enough to store all
-      //!        the entries of the histogram, divided by the superSampling squared
+      //!        the entries of the histogram, divided by the superSampling squared. The work is split into tiles
+      //!        that are processed by up to threadBudget threads
+      template<typename RndIter>
+      void Resolve( RndIter begin, RndIter end, size_t superSampling = 1, size_t threadBudget = 1 );
+
+      //! \brief Resolves only the tiles that changed into a range that still holds the result of the previous
+      //!        Resolve or ResolveChanges call, then clears the changes. Everything is resolved again if the maximum
+      //!        count of the changed tiles moved the normalization by a visible amount (more than 1/512)
       template<typename RndIter>
-      void Resolve( RndIter begin, RndIter end, size_t superSampling = 1 );
+      void ResolveChanges( RndIter begin, RndIter end, size_t superSampling, DirtyTiles& changes, size_t threadBudget = 1 );
+
+      //! \brief Returns the highest count of all entries, computed over tiles by up to threadBudget threads
+      uint32_t MaxCount( size_t threadBudget = 1 ) const
+      {
+         const TileGrid grid( _width, _height, ParallelTileEdge );
+         std::vector<uint32_t> tileMax( grid.GetTileCount() );
+         ParallelFor( grid.GetTileCount(), threadBudget, [&]( size_t tile )
+         {
+            const auto rect = grid.GetTileRect( tile );
+            uint32_t maxCount = 0;
+            for ( auto y = rect.y0; y < rect.y1; y++ )
+            {
+               for ( auto idx = y * _width + rect.x0; idx < y * _width + rect.x1; idx++ ) maxCount = std::max( maxCount, _entries[idx].count );
+            }
+            tileMax[tile] = maxCount;
+         } );
+         return tileMax.empty() ? 0 : *std::max_element( tileMax.begin(), tileMax.end() );
+      }
+
+      //! \brief Edge length of the tiles that parallel operations split the histogram into. 64x64 entries of 8 bytes
+      //!        are 32KB, which stays within the L1/L2 cache while a tile is processed
+      static constexpr size_t ParallelTileEdge = 64;
 
       auto GetWidth() const { return _width; }
       auto GetHeight() const { return _height; }
 
    private:
+      template<typename RndIter>
+      void ResolveRect( RndIter begin, size_t superSampling, const TileRect& rect, float logMaxCount ) const;
+
       const size_t _width, _height;
       std::vector<_EntryType> _entries;
+      //! \brief Maximum count that the resolved colors were normalized with, 0 if there was no resolve yet
+      uint32_t _resolvedMaxCount = 0;
    };
 
    //! \brief A simple histogram that does not support concurrent access
@@ -81,51 +206,58 @@ namespace flame
    {
       //! \brief Resolve histogram with supersampling of 1 (i.e. no supersampling)
       template<typename RndIter>
-      void ResolveImpl_SS1( RndIter begin, const std::vector<HistogramEntry>& histogram, size_t width, size_t height, float maxIntensity )
+      void ResolveImpl_SS1( RndIter begin, const std::vector<HistogramEntry>& histogram, size_t width, const TileRect& rect, float maxIntensity )
       {
-         for ( const auto& entry : histogram )
+         for ( auto y = rect.y0; y < rect.y1; y++ )
          {
-            auto intensity = std::log2f( static_cast<float>( entry.count ) ) / maxIntensity;
-            *begin++ = entry.color * intensity;
+            auto out = begin + y * width + rect.x0;
+            for ( auto x = rect.x0; x < rect.x1; x++ )
+            {
+               const auto& entry = histogram[y*width + x];
+               auto intensity = std::log2( static_cast<float>( entry.count ) ) / maxIntensity;
+               *out++ = entry.color * intensity;
+            }
          }
       }
 
       template<typename RndIter>
-      void ResolveImpl_SS2( RndIter begin, const std::vector<HistogramEntry>& histogram, size_t width, size_t height, float maxIntensity )
+      void ResolveImpl_SS2( RndIter begin, const std::vector<HistogramEntry>& histogram, size_t width, const TileRect& rect, float maxIntensity )
       {
          //Loop unrolling for better performance
          const auto scaleFactor = 1.f / ( 4 * maxIntensity );
-         for ( size_t y = 0; y < height; y += 2 )
+         for ( auto y = rect.y0; y < rect.y1; y += 2 )
          {
-            for ( size_t x = 0; x < width; x += 2 )
+            auto out = begin + ( y / 2 ) * ( width / 2 ) + rect.x0 / 2;
+            for ( auto x = rect.x0; x < rect.x1; x += 2 )
             {
                auto& e1 = histogram[y*width + x];
                auto& e2 = histogram[y*width + x + 1];
                auto& e3 = histogram[( y + 1 )*width + x];
                auto& e4 = histogram[( y + 1 )*width + x + 1];
 
-               //auto i1 = std::log2f( static_cast<float>( e1.count ) ) * scaleFactor;
-               //auto i2 = std::log2f( static_cast<float>( e2.count ) ) * scaleFactor;
-               //auto i3 = std::log2f( static_cast<float>( e3.count ) ) * scaleFactor;
-               //auto i4 = std::log2f( static_cast<float>( e4.count ) ) * scaleFactor;
+               //auto i1 = std::log2( static_cast<float>( e1.count ) ) * scaleFactor;
+               //auto i2 = std::log2( static_cast<float>( e2.count ) ) * scaleFactor;
+               //auto i3 = std::log2( static_cast<float>( e3.count ) ) * scaleFactor;
+               //auto i4 = std::log2( static_cast<float>( e4.count ) ) * scaleFactor;
 
                auto i1 = static_cast<float>( FastLog2( e1.count ) ) * scaleFactor;
                auto i2 = static_cast<float>( FastLog2( e2.count ) ) * scaleFactor;
                auto i3 = static_cast<float>( FastLog2( e3.count ) ) * scaleFactor;
                auto i4 = static_cast<float>( FastLog2( e4.count ) ) * scaleFactor;
 
-               *begin++ = ( e1.color * i1 + e2.color * i2 + e3.color * i3 + e4.color * i4 );
+               *out++ = ( e1.color * i1 + e2.color * i2 + e3.color * i3 + e4.color * i4 );
             }
          }
       }
 
       template<typename RndIter>
-      void ResolveImpl_SSHigh( RndIter begin, const std::vector<HistogramEntry>& histogram, size_t width, size_t height, float maxIntensity, size_t ss )
+      void ResolveImpl_SSHigh( RndIter begin, const std::vector<HistogramEntry>& histogram, size_t width, const TileRect& rect, float maxIntensity, size_t ss )
       {
          auto invSamples = 1.f / ss;
-         for ( size_t y = 0; y < height; y += ss )
+         for ( auto y = rect.y0; y < rect.y1; y += ss )
          {
-            for ( size_t x = 0; x < width; x += ss )
+            auto out = begin + ( y / ss ) * ( width / ss ) + rect.x0 / ss;
+            for ( auto x = rect.x0; x < rect.x1; x += ss )
             {
                Color3_16 accumulator;
                for ( auto ssy = y; ssy < y + ss; ssy++ )
@@ -133,11 +265,11 @@ namespace flame
                   for ( auto ssx = x; ssx < x + ss; ssx++ )
                   {
                      const auto& entry = histogram[ssy*width + ssx];
-                     auto intensity = std::log2f( static_cast<float>( entry.count ) ) / maxIntensity;
+                     auto intensity = std::log2( static_cast<float>( entry.count ) ) / maxIntensity;
                      accumulator += entry.color * intensity;
                   }
                }
-               *begin++ = Color3_8(
+               *out++ = Color3_8(
                   static_cast<uint8_t>( accumulator.r * invSamples ),
                   static_cast<uint8_t>( accumulator.g * invSamples ),
                   static_cast<uint8_t>( accumulator.b * invSamples )
@@ -149,45 +281,109 @@ namespace flame
 
    template <>
    template <class RndIter>
-   void Histogram<HistogramEntry>::Resolve( RndIter begin, RndIter end, size_t superSampling )
+   void Histogram<HistogramEntry>::ResolveRect( RndIter begin, size_t superSampling, const TileRect& rect, float logMaxCount ) const
    {
-#ifdef _DEBUG
-      auto dist = std::distance( begin, end );
-      if ( dist != ( _width / superSampling ) * ( _height / superSampling ) ) throw std::exception( "Range has the wrong size!" );
-#endif
-      auto maxCountIter = std::max_element( _entries.begin(), _entries.end(), []( const auto& l, const auto& r )
-      {
-         return l.count < r.count;
-      } );
-      auto logMaxCount = std::log2f( static_cast<float>( ( *maxCountIter ).count ) );
-
       switch ( superSampling )
       {
       case 1:
-         impl::ResolveImpl_SS1( begin, _entries, _width, _height, logMaxCount );
+         impl::ResolveImpl_SS1( begin, _entries, _width, rect, logMaxCount );
          break;
       case 2:
-         impl::ResolveImpl_SS2( begin, _entries, _width, _height, logMaxCount );
+         impl::ResolveImpl_SS2( begin, _entries, _width, rect, logMaxCount );
          break;
       default:
-         impl::ResolveImpl_SSHigh( begin, _entries, _width, _height, logMaxCount, superSampling );
+         impl::ResolveImpl_SSHigh( begin, _entries, _width, rect, logMaxCount, superSampling );
          break;
       }
    }
 
+   template <>
+   template <class RndIter>
+   void Histogram<HistogramEntry>::Resolve( RndIter begin, RndIter end, size_t superSampling, size_t threadBudget )
+   {
+      const auto dist = static_cast<size_t>( std::distance( begin, end ) );
+      if ( dist != ( _width / superSampling ) * ( _height / superSampling ) ) throw std::runtime_error( "Range has the wrong size!" );
+      _resolvedMaxCount = MaxCount( threadBudget );
+      auto logMaxCount = std::log2( static_cast<float>( _resolvedMaxCount ) );
+
+      //The tile edge has to be a multiple of the supersampling, so the dirty tile layout is used
+      const DirtyTiles grid( _width, _height, superSampling );
+      ParallelFor( grid.GetTileCount(), threadBudget, [&]( size_t tile )
+      {
+         ResolveRect( begin, superSampling, grid.GetTileRect( tile ), logMaxCount );
+      } );
+   }
+
+   template <>
+   template <class RndIter>
+   void Histogram<HistogramEntry>::ResolveChanges( RndIter begin, RndIter end, size_t superSampling, DirtyTiles& changes, size_t threadBudget )
+   {
+      //Counts only ever grow between two clears, so the new maximum is either the old one or within the changes
+      const auto maxCount = std::max( _resolvedMaxCount, changes.GetMaxCount() );
+      const auto logMaxCount = std::log2( static_cast<float>( maxCount ) );
+      const auto resolvedLogMaxCount = std::log2( static_cast<float>( _resolvedMaxCount ) );
+
+      if ( !_resolvedMaxCount || ( logMaxCount - resolvedLogMaxCount ) * 512 > resolvedLogMaxCount )
+      {
+         Resolve( begin, end, superSampling, threadBudget );
+      }
+      else
+      {
+         ParallelFor( changes.GetTileCount(), threadBudget, [&]( size_t tile )
+         {
+            if ( changes.IsDirty( tile ) ) ResolveRect( begin, superSampling, changes.GetTileRect( tile ), resolvedLogMaxCount );
+         } );
+      }
+      changes.Clear();
+   }
+
+   //! \brief Adds the hits within the given rectangle of one histogram to another histogram of the same size
+   //! \returns The highest count within the rectangle of the destination histogram after adding
    template<typename _EntryType>
-   void MergeHistograms( std::vector<Histogram<_EntryType>>& histograms )
+   uint32_t AddHistogram( Histogram<_EntryType>& dst, const Histogram<_EntryType>& from, const TileRect& rect )
    {
-      auto& dst = histograms[0];
-      for ( size_t h = 1; h < histograms.size(); h++ )
+      if ( dst.GetWidth() != from.GetWidth() || dst.GetHeight() != from.GetHeight() ) throw std::runtime_error( "Size mismatch!" );
+      uint32_t maxCount = 0;
+      for ( auto y = rect.y0; y < rect.y1; y++ )
       {
-         auto& from = histograms[h];
-         for ( size_t idx = 0; idx < from.GetWidth() * from.GetHeight(); idx++ )
+         for ( auto idx = y * from.GetWidth() + rect.x0; idx < y * from.GetWidth() + rect.x1; idx++ )
          {
-            dst[idx].count += from[idx].count;
-            dst[idx].color = dst[idx].color.BlendWith( from[idx].color, 0.5f );
+            const auto& src = from[idx];
+            auto& entry = dst[idx];
+            if ( src.count )
+            {
+               //Empty entries are black, blending with them would darken the color
+               entry.color = entry.count ? entry.color.BlendWith( src.color, 0.5f ) : src.color;
+               entry.count += src.count;
+            }
+            maxCount = std::max( maxCount, entry.count );
          }
       }
+      return maxCount;
+   }
+
+   //! \brief Adds the hits of one histogram to another histogram of the same size
+   template<typename _EntryType>
+   uint32_t AddHistogram( Histogram<_EntryType>& dst, const Histogram<_EntryType>& from )
+   {
+      return AddHistogram( dst, from, { 0, 0, from.GetWidth(), from.GetHeight() } );
+   }
+
+   //! \brief Adds all histograms to the first one. The work is split into tiles that are processed by up to
+   //!        threadBudget threads, each tile of the destination stays in the cache while all sources are added
+   template<typename _EntryType>
+   void MergeHistograms( std::vector<Histogram<_EntryType>>& histograms, size_t threadBudget = 1 )
+   {
+      auto& dst = histograms[0];
+      const TileGrid grid( dst.GetWidth(), dst.GetHeight(), Histogram<_EntryType>::ParallelTileEdge );
+      ParallelFor( grid.GetTileCount(), threadBudget, [&]( size_t tile )
+      {
+         const auto rect = grid.GetTileRect( tile );
+         for ( size_t h = 1; h < histograms.size(); h++ )
+         {
+            AddHistogram( dst, histograms[h], rect );
+         }
+      } );
    }
 
 }
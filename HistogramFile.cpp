@@ -0,0 +1,374 @@
+#include "HistogramFile.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace flame
+{
+   namespace
+   {
+      const char Magic[8] = { 'F', 'L', 'A', 'M', 'E', 'H', 'S', 'T' };
+      //! \brief Version 2 has integer color sums
+      constexpr uint32_t FormatVersion = 2;
+      //! \brief Reads as another value on a machine of the other byte order
+      constexpr uint32_t ByteOrderMark = 0x01020304;
+      constexpr size_t Planes = 1 + FlameHistogram_t::Channels;
+
+      //! \brief The header as it is stored, at the start of the file
+      struct RawHeader
+      {
+         char magic[8];
+         uint32_t version;
+         uint32_t byteOrder;
+         uint64_t genomeHash;
+         uint64_t width, height, superSampling;
+         uint64_t iterations;
+         uint64_t seed;
+         uint32_t segments;
+         uint32_t node;
+         uint64_t storageSize;
+         //! \brief 0 in files from before distributed renders, which had one node
+         uint32_t nodes;
+         uint32_t reserved;
+      };
+      static_assert( std::is_trivially_copyable<RawHeader>::value && sizeof( RawHeader ) <= FileViewAlignment, "The header is copied bytewise" );
+
+      //! \brief Plane 0 has the counts, the others the color sums
+      size_t GetEntryBytes( size_t plane )
+      {
+         return plane ? sizeof( FlameHistogram_t::ColorSum_t ) : sizeof( uint32_t );
+      }
+
+      size_t GetPlaneBytes( uint64_t storageSize, size_t plane )
+      {
+         return static_cast<size_t>( storageSize ) * GetEntryBytes( plane );
+      }
+
+      uint64_t GetPlaneOffset( uint64_t storageSize, size_t plane )
+      {
+         uint64_t offset = FileViewAlignment;
+         for ( size_t previous = 0; previous < plane; previous++ )
+         {
+            offset += ( GetPlaneBytes( storageSize, previous ) + FileViewAlignment - 1 ) / FileViewAlignment * FileViewAlignment;
+         }
+         return offset;
+      }
+
+      //! \brief Flushes the written data of the file from the OS caches to the disk
+      bool SyncFile( std::FILE* file )
+      {
+#if defined(_WIN32)
+         return _commit( _fileno( file ) ) == 0;
+#else
+         return fsync( fileno( file ) ) == 0;
+#endif
+      }
+
+      //! \brief Extends the file to the given size with zeros, which are holes in file systems with sparse files
+      bool ResizeFile( std::FILE* file, uint64_t bytes )
+      {
+#if defined(_WIN32)
+         return _chsize_s( _fileno( file ), static_cast<__int64>( bytes ) ) == 0;
+#else
+         return ftruncate( fileno( file ), static_cast<off_t>( bytes ) ) == 0;
+#endif
+      }
+
+      //! \brief The last plane is padded too
+      uint64_t GetFileBytes( uint64_t storageSize )
+      {
+         return GetPlaneOffset( storageSize, Planes );
+      }
+
+      RawHeader ToHeader( const HistogramFileInfo& info )
+      {
+         RawHeader header = {};
+         std::copy( std::begin( Magic ), std::end( Magic ), header.magic );
+         header.version = FormatVersion;
+         header.byteOrder = ByteOrderMark;
+         header.genomeHash = info.genomeHash;
+         header.width = info.width;
+         header.height = info.height;
+         header.superSampling = info.superSampling;
+         header.iterations = info.iterations;
+         header.seed = info.seed;
+         header.segments = info.segments;
+         header.node = info.node;
+         header.nodes = info.nodes;
+         header.storageSize = TiledLayout( info.width, info.height ).GetStorageSize();
+         return header;
+      }
+
+      //! \brief Writes the header and the padding up to the first plane
+      bool WriteHeader( std::FILE* file, const RawHeader& header )
+      {
+         const std::vector<char> padding( FileViewAlignment - sizeof( header ), 0 );
+         return std::fwrite( &header, sizeof( header ), 1, file ) == 1 && std::fwrite( padding.data(), padding.size(), 1, file ) == 1;
+      }
+
+      //! \brief Reads and validates the header, which includes checking the size of the file
+      RawHeader ReadHeader( std::ifstream& file, const std::string& path )
+      {
+         if ( !file ) throw HistogramFileError( "Can't open histogram file " + path );
+         RawHeader header;
+         file.read( reinterpret_cast<char*>( &header ), sizeof( header ) );
+         if ( !file || !std::equal( std::begin( Magic ), std::end( Magic ), header.magic ) )
+         {
+            throw HistogramFileError( path + " is not a histogram file" );
+         }
+         if ( header.byteOrder != ByteOrderMark ) throw HistogramFileError( path + " was written with another byte order" );
+         if ( header.version != FormatVersion )
+         {
+            throw HistogramFileError( path + " has format version " + std::to_string( header.version ) + ", expected " +
+                                      std::to_string( FormatVersion ) );
+         }
+         if ( header.node >= std::max( header.nodes, 1u ) ) throw HistogramFileError( path + " has an invalid node" );
+         if ( header.storageSize != TiledLayout( static_cast<size_t>( header.width ), static_cast<size_t>( header.height ) ).GetStorageSize() )
+         {
+            throw HistogramFileError( path + " has planes of the wrong size" );
+         }
+
+         file.seekg( 0, std::ios::end );
+         const auto fileBytes = static_cast<uint64_t>( file.tellg() );
+         if ( fileBytes < GetFileBytes( header.storageSize ) )
+         {
+            throw HistogramFileError( path + " is truncated" );
+         }
+         return header;
+      }
+
+      HistogramFileInfo ToInfo( const RawHeader& header )
+      {
+         HistogramFileInfo info;
+         info.genomeHash = header.genomeHash;
+         info.width = static_cast<size_t>( header.width );
+         info.height = static_cast<size_t>( header.height );
+         info.superSampling = static_cast<size_t>( header.superSampling );
+         info.iterations = header.iterations;
+         info.seed = header.seed;
+         info.segments = header.segments;
+         info.node = header.node;
+         info.nodes = std::max( header.nodes, 1u );
+         return info;
+      }
+   }
+
+   void WriteHistogramFile( const std::string& path, const FlameHistogram_t& histogram, const HistogramFileInfo& info )
+   {
+      auto sizedInfo = info;
+      sizedInfo.width = histogram.GetWidth();
+      sizedInfo.height = histogram.GetHeight();
+      const auto header = ToHeader( sizedInfo );
+
+      const auto tempPath = path + ".tmp";
+      auto file = std::fopen( tempPath.c_str(), "wb" );
+      if ( !file ) throw HistogramFileError( "Can't write histogram file " + tempPath );
+
+      const std::vector<char> padding( FileViewAlignment, 0 );
+      const void* planes[Planes] = { histogram.GetCounts(), histogram.GetColorSums( 0 ), histogram.GetColorSums( 1 ), histogram.GetColorSums( 2 ) };
+      auto isWritten = WriteHeader( file, header );
+      for ( size_t plane = 0; plane < Planes && isWritten; plane++ )
+      {
+         const auto planeBytes = GetPlaneBytes( header.storageSize, plane );
+         const auto paddingBytes = GetPlaneOffset( header.storageSize, plane + 1 ) - GetPlaneOffset( header.storageSize, plane ) - planeBytes;
+         isWritten = std::fwrite( planes[plane], planeBytes, 1, file ) == 1 &&
+            ( !paddingBytes || std::fwrite( padding.data(), static_cast<size_t>( paddingBytes ), 1, file ) == 1 );
+      }
+      isWritten = isWritten && std::fflush( file ) == 0 && SyncFile( file );
+      isWritten = std::fclose( file ) == 0 && isWritten;
+      if ( !isWritten )
+      {
+         std::remove( tempPath.c_str() );
+         throw HistogramFileError( "Can't write histogram file " + tempPath );
+      }
+
+      MoveHistogramFile( tempPath, path );
+   }
+
+   void CreateHistogramFile( const std::string& path, const HistogramFileInfo& info )
+   {
+      const auto header = ToHeader( info );
+      auto file = std::fopen( path.c_str(), "wb" );
+      if ( !file ) throw HistogramFileError( "Can't create histogram file " + path );
+      auto isWritten = WriteHeader( file, header ) && std::fflush( file ) == 0 && ResizeFile( file, GetFileBytes( header.storageSize ) );
+      isWritten = std::fclose( file ) == 0 && isWritten;
+      if ( !isWritten )
+      {
+         std::remove( path.c_str() );
+         throw HistogramFileError( "Can't create histogram file " + path + " of " + std::to_string( GetFileBytes( header.storageSize ) ) + " bytes" );
+      }
+   }
+
+   void WriteHistogramFileInfo( const std::string& path, const HistogramFileInfo& info )
+   {
+      const auto header = ToHeader( info );
+      {
+         std::ifstream file( path, std::ios::binary );
+         if ( ReadHeader( file, path ).storageSize != header.storageSize ) throw HistogramFileError( path + " has planes of another size" );
+      }
+      auto file = std::fopen( path.c_str(), "r+b" );
+      if ( !file ) throw HistogramFileError( "Can't write histogram file " + path );
+      auto isWritten = std::fwrite( &header, sizeof( header ), 1, file ) == 1 && std::fflush( file ) == 0 && SyncFile( file );
+      isWritten = std::fclose( file ) == 0 && isWritten;
+      if ( !isWritten ) throw HistogramFileError( "Can't write histogram file " + path );
+   }
+
+   void MoveHistogramFile( const std::string& from, const std::string& to )
+   {
+      //Windows doesn't rename onto existing files, there the old file is removed first
+      if ( std::rename( from.c_str(), to.c_str() ) != 0 )
+      {
+         std::remove( to.c_str() );
+         if ( std::rename( from.c_str(), to.c_str() ) != 0 ) throw HistogramFileError( "Can't replace histogram file " + to );
+      }
+   }
+
+   HistogramFileInfo ReadHistogramFileInfo( const std::string& path )
+   {
+      std::ifstream file( path, std::ios::binary );
+      return ToInfo( ReadHeader( file, path ) );
+   }
+
+   FlameHistogram_t ReadHistogramFile( const std::string& path, HistogramFileInfo& info, const MemoryPolicy& memory )
+   {
+      std::ifstream file( path, std::ios::binary );
+      const auto header = ReadHeader( file, path );
+      info = ToInfo( header );
+
+      FlameHistogram_t histogram( info.width, info.height, memory );
+      char* planes[Planes] = {
+         reinterpret_cast<char*>( histogram.GetCounts() ),
+         reinterpret_cast<char*>( histogram.GetColorSums( 0 ) ),
+         reinterpret_cast<char*>( histogram.GetColorSums( 1 ) ),
+         reinterpret_cast<char*>( histogram.GetColorSums( 2 ) )
+      };
+      for ( size_t plane = 0; plane < Planes; plane++ )
+      {
+         file.seekg( static_cast<std::streamoff>( GetPlaneOffset( header.storageSize, plane ) ) );
+         file.read( planes[plane], static_cast<std::streamsize>( GetPlaneBytes( header.storageSize, plane ) ) );
+      }
+      if ( !file ) throw HistogramFileError( "Can't read histogram file " + path );
+      histogram.ScanOccupied();
+      return histogram;
+   }
+
+   FlameHistogram_t MapHistogramFile( const std::string& path, HistogramFileInfo& info, bool isWritable )
+   {
+      uint64_t storageSize;
+      {
+         std::ifstream file( path, std::ios::binary );
+         const auto header = ReadHeader( file, path );
+         info = ToInfo( header );
+         storageSize = header.storageSize;
+      }
+
+      const auto size = static_cast<size_t>( storageSize );
+      PlaneBuffer<uint32_t> counts( size, MapFilePlane( path, GetPlaneOffset( storageSize, 0 ), GetPlaneBytes( storageSize, 0 ), isWritable ) );
+      std::array<PlaneBuffer<FlameHistogram_t::ColorSum_t>, FlameHistogram_t::Channels> colorSums;
+      for ( size_t channel = 0; channel < colorSums.size(); channel++ )
+      {
+         const auto plane = channel + 1;
+         colorSums[channel] = PlaneBuffer<FlameHistogram_t::ColorSum_t>(
+            size, MapFilePlane( path, GetPlaneOffset( storageSize, plane ), GetPlaneBytes( storageSize, plane ), isWritable ) );
+      }
+      return FlameHistogram_t( info.width, info.height, std::move( counts ), std::move( colorSums ) );
+   }
+
+   void CheckHistogramFile( const HistogramFileInfo& info, uint64_t genomeHash, size_t width, size_t height, size_t superSampling,
+                            uint32_t node, uint32_t nodes )
+   {
+      if ( info.genomeHash != genomeHash ) throw HistogramFileError( "The histogram file belongs to another genome" );
+      if ( info.width != width || info.height != height || info.superSampling != superSampling )
+      {
+         throw HistogramFileError( "The histogram file is " + std::to_string( info.width ) + "x" + std::to_string( info.height ) + " with SS " +
+                                   std::to_string( info.superSampling ) + ", the render " + std::to_string( width ) + "x" +
+                                   std::to_string( height ) + " with SS " + std::to_string( superSampling ) );
+      }
+      if ( info.node != node || info.nodes != nodes )
+      {
+         throw HistogramFileError( "The histogram file is node " + std::to_string( info.node ) + " of " + std::to_string( info.nodes ) +
+                                   ", the render node " + std::to_string( node ) + " of " + std::to_string( nodes ) );
+      }
+   }
+
+   FlameHistogram_t MergeHistogramFiles( const std::vector<std::string>& paths, HistogramFileInfo& info, size_t threadBudget,
+                                         const MemoryPolicy& memory )
+   {
+      if ( paths.empty() ) throw HistogramFileError( "No histogram files to merge" );
+      std::vector<RawHeader> headers;
+      for ( const auto& path : paths )
+      {
+         std::ifstream file( path, std::ios::binary );
+         headers.push_back( ReadHeader( file, path ) );
+      }
+
+      //The merged render continues after the streams of all nodes, see RenderSettings::seed
+      info = ToInfo( headers[0] );
+      std::vector<bool> isMerged( info.nodes, false );
+      uint32_t segments = 0;
+      info.iterations = 0;
+      for ( size_t idx = 0; idx < paths.size(); idx++ )
+      {
+         const auto shard = ToInfo( headers[idx] );
+         if ( shard.genomeHash != info.genomeHash || shard.width != info.width || shard.height != info.height ||
+              shard.superSampling != info.superSampling || shard.seed != info.seed || shard.nodes != info.nodes )
+         {
+            throw HistogramFileError( paths[idx] + " belongs to another render than " + paths[0] );
+         }
+         if ( isMerged[shard.node] ) throw HistogramFileError( paths[idx] + " repeats node " + std::to_string( shard.node ) );
+         isMerged[shard.node] = true;
+         info.iterations += shard.iterations;
+         segments = std::max( segments, shard.segments );
+      }
+      info.segments = segments * info.nodes;
+      info.node = 0;
+      info.nodes = 1;
+
+      //Every chunk reads its range of the planes of all files and adds them, the storage order is the same in all
+      FlameHistogram_t histogram( info.width, info.height, memory );
+      const auto storageSize = static_cast<size_t>( headers[0].storageSize );
+      const auto chunks = ( storageSize + MergeChunkEntries - 1 ) / MergeChunkEntries;
+      std::atomic<size_t> failedPath( paths.size() );
+      ParallelFor( chunks, threadBudget, [&]( size_t chunk )
+      {
+         const auto begin = chunk * MergeChunkEntries;
+         const auto count = std::min( MergeChunkEntries, storageSize - begin );
+         std::vector<uint32_t> counts( count );
+         std::vector<FlameHistogram_t::ColorSum_t> sums( count );
+         for ( size_t idx = 0; idx < paths.size(); idx++ )
+         {
+            std::ifstream file( paths[idx], std::ios::binary );
+            auto read = [&]( size_t plane, void* buffer )
+            {
+               file.seekg( static_cast<std::streamoff>( GetPlaneOffset( storageSize, plane ) + begin * GetEntryBytes( plane ) ) );
+               file.read( static_cast<char*>( buffer ), static_cast<std::streamsize>( count * GetEntryBytes( plane ) ) );
+            };
+            read( 0, counts.data() );
+            auto dstCounts = histogram.GetCounts() + begin;
+            for ( size_t entry = 0; entry < count; entry++ ) dstCounts[entry] += counts[entry];
+            for ( size_t channel = 0; channel < FlameHistogram_t::Channels; channel++ )
+            {
+               read( channel + 1, sums.data() );
+               auto dstSums = histogram.GetColorSums( channel ) + begin;
+               for ( size_t entry = 0; entry < count; entry++ ) dstSums[entry] += sums[entry];
+            }
+            if ( !file ) failedPath = idx;
+         }
+         //The chunks are whole blocks, so every thread sets its own flags
+         histogram.ScanOccupied( begin, begin + count );
+      } );
+      if ( failedPath != paths.size() ) throw HistogramFileError( "Can't read histogram file " + paths[failedPath] );
+      return histogram;
+   }
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include "PlanarHistogram.h"
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//Histogram files: the planes of a FlameHistogram_t with a header that says which render they belong to
+//
+//   header   magic "FLAMEHST", format version, byte order mark, HistogramFileInfo, storage size of the layout
+//   planes   counts (uint32), then the color sums (uint64) of red, green and blue, in storage order
+//
+//The header and every plane start at a multiple of FileViewAlignment, so that the planes can be mapped as they
+//are (see MapHistogramFile). Everything is in the byte order of the machine that wrote the file, files from a
+//machine of the other byte order are rejected
+
+namespace flame
+{
+   //! \brief Thrown for files that are not histogram files, are truncated or don't fit the render
+   class HistogramFileError : public std::runtime_error
+   {
+   public:
+      using std::runtime_error::runtime_error;
+   };
+
+   //! \brief What a histogram file records besides the planes
+   struct HistogramFileInfo
+   {
+      //! \brief Of the genome that was rendered, see HashGenome
+      uint64_t genomeHash = 0;
+      //! \brief Size of the histogram, i.e. of the image times the superSampling
+      size_t width = 0, height = 0;
+      size_t superSampling = 1;
+      //! \brief Iterations whose hits are in the histogram
+      uint64_t iterations = 0;
+      uint64_t seed = 0;
+      //! \brief Number of renders that added to the histogram. A resumed render continues with streams that the
+      //!        earlier ones didn't draw
+      uint32_t segments = 0;
+      //! \brief Node of a distributed render that wrote the histogram, and the number of nodes
+      uint32_t node = 0;
+      uint32_t nodes = 1;
+   };
+
+   //! \brief Writes the histogram to a temporary file next to the path, flushes it to the disk and renames it to
+   //!        the path. A crash while writing leaves the previous file intact
+   void WriteHistogramFile( const std::string& path, const FlameHistogram_t& histogram, const HistogramFileInfo& info );
+
+   //! \brief Creates a histogram file with empty planes, e.g. for a histogram that is mapped writable (see
+   //!        MapHistogramFile). The planes take no space on the disk until they are written, on file systems with
+   //!        sparse files
+   void CreateHistogramFile( const std::string& path, const HistogramFileInfo& info );
+
+   //! \brief Replaces the header of a histogram file in place and flushes the file to the disk, e.g. once the hits
+   //!        of a mapped histogram are complete. The size of the histogram has to stay the same
+   void WriteHistogramFileInfo( const std::string& path, const HistogramFileInfo& info );
+
+   //! \brief Renames a histogram file, a file at the new path is replaced
+   void MoveHistogramFile( const std::string& from, const std::string& to );
+
+   //! \brief Reads only the header of a histogram file
+   HistogramFileInfo ReadHistogramFileInfo( const std::string& path );
+
+   //! \brief Reads a histogram file into memory
+   FlameHistogram_t ReadHistogramFile( const std::string& path, HistogramFileInfo& info, const MemoryPolicy& memory = MemoryPolicy() );
+
+   //! \brief Maps the planes of a histogram file instead of reading them, the pages are loaded on first access. A
+   //!        writable histogram writes its changes through to the file, the header stays as it is. The file must
+   //!        not be replaced while the histogram is alive
+   FlameHistogram_t MapHistogramFile( const std::string& path, HistogramFileInfo& info, bool isWritable = false );
+
+   //! \brief Checks that a histogram file can continue the given render, throws a HistogramFileError otherwise
+   void CheckHistogramFile( const HistogramFileInfo& info, uint64_t genomeHash, size_t width, size_t height, size_t superSampling,
+                            uint32_t node = 0, uint32_t nodes = 1 );
+
+   //! \brief Sums the histogram files of the nodes of a distributed render, in the order of the paths, so the result
+   //!        doesn't depend on the threads. The files are streamed in chunks of MergeChunkEntries entries per thread,
+   //!        so the merge needs the memory of one histogram however many files there are. Throws a HistogramFileError
+   //!        for files of another render and for nodes that are repeated, missing nodes are left out
+   //! \param info Receives the info of the merged histogram, a render of one node that can be resumed
+   FlameHistogram_t MergeHistogramFiles( const std::vector<std::string>& paths, HistogramFileInfo& info, size_t threadBudget = 1,
+                                         const MemoryPolicy& memory = MemoryPolicy() );
+   constexpr size_t MergeChunkEntries = size_t( 1 ) << 18;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "Colors.h"
+#include <cstdint>
+#include <vector>
+
+namespace flame
+{
+
+   //! \brief Hit of the chaos game that waits in a HitBinner until it is added to the histogram
+   struct BinnedHit
+   {
+      //! \brief Storage index of the histogram entry relative to the start of its region. This keeps a hit at 8 bytes
+      //!        for histograms of any size
+      uint32_t offset;
+      Color3_8 color;
+      uint8_t  unused;
+   };
+
+   //! \brief Sorts hits into small buffers, one per region of consecutive histogram storage indices, and hands out
+   //!        a buffer once it is full. All writes of a batch go to one region, which stays in the cache while the
+   //!        batch is added, instead of every hit missing the cache somewhere in a histogram of many megabytes
+   class HitBinner
+   {
+   public:
+      //! \brief Storage indices per region, 2^14 entries of a planar histogram (28 bytes each) are 448KB
+      static constexpr size_t RegionShift = 14;
+      static constexpr size_t BinCapacity = 64;
+
+      explicit HitBinner( size_t storageSize ) :
+         _fill( ( storageSize >> RegionShift ) + 1, 0 ),
+         _hits( _fill.size() * BinCapacity )
+      {
+      }
+
+      //! \brief Adds a hit to its bin. Calls sink( size_t regionStart, const BinnedHit* hits, size_t count ) if the
+      //!        bin is full, the storage index of a hit is regionStart + offset
+      template<typename Sink>
+      void Add( size_t index, const Color3_8& color, Sink&& sink )
+      {
+         const auto bin = index >> RegionShift;
+         auto bucket = _hits.data() + bin * BinCapacity;
+         bucket[_fill[bin]] = { static_cast<uint32_t>( index - ( bin << RegionShift ) ), color, 0 };
+         if ( ++_fill[bin] == BinCapacity )
+         {
+            sink( bin << RegionShift, bucket, BinCapacity );
+            _fill[bin] = 0;
+         }
+      }
+
+      //! \brief Hands out the hits of all bins that are not empty
+      template<typename Sink>
+      void Flush( Sink&& sink )
+      {
+         for ( size_t bin = 0; bin < _fill.size(); bin++ )
+         {
+            if ( !_fill[bin] ) continue;
+            sink( bin << RegionShift, _hits.data() + bin * BinCapacity, _fill[bin] );
+            _fill[bin] = 0;
+         }
+      }
+
+   private:
+      std::vector<uint32_t> _fill;
+      std::vector<BinnedHit> _hits;
+   };
+
+}
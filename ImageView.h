@@ -0,0 +1,152 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+namespace flame
+{
+   //! \brief Order of the channels of a pixel. The alpha channel of the orders with alpha is always opaque
+   enum class ChannelOrder
+   {
+      Rgb,
+      //! \brief The order of OpenCV
+      Bgr,
+      Rgba,
+      Bgra
+   };
+
+   //! \brief Type of the channels of a pixel
+   enum class PixelType
+   {
+      //! \brief 0 to 255
+      UInt8,
+      //! \brief 0 to 65535
+      UInt16,
+      //! \brief 0 to 1
+      Float
+   };
+
+   struct PixelFormat
+   {
+      ChannelOrder order = ChannelOrder::Rgb;
+      PixelType type = PixelType::UInt8;
+
+      size_t GetChannels() const { return order == ChannelOrder::Rgb || order == ChannelOrder::Bgr ? 3 : 4; }
+      size_t GetChannelBytes() const { return type == PixelType::UInt8 ? 1 : type == PixelType::UInt16 ? 2 : 4; }
+      size_t GetPixelBytes() const { return GetChannels() * GetChannelBytes(); }
+   };
+
+   //! \brief Image in memory of the caller, like a display buffer or a cv::Mat. Rows are stride bytes apart, which
+   //!        may be more than the pixels of a row need
+   struct ImageView
+   {
+      uint8_t* data;
+      size_t width, height;
+      size_t stride;
+      PixelFormat format;
+
+      uint8_t* GetPixel( size_t x, size_t y ) const { return data + y * stride + x * format.GetPixelBytes(); }
+   };
+
+   //! \brief Image with rows of tightly packed pixels in memory of its own
+   class ImageBuffer
+   {
+   public:
+      ImageBuffer() : ImageBuffer( 0, 0, PixelFormat() ) {}
+
+      ImageBuffer( size_t width, size_t height, const PixelFormat& format ) :
+         _width( width ),
+         _height( height ),
+         _format( format ),
+         _data( width * height * format.GetPixelBytes() )
+      {
+      }
+
+      ImageView GetView() { return{ _data.data(), _width, _height, _width * _format.GetPixelBytes(), _format }; }
+
+      size_t GetWidth() const { return _width; }
+      size_t GetHeight() const { return _height; }
+      const PixelFormat& GetFormat() const { return _format; }
+   private:
+      size_t _width, _height;
+      PixelFormat _format;
+      std::vector<uint8_t> _data;
+   };
+
+   namespace impl
+   {
+      template<PixelType Type>
+      struct ChannelTraits;
+
+      template<>
+      struct ChannelTraits<PixelType::UInt8>
+      {
+         using Channel_t = uint8_t;
+         static constexpr Channel_t Opaque = 255;
+         //! \brief Truncates like the Color3_8 resolve
+         static Channel_t Convert( float value ) { return static_cast<uint8_t>( std::min( value, 255.f ) ); }
+      };
+
+      template<>
+      struct ChannelTraits<PixelType::UInt16>
+      {
+         using Channel_t = uint16_t;
+         static constexpr Channel_t Opaque = 65535;
+         static Channel_t Convert( float value ) { return static_cast<uint16_t>( std::min( value * 257.f + 0.5f, 65535.f ) ); }
+      };
+
+      template<>
+      struct ChannelTraits<PixelType::Float>
+      {
+         using Channel_t = float;
+         static constexpr float Opaque = 1.f;
+         static Channel_t Convert( float value ) { return value * ( 1.f / 255.f ); }
+      };
+
+      //! \brief Writes a pixel of the given format from channel values on the scale of 0 to 255
+      template<ChannelOrder Order, PixelType Type>
+      struct PixelStore
+      {
+         using Traits = ChannelTraits<Type>;
+         static constexpr bool IsBgr = Order == ChannelOrder::Bgr || Order == ChannelOrder::Bgra;
+         static constexpr bool HasAlpha = Order == ChannelOrder::Rgba || Order == ChannelOrder::Bgra;
+         static constexpr size_t PixelBytes = ( HasAlpha ? 4 : 3 ) * sizeof( typename Traits::Channel_t );
+
+         void operator()( uint8_t* pixel, float r, float g, float b ) const
+         {
+            auto channels = reinterpret_cast<typename Traits::Channel_t*>( pixel );
+            channels[IsBgr ? 2 : 0] = Traits::Convert( r );
+            channels[1] = Traits::Convert( g );
+            channels[IsBgr ? 0 : 2] = Traits::Convert( b );
+            if ( HasAlpha ) channels[3] = Traits::Opaque;
+         }
+      };
+
+      template<ChannelOrder Order, typename Func>
+      void DispatchPixelType( PixelType type, Func&& func )
+      {
+         switch ( type )
+         {
+         case PixelType::UInt8: func( PixelStore<Order, PixelType::UInt8>() ); break;
+         case PixelType::UInt16: func( PixelStore<Order, PixelType::UInt16>() ); break;
+         case PixelType::Float: func( PixelStore<Order, PixelType::Float>() ); break;
+         }
+      }
+   }
+
+   //! \brief Calls func with a functor store( uint8_t* pixel, float r, float g, float b ) for the format, which takes
+   //!        channel values on the scale of 0 to 255. Its type has the size of a pixel as PixelBytes. The format is
+   //!        dispatched once, so that the loops within func are compiled for every format
+   template<typename Func>
+   void DispatchPixelFormat( const PixelFormat& format, Func&& func )
+   {
+      switch ( format.order )
+      {
+      case ChannelOrder::Rgb: impl::DispatchPixelType<ChannelOrder::Rgb>( format.type, func ); break;
+      case ChannelOrder::Bgr: impl::DispatchPixelType<ChannelOrder::Bgr>( format.type, func ); break;
+      case ChannelOrder::Rgba: impl::DispatchPixelType<ChannelOrder::Rgba>( format.type, func ); break;
+      case ChannelOrder::Bgra: impl::DispatchPixelType<ChannelOrder::Bgra>( format.type, func ); break;
+      }
+   }
+}
@@ -0,0 +1,153 @@
+#include "ImageWriter.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+
+namespace flame
+{
+   namespace
+   {
+      bool EndsWith( const std::string& str, const std::string& suffix )
+      {
+         return str.size() >= suffix.size() && str.compare( str.size() - suffix.size(), suffix.size(), suffix ) == 0;
+      }
+
+      //! \brief Channel types that can be written to files with an extension, by PpmWriter or OpenCV
+      struct ImageExtension
+      {
+         const char* extension;
+         bool hasUInt8, hasUInt16, hasFloat;
+      };
+      const ImageExtension ImageExtensions[] = {
+         { ".ppm", true, true, false },
+         { ".png", true, true, false },
+         { ".tif", true, true, true },
+         { ".tiff", true, true, true },
+         { ".jpg", true, false, false },
+         { ".jpeg", true, false, false },
+         { ".bmp", true, false, false },
+         { ".webp", true, false, false },
+         { ".exr", false, false, true },
+         { ".hdr", false, false, true },
+         { ".pfm", false, false, true }
+      };
+
+      const char* GetPixelTypeName( PixelType type )
+      {
+         return type == PixelType::UInt8 ? "8" : type == PixelType::UInt16 ? "16" : "float";
+      }
+   }
+
+   PpmWriter::PpmWriter( const std::string& path, size_t width, size_t height, const PixelFormat& format ) :
+      _file( path, std::ios::binary ),
+      _width( width ),
+      _height( height ),
+      _format( format ),
+      _writtenRows( 0 ),
+      _row( width * format.GetPixelBytes() )
+   {
+      if ( format.order != ChannelOrder::Rgb || format.type == PixelType::Float )
+      {
+         throw std::runtime_error( "PPM images need RGB pixels with 8 or 16 bit channels!" );
+      }
+      if ( !_file ) throw std::runtime_error( "Can't open image file for writing!" );
+      _file << "P6\n" << width << " " << height << "\n" << ( format.type == PixelType::UInt16 ? 65535 : 255 ) << "\n";
+   }
+
+   void PpmWriter::WriteRows( const ImageView& rows )
+   {
+      if ( rows.width != _width || rows.format.order != _format.order || rows.format.type != _format.type || _writtenRows + rows.height > _height )
+      {
+         throw std::runtime_error( "Rows don't fit the image!" );
+      }
+
+      const auto rowBytes = _row.size();
+      for ( size_t y = 0; y < rows.height; y++ )
+      {
+         const auto pixels = rows.data + y * rows.stride;
+         //16 bit PPM is big endian
+         if ( _format.type == PixelType::UInt16 )
+         {
+            for ( size_t idx = 0; idx < rowBytes; idx += 2 )
+            {
+               const auto value = *reinterpret_cast<const uint16_t*>( pixels + idx );
+               _row[idx] = static_cast<uint8_t>( value >> 8 );
+               _row[idx + 1] = static_cast<uint8_t>( value & 0xff );
+            }
+            _file.write( reinterpret_cast<const char*>( _row.data() ), rowBytes );
+         }
+         else _file.write( reinterpret_cast<const char*>( pixels ), rowBytes );
+      }
+      _writtenRows += rows.height;
+   }
+
+   void PpmWriter::Close()
+   {
+      _file.close();
+      if ( !_file || _writtenRows != _height ) throw std::runtime_error( "Writing the image failed!" );
+   }
+
+   void WritePpm( const std::string& path, const ImageView& image )
+   {
+      PpmWriter writer( path, image.width, image.height, image.format );
+      writer.WriteRows( image );
+      writer.Close();
+   }
+
+   bool IsPpmPath( const std::string& path )
+   {
+      return EndsWith( path, ".ppm" );
+   }
+
+   PixelType ParsePixelType( const std::string& name )
+   {
+      if ( name == "8" ) return PixelType::UInt8;
+      if ( name == "16" ) return PixelType::UInt16;
+      if ( name == "float" ) return PixelType::Float;
+      throw std::runtime_error( "Unknown depth '" + name + "', expected 8, 16 or float" );
+   }
+
+   void CheckImageType( const std::string& path, PixelType type )
+   {
+      auto lowerPath = path;
+      std::transform( lowerPath.begin(), lowerPath.end(), lowerPath.begin(), []( char c ) { return static_cast<char>( std::tolower( static_cast<unsigned char>( c ) ) ); } );
+      const auto extension = std::find_if( std::begin( ImageExtensions ), std::end( ImageExtensions ), [&]( const ImageExtension& candidate )
+      {
+         return EndsWith( lowerPath, candidate.extension );
+      } );
+      //Other extensions are left to OpenCV, which writes 8 bit channels to all of its formats
+      const auto isSupported = extension == std::end( ImageExtensions ) ? type == PixelType::UInt8 :
+                               type == PixelType::UInt8 ? extension->hasUInt8 : type == PixelType::UInt16 ? extension->hasUInt16 : extension->hasFloat;
+      if ( !isSupported ) throw std::runtime_error( "Can't write " + path + " with a depth of " + GetPixelTypeName( type ) );
+   }
+
+   PixelFormat GetImageFormat( const std::string& path, PixelType type )
+   {
+      PixelFormat format;
+      format.order = IsPpmPath( path ) ? ChannelOrder::Rgb : ChannelOrder::Bgr;
+      format.type = type;
+      return format;
+   }
+
+   void WriteImage( const std::string& path, const ImageView& image )
+   {
+      CheckImageType( path, image.format.type );
+      if ( IsPpmPath( path ) )
+      {
+         WritePpm( path, image );
+         return;
+      }
+
+      const auto& format = image.format;
+      if ( format.order != ChannelOrder::Bgr && format.order != ChannelOrder::Bgra ) throw std::runtime_error( "OpenCV needs BGR pixels!" );
+      const auto hasAlpha = format.order == ChannelOrder::Bgra;
+      const auto type = format.type == PixelType::UInt8 ? ( hasAlpha ? CV_8UC4 : CV_8UC3 ) :
+                        format.type == PixelType::UInt16 ? ( hasAlpha ? CV_16UC4 : CV_16UC3 ) : ( hasAlpha ? CV_32FC4 : CV_32FC3 );
+      const cv::Mat mat( static_cast<int>( image.height ), static_cast<int>( image.width ), type, image.data, image.stride );
+      if ( !cv::imwrite( path, mat ) ) throw std::runtime_error( "Writing the image failed!" );
+   }
+}
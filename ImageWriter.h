@@ -0,0 +1,51 @@
+#pragma once
+#include "ImageView.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace flame
+{
+   //! \brief Writes an RGB image with 8 or 16 bit channels as binary PPM (P6) in bands of rows from top to bottom,
+   //!        so that an image can be written while it is resolved, without all of it in memory
+   class PpmWriter
+   {
+   public:
+      //! \brief Opens the file and writes the header
+      PpmWriter( const std::string& path, size_t width, size_t height, const PixelFormat& format );
+
+      //! \brief Appends the rows of an image with the width and the format of the writer
+      void WriteRows( const ImageView& rows );
+      //! \brief Throws if rows are missing or writing failed
+      void Close();
+   private:
+      std::ofstream _file;
+      const size_t _width, _height;
+      const PixelFormat _format;
+      size_t _writtenRows;
+      //! \brief A row converted to big endian, for 16 bit channels
+      std::vector<uint8_t> _row;
+   };
+
+   //! \brief Writes an RGB image with 8 or 16 bit channels as binary PPM (P6)
+   void WritePpm( const std::string& path, const ImageView& image );
+
+   //! \brief Whether WriteImage writes the path as PPM
+   bool IsPpmPath( const std::string& path );
+
+   //! \brief Parses the channel depth of an image: "8", "16" or "float". Throws a std::runtime_error for anything else
+   PixelType ParsePixelType( const std::string& name );
+
+   //! \brief Throws a std::runtime_error if WriteImage can't write the file with channels of the given type, e.g.
+   //!        float channels as ".png" or 16 bit ones as ".jpg". Checked before a render, so it doesn't fail at the end
+   void CheckImageType( const std::string& path, PixelType type );
+
+   //! \brief Pixel format that WriteImage writes the given file with, so that the image can be resolved in it
+   //!        without a conversion: RGB for ".ppm", the BGR order of OpenCV for everything else
+   PixelFormat GetImageFormat( const std::string& path, PixelType type = PixelType::UInt8 );
+
+   //! \brief Writes an image, the format is chosen by the extension of the path. ".ppm" is written directly,
+   //!        everything else (e.g. ".png", or ".exr" for float channels) goes through OpenCV. The image has to have
+   //!        the pixel format of GetImageFormat, and a type that CheckImageType accepts
+   void WriteImage( const std::string& path, const ImageView& image );
+}
@@ -1,6 +1,10 @@
 #pragma once
 #include <cstdint>
-#include <chrono>
+#include <array>
+#include <cstring>
+#include <cstddef>
+#include <vector>
+#include "SimdVec.h"
 
 inline uint32_t FastLog2( uint32_t v )
 {
@@ -19,35 +23,212 @@ inline uint32_t FastLog2( uint32_t v )
    return r;
 }
 
-//! \brief Fast, simple random number generator
-class XorShiftRnd
+//! \brief SplitMix64, turns seeds into well distributed generator states
+inline uint64_t SplitMix64( uint64_t& state )
+{
+   auto z = ( state += 0x9E3779B97F4A7C15ull );
+   z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+   z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBull;
+   return z ^ ( z >> 31 );
+}
+
+//! \brief xoshiro128++ random number generator with explicit seeding. Streams and substreams are jumps of 2^96 and
+//!        2^64 numbers ahead of the seeded state, so they never overlap, and the same seed always gives the same
+//!        numbers. Any of the 2^32 streams is reached with at most 32 precomputed jumps
+class Xoshiro128
 {
 public:
-   XorShiftRnd() :
-      //Don't ask...
-      x( std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::high_resolution_clock::now().time_since_epoch() ).count() ),
-      y( 362436069 ),
-      z( 521288629 )
+   using State_t = std::array<uint32_t, 4>;
+
+   //! \param stream Independent stream, e.g. per thread
+   //! \param substream Independent part of the stream, e.g. per SIMD lane
+   explicit Xoshiro128( uint64_t seed, uint32_t stream = 0, uint32_t substream = 0 )
    {
+      auto splitMix = seed;
+      const auto low = SplitMix64( splitMix );
+      const auto high = SplitMix64( splitMix );
+      _s = { static_cast<uint32_t>( low ), static_cast<uint32_t>( low >> 32 ), static_cast<uint32_t>( high ), static_cast<uint32_t>( high >> 32 ) };
+      //A zero state would only ever produce zeros
+      if ( !( _s[0] | _s[1] | _s[2] | _s[3] ) ) _s[0] = 1;
+
+      const auto& streamJumps = GetStreamJumps();
+      for ( size_t bit = 0; stream; bit++, stream >>= 1 )
+      {
+         if ( stream & 1 ) _s = streamJumps[bit].Apply( _s );
+      }
+      for ( uint32_t idx = 0; idx < substream; idx++ ) Jump();
    }
 
    uint32_t operator()()
    {
-      uint32_t t;
-      x ^= x << 16;
-      x ^= x >> 5;
-      x ^= x << 1;
+      const auto result = Rotl( _s[0] + _s[3], 7 ) + _s[0];
+      const auto t = _s[1] << 9;
+      _s[2] ^= _s[0];
+      _s[3] ^= _s[1];
+      _s[1] ^= _s[2];
+      _s[0] ^= _s[3];
+      _s[2] ^= t;
+      _s[3] = Rotl( _s[3], 11 );
+      return result;
+   }
+
+   //! \brief Advances by 2^64 numbers
+   void Jump() { Advance( { 0x8764000b, 0xf542d2d3, 0x6fa035c3, 0x77f2db5b } ); }
+   //! \brief Advances by 2^96 numbers
+   void LongJump() { Advance( { 0xb523952e, 0x0b6f099f, 0xccf5a0ef, 0x1c580662 } ); }
+
+   const State_t& GetState() const { return _s; }
+
+   static constexpr uint32_t min() { return 0; }
+   static constexpr uint32_t max() { return static_cast<uint32_t>( -1 ); }
+
+   static uint32_t Rotl( uint32_t v, int k ) { return ( v << k ) | ( v >> ( 32 - k ) ); }
+
+private:
+   //! \brief A jump as the linear map over GF(2) that it is, by the images of the 128 single bit states
+   struct JumpMap
+   {
+      std::array<State_t, 128> images;
+
+      State_t Apply( const State_t& s ) const
+      {
+         State_t result = { 0, 0, 0, 0 };
+         for ( size_t bit = 0; bit < images.size(); bit++ )
+         {
+            if ( !( s[bit / 32] & ( 1u << ( bit % 32 ) ) ) ) continue;
+            for ( size_t idx = 0; idx < 4; idx++ ) result[idx] ^= images[bit][idx];
+         }
+         return result;
+      }
+   };
+
+   explicit Xoshiro128( const State_t& state ) : _s( state ) {}
+
+   //! \brief Jump i advances by 2^i long jumps, each one is the previous one applied twice
+   static const std::vector<JumpMap>& GetStreamJumps()
+   {
+      static const std::vector<JumpMap> jumps = []()
+      {
+         std::vector<JumpMap> result( 32 );
+         for ( size_t bit = 0; bit < 128; bit++ )
+         {
+            State_t state = { 0, 0, 0, 0 };
+            state[bit / 32] = 1u << ( bit % 32 );
+            Xoshiro128 rnd( state );
+            rnd.LongJump();
+            result[0].images[bit] = rnd.GetState();
+         }
+         for ( size_t jump = 1; jump < result.size(); jump++ )
+         {
+            for ( size_t bit = 0; bit < 128; bit++ ) result[jump].images[bit] = result[jump - 1].Apply( result[jump - 1].images[bit] );
+         }
+         return result;
+      }();
+      return jumps;
+   }
+
+   void Advance( const State_t& polynomial )
+   {
+      State_t s = { 0, 0, 0, 0 };
+      for ( auto word : polynomial )
+      {
+         for ( int bit = 0; bit < 32; bit++ )
+         {
+            if ( word & ( 1u << bit ) )
+            {
+               for ( size_t idx = 0; idx < 4; idx++ ) s[idx] ^= _s[idx];
+            }
+            ( *this )();
+         }
+      }
+      _s = s;
+   }
+
+   State_t _s;
+};
 
-      t = x;
-      x = y;
-      y = z;
-      z = t ^ x ^ y;
+//! \brief Uniform float in [0, 1) from the upper 23 bits of a random number, which become the mantissa of a float
+//!        in [1, 2)
+inline float ToUnitFloat( uint32_t random )
+{
+   const uint32_t bits = 0x3F800000u | ( random >> 9 );
+   float value;
+   std::memcpy( &value, &bits, sizeof( value ) );
+   return value - 1.f;
+}
+
+//! \brief Uniform float in [-1, 1), the same trick with floats in [2, 4)
+inline float ToMinusOneOne( uint32_t random )
+{
+   const uint32_t bits = 0x40000000u | ( random >> 9 );
+   float value;
+   std::memcpy( &value, &bits, sizeof( value ) );
+   return value - 3.f;
+}
 
-      return z;
+//! \brief Xoshiro128 substreams in structure of arrays layout, lane l is substream l + 1 of the stream (substream 0
+//!        is left for scalar use). Filling a buffer advances the lanes in SSE2 registers of 4, the lanes of a
+//!        row come from the same step
+template<size_t Lanes>
+class Xoshiro128Lanes
+{
+public:
+   Xoshiro128Lanes( uint64_t seed, uint32_t stream )
+   {
+      for ( size_t lane = 0; lane < Lanes; lane++ )
+      {
+         const auto state = Xoshiro128( seed, stream, static_cast<uint32_t>( lane + 1 ) ).GetState();
+         for ( size_t word = 0; word < 4; word++ ) _s[word][lane] = state[word];
+      }
    }
 
-   auto min() const { return 0; }
-   auto max() const { return static_cast<uint32_t>( -1 ); }
+   //! \brief Fills the given buffer with random numbers. The count has to be a multiple of Lanes
+   void Fill( uint32_t* out, size_t count )
+   {
+#ifdef FLAME_SIMD_SSE2
+      //Compilers keep the lanes in scalar registers, so groups of 4 lanes advance in SSE2 registers. Each group
+      //writes its columns of the buffer
+      static_assert( Lanes % 4 == 0, "The lanes are advanced in groups of 4" );
+      for ( size_t group = 0; group < Lanes; group += 4 )
+      {
+         auto s0 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( &_s[0][group] ) );
+         auto s1 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( &_s[1][group] ) );
+         auto s2 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( &_s[2][group] ) );
+         auto s3 = _mm_loadu_si128( reinterpret_cast<const __m128i*>( &_s[3][group] ) );
+         for ( size_t idx = group; idx < count; idx += Lanes )
+         {
+            const auto sum = _mm_add_epi32( s0, s3 );
+            const auto result = _mm_add_epi32( _mm_or_si128( _mm_slli_epi32( sum, 7 ), _mm_srli_epi32( sum, 25 ) ), s0 );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>( out + idx ), result );
+
+            const auto t = _mm_slli_epi32( s1, 9 );
+            s2 = _mm_xor_si128( s2, s0 );
+            s3 = _mm_xor_si128( s3, s1 );
+            s1 = _mm_xor_si128( s1, s2 );
+            s0 = _mm_xor_si128( s0, s3 );
+            s2 = _mm_xor_si128( s2, t );
+            s3 = _mm_or_si128( _mm_slli_epi32( s3, 11 ), _mm_srli_epi32( s3, 21 ) );
+         }
+         _mm_storeu_si128( reinterpret_cast<__m128i*>( &_s[0][group] ), s0 );
+         _mm_storeu_si128( reinterpret_cast<__m128i*>( &_s[1][group] ), s1 );
+         _mm_storeu_si128( reinterpret_cast<__m128i*>( &_s[2][group] ), s2 );
+         _mm_storeu_si128( reinterpret_cast<__m128i*>( &_s[3][group] ), s3 );
+      }
+#else
+      for ( size_t idx = 0; idx < count; idx += Lanes )
+      {
+         for ( size_t lane = 0; lane < Lanes; lane++ )
+         {
+            const auto s0 = _s[0][lane], s1 = _s[1][lane], s2 = _s[2][lane] ^ s0, s3 = _s[3][lane] ^ s1;
+            out[idx + lane] = Xoshiro128::Rotl( s0 + _s[3][lane], 7 ) + s0;
+            _s[0][lane] = s0 ^ s3;
+            _s[1][lane] = s1 ^ s2;
+            _s[2][lane] = s2 ^ ( s1 << 9 );
+            _s[3][lane] = Xoshiro128::Rotl( s3, 11 );
+         }
+      }
+#endif
+   }
 private:
-   uint32_t x, y, z;
-};
\ No newline at end of file
+   uint32_t _s[4][Lanes];
+};
@@ -0,0 +1,58 @@
+#include "OutOfCoreHistogram.h"
+#include "ImageWriter.h"
+#include "Parallel.h"
+
+namespace flame
+{
+   namespace
+   {
+      //! \brief How many hits ahead AddHits prefetches the histogram entries, like FlameCalculator does
+      constexpr size_t PrefetchDistance = 8;
+   }
+
+   OutOfCoreHistogram::OutOfCoreHistogram( const std::string& path ) :
+      _histogram( MapHistogramFile( path, _info, true ) ),
+      _regionMutexes( ( _histogram.GetLayout().GetStorageSize() >> HitBinner::RegionShift ) + 1 )
+   {
+   }
+
+   void OutOfCoreHistogram::AddHits( size_t regionStart, const BinnedHit* hits, size_t count )
+   {
+      std::lock_guard<std::mutex> guard( _regionMutexes[regionStart >> HitBinner::RegionShift] );
+      for ( size_t hit = 0; hit < count; hit++ )
+      {
+         if ( hit + PrefetchDistance < count ) _histogram.Prefetch( regionStart + hits[hit + PrefetchDistance].offset );
+         _histogram.AddAt( regionStart + hits[hit].offset, hits[hit].color );
+      }
+   }
+
+   void ResolveHistogramFile( const std::string& histogramPath, const std::string& imagePath, PixelType type, size_t threadBudget )
+   {
+      CheckImageType( imagePath, type );
+      HistogramFileInfo info;
+      auto histogram = MapHistogramFile( histogramPath, info );
+      const auto width = info.width / info.superSampling;
+      const auto height = info.height / info.superSampling;
+      const auto format = GetImageFormat( imagePath, type );
+      if ( !IsPpmPath( imagePath ) || type == PixelType::Float )
+      {
+         ImageBuffer image( width, height, format );
+         histogram.Resolve( image.GetView(), info.superSampling, threadBudget );
+         WriteImage( imagePath, image.GetView() );
+         return;
+      }
+
+      //Every band is normalized like the whole image
+      const auto maxCount = histogram.MaxCount( threadBudget );
+      PpmWriter writer( imagePath, width, height, format );
+      ImageBuffer band( width, std::min( ResolveBandRows, height ), format );
+      for ( size_t row = 0; row < height; row += ResolveBandRows )
+      {
+         auto view = band.GetView();
+         view.height = std::min( ResolveBandRows, height - row );
+         histogram.ResolveRows( view, info.superSampling, row, maxCount, threadBudget );
+         writer.WriteRows( view );
+      }
+      writer.Close();
+   }
+}
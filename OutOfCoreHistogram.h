@@ -0,0 +1,55 @@
+#pragma once
+#include "HistogramFile.h"
+#include "HitBinner.h"
+#include "ImageView.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace flame
+{
+
+   //! \brief Histogram that lives in a histogram file instead of memory, for renders that are larger than the RAM.
+   //!        The planes are mapped writable, the OS keeps the pages that are in use resident and writes cold ones
+   //!        back to the file. FlameCalculators don't have buffers of their own, they collect their hits per region
+   //!        of the storage (see HitBinner) and add every full bin at once, so a batch touches a few pages instead
+   //!        of every hit faulting somewhere in a file of many gigabytes. The calculators lock the region while they
+   //!        add, so one histogram serves all of them
+   class OutOfCoreHistogram
+   {
+   public:
+      //! \brief Maps an existing histogram file, see CreateHistogramFile. Throws a HistogramFileError if the file
+      //!        can't be mapped
+      explicit OutOfCoreHistogram( const std::string& path );
+
+      OutOfCoreHistogram( const OutOfCoreHistogram& ) = delete;
+      OutOfCoreHistogram& operator=( const OutOfCoreHistogram& ) = delete;
+
+      //! \brief Adds hits that all belong to the region of a HitBinner that starts at regionStart. Can be called
+      //!        concurrently
+      void AddHits( size_t regionStart, const BinnedHit* hits, size_t count );
+
+      //! \brief The mapped planes, e.g. to estimate the noise or to resolve. Nobody may add hits meanwhile
+      FlameHistogram_t& GetHistogram() { return _histogram; }
+      //! \brief The header of the file when it was mapped
+      const HistogramFileInfo& GetInfo() const { return _info; }
+
+      auto GetWidth() const { return _histogram.GetWidth(); }
+      auto GetHeight() const { return _histogram.GetHeight(); }
+
+   private:
+      HistogramFileInfo _info;
+      FlameHistogram_t _histogram;
+      //! \brief One per region of the HitBinner
+      std::vector<std::mutex> _regionMutexes;
+   };
+
+   //! \brief Resolves a histogram file into an image file. PPM images are resolved in bands of ResolveBandRows
+   //!        rows straight into the file, so neither the histogram nor the image have to fit into memory. Other
+   //!        formats go through OpenCV, which needs the whole image. Throws a std::runtime_error if the image file
+   //!        can't have the given type, see CheckImageType
+   void ResolveHistogramFile( const std::string& histogramPath, const std::string& imagePath, PixelType type = PixelType::UInt8,
+                              size_t threadBudget = 1 );
+   constexpr size_t ResolveBandRows = 256;
+
+}
@@ -0,0 +1,176 @@
+#include "Parallel.h"
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace flame
+{
+   namespace
+   {
+      //! \brief Restricts the thread to one hardware thread, where the platform supports it
+      void PinThread( std::thread& thread, size_t hardwareThread )
+      {
+#if defined(_WIN32)
+         if ( hardwareThread < sizeof( DWORD_PTR ) * 8 )
+         {
+            SetThreadAffinityMask( thread.native_handle(), DWORD_PTR( 1 ) << hardwareThread );
+         }
+#elif defined(__linux__)
+         cpu_set_t cpus;
+         CPU_ZERO( &cpus );
+         CPU_SET( hardwareThread, &cpus );
+         pthread_setaffinity_np( thread.native_handle(), sizeof( cpus ), &cpus );
+#else
+         (void)thread;
+         (void)hardwareThread;
+#endif
+      }
+
+      //! \brief Shared by the caller and the helpers of a ParallelFor. Helpers that start after all indices are
+      //!        handed out never touch the body, so the caller does not have to wait for them
+      struct ParallelForState
+      {
+         std::atomic<size_t> next;
+         //! \brief Participants that might still call the body
+         std::atomic<size_t> running;
+         size_t count;
+         const std::function<void( size_t )>* body;
+
+         void Work()
+         {
+            running++;
+            for ( auto idx = next++; idx < count; idx = next++ ) ( *body )( idx );
+            running--;
+         }
+      };
+   }
+
+   thread_local TaskScheduler* TaskScheduler::_current = nullptr;
+   thread_local TaskScheduler* TaskScheduler::_workerOf = nullptr;
+   thread_local size_t TaskScheduler::_workerIndex = 0;
+
+   TaskScheduler::TaskScheduler( const SchedulerSettings& settings ) :
+      _nextQueue( 0 ),
+      _pendingTasks( 0 ),
+      _isStopping( false )
+   {
+      const auto threads = settings.threads ? settings.threads : HardwareThreads();
+      _workers.reserve( threads );
+      for ( size_t idx = 0; idx < threads; idx++ ) _workers.push_back( std::make_unique<Worker>() );
+
+      _threads.reserve( threads );
+      for ( size_t idx = 0; idx < threads; idx++ )
+      {
+         _threads.emplace_back( [this, idx]() { Work( idx ); } );
+         if ( settings.pinThreads ) PinThread( _threads.back(), idx % HardwareThreads() );
+      }
+   }
+
+   TaskScheduler::~TaskScheduler()
+   {
+      {
+         std::lock_guard<std::mutex> guard( _wakeMutex );
+         _isStopping = true;
+      }
+      _wakeUp.notify_all();
+      for ( auto& thread : _threads ) thread.join();
+   }
+
+   void TaskScheduler::Submit( Task task, TaskPriority priority )
+   {
+      const auto queue = _workerOf == this ? _workerIndex : _nextQueue++ % _workers.size();
+      {
+         auto& worker = *_workers[queue];
+         std::lock_guard<std::mutex> guard( worker.mutex );
+         worker.queues[static_cast<size_t>( priority )].push_back( std::move( task ) );
+      }
+      {
+         std::lock_guard<std::mutex> guard( _wakeMutex );
+         _pendingTasks++;
+      }
+      _wakeUp.notify_one();
+   }
+
+   void TaskScheduler::ParallelFor( size_t count, size_t threadBudget, const std::function<void( size_t )>& body,
+                                    TaskPriority priority )
+   {
+      auto state = std::make_shared<ParallelForState>();
+      state->next = 0;
+      state->running = 0;
+      state->count = count;
+      state->body = &body;
+
+      const auto helpers = std::min( std::min( threadBudget, count ), _workers.size() + 1 ) - 1;
+      for ( size_t idx = 0; idx < helpers; idx++ ) Submit( [state]() { state->Work(); }, priority );
+
+      auto previous = _current;
+      _current = this;
+      state->Work();
+      _current = previous;
+
+      //Only the helpers that took an index are waited for, they are busy with it and don't need the caller's thread
+      while ( state->running.load() ) std::this_thread::yield();
+   }
+
+   void TaskScheduler::Work( size_t index )
+   {
+      _current = this;
+      _workerOf = this;
+      _workerIndex = index;
+
+      Task task;
+      while ( !_isStopping )
+      {
+         if ( TakeTask( index, task ) )
+         {
+            task();
+            task = nullptr;
+            continue;
+         }
+
+         std::unique_lock<std::mutex> lock( _wakeMutex );
+         _wakeUp.wait( lock, [this]() { return _pendingTasks.load() > 0 || _isStopping; } );
+      }
+   }
+
+   bool TaskScheduler::TakeTask( size_t index, Task& task )
+   {
+      for ( size_t priority = 0; priority < Priorities; priority++ )
+      {
+         //Own queue from the front, so that resubmitted tasks go to the end of the line
+         {
+            auto& own = *_workers[index];
+            std::lock_guard<std::mutex> guard( own.mutex );
+            auto& queue = own.queues[priority];
+            if ( !queue.empty() )
+            {
+               task = std::move( queue.front() );
+               queue.pop_front();
+               _pendingTasks--;
+               return true;
+            }
+         }
+
+         //Steal from the back of the others, starting with the next worker so that the victims are spread out
+         for ( size_t offset = 1; offset < _workers.size(); offset++ )
+         {
+            auto& victim = *_workers[( index + offset ) % _workers.size()];
+            std::lock_guard<std::mutex> guard( victim.mutex );
+            auto& queue = victim.queues[priority];
+            if ( !queue.empty() )
+            {
+               task = std::move( queue.back() );
+               queue.pop_back();
+               _pendingTasks--;
+               return true;
+            }
+         }
+      }
+      return false;
+   }
+}
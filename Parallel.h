@@ -0,0 +1,145 @@
+#pragma once
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <algorithm>
+
+namespace flame
+{
+   //! \brief Number of hardware threads, at least 1
+   inline size_t HardwareThreads()
+   {
+      return std::max( 1u, std::thread::hardware_concurrency() );
+   }
+
+   //! \brief Order in which the workers of a TaskScheduler pick tasks, higher priorities first
+   enum class TaskPriority
+   {
+      //! \brief Work that somebody waits for, like merging and resolving a frame
+      High,
+      //! \brief Interactive renders
+      Normal,
+      //! \brief Background renders, only get the workers that nothing else needs
+      Low
+   };
+
+   //! \brief Settings of a TaskScheduler
+   struct SchedulerSettings
+   {
+      //! \brief Number of workers, 0 for one per hardware thread
+      size_t threads = 0;
+      //! \brief Pins worker i to hardware thread i (modulo the hardware threads), which keeps the histograms of
+      //!        a worker in the caches of its core. Only useful if the process has the machine to itself
+      bool pinThreads = false;
+   };
+
+   //! \brief Fixed pool of workers that run tasks from work-stealing queues. Every worker has a queue per priority.
+   //!        Tasks submitted by a worker go to its own queue, other tasks are distributed round-robin. Workers
+   //!        take their own tasks in submission order, so tasks that resubmit themselves (like the chunks of a
+   //!        FlameCalculator) take turns. Idle workers steal from the other end of the other queues.
+   //!        Any number of renders can share a scheduler, their priorities decide who gets the workers
+   class TaskScheduler
+   {
+   public:
+      using Task = std::function<void()>;
+
+      explicit TaskScheduler( const SchedulerSettings& settings = SchedulerSettings() );
+      //! \brief Joins the workers after they finished the task they are running. Tasks that are still queued are
+      //!        dropped, so the owners of tasks have to wait for them before the scheduler goes away
+      ~TaskScheduler();
+
+      TaskScheduler( const TaskScheduler& ) = delete;
+      TaskScheduler& operator=( const TaskScheduler& ) = delete;
+
+      size_t GetThreadCount() const { return _workers.size(); }
+
+      //! \brief Queues a task, which must not throw
+      void Submit( Task task, TaskPriority priority = TaskPriority::Normal );
+
+      //! \brief Runs the body on the calling thread, with ParallelFor calls inside of it using the workers of this
+      //!        scheduler as helpers instead of new threads
+      template<typename Body>
+      void Run( Body&& body )
+      {
+         auto previous = _current;
+         _current = this;
+         body();
+         _current = previous;
+      }
+
+      //! \brief Calls body(idx) for every idx in [0, count) on the calling thread and up to threadBudget - 1
+      //!        workers, whose helper tasks have the given priority. Indices are handed out one at a time
+      void ParallelFor( size_t count, size_t threadBudget, const std::function<void( size_t )>& body,
+                        TaskPriority priority = TaskPriority::High );
+
+      //! \brief Scheduler of the calling thread: the one of a worker, or the one whose Run the thread is in
+      static TaskScheduler* GetCurrent() { return _current; }
+   private:
+      static constexpr size_t Priorities = 3;
+
+      //! \brief Queues of one worker
+      struct Worker
+      {
+         std::mutex mutex;
+         std::deque<Task> queues[Priorities];
+      };
+
+      void Work( size_t index );
+      //! \brief Takes the next task from the worker's own queues, or steals one. Returns false if all are empty
+      bool TakeTask( size_t index, Task& task );
+
+      std::vector<std::unique_ptr<Worker>> _workers;
+      std::vector<std::thread> _threads;
+      //! \brief Queue for the next task that is not submitted by a worker
+      std::atomic<size_t> _nextQueue;
+
+      //! \brief Number of queued tasks, only raised under the mutex, so that no worker misses a wake up
+      std::atomic<size_t> _pendingTasks;
+      std::mutex _wakeMutex;
+      std::condition_variable _wakeUp;
+      std::atomic_bool _isStopping;
+
+      static thread_local TaskScheduler* _current;
+      //! \brief Scheduler that the calling thread is a worker of, and its index there
+      static thread_local TaskScheduler* _workerOf;
+      static thread_local size_t _workerIndex;
+   };
+
+   //! \brief Calls body(idx) for every idx in [0, count), using up to threadBudget threads including the calling
+   //!        one. The indices are handed out one at a time, so items of uneven cost balance out. Inside a task or a
+   //!        Run of a TaskScheduler the helpers are its workers, otherwise threads that are started for the call.
+   //!        The body must not throw
+   template<typename Body>
+   void ParallelFor( size_t count, size_t threadBudget, Body&& body )
+   {
+      const auto threads = std::min( std::max<size_t>( threadBudget, 1 ), count );
+      if ( threads <= 1 )
+      {
+         for ( size_t idx = 0; idx < count; idx++ ) body( idx );
+         return;
+      }
+
+      if ( auto scheduler = TaskScheduler::GetCurrent() )
+      {
+         scheduler->ParallelFor( count, threads, body );
+         return;
+      }
+
+      std::atomic<size_t> next( 0 );
+      auto work = [&]()
+      {
+         for ( auto idx = next++; idx < count; idx = next++ ) body( idx );
+      };
+
+      std::vector<std::thread> helpers;
+      helpers.reserve( threads - 1 );
+      for ( size_t t = 1; t < threads; t++ ) helpers.emplace_back( work );
+      work();
+      for ( auto& helper : helpers ) helper.join();
+   }
+}
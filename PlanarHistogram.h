@@ -0,0 +1,602 @@
+#pragma once
+#include "Histogram.h"
+#include "SimdVec.h"
+#include "PlaneBuffer.h"
+#include "ImageView.h"
+#include <array>
+
+namespace flame
+{
+
+   //! \brief Row-major order of the histogram entries
+   class LinearLayout
+   {
+   public:
+      LinearLayout( size_t width, size_t height ) :
+         _width( width ),
+         _height( height )
+      {
+      }
+
+      size_t GetStorageSize() const { return _width * _height; }
+      size_t GetIndex( size_t x, size_t y ) const { return y * _width + x; }
+
+      //! \brief Calls func( begin, end ) for contiguous ranges of storage indices that together cover the rectangle
+      template<typename Func>
+      void ForEachSpan( const TileRect& rect, Func&& func ) const
+      {
+         if ( rect.x0 == 0 && rect.x1 == _width )
+         {
+            func( rect.y0 * _width, rect.y1 * _width );
+            return;
+         }
+         for ( auto y = rect.y0; y < rect.y1; y++ ) func( y * _width + rect.x0, y * _width + rect.x1 );
+      }
+
+   private:
+      size_t _width, _height;
+   };
+
+   //! \brief Stores the entries in blocks of BlockEdge x BlockEdge, the blocks in row-major order. The chaos game
+   //!        hits points that are close in 2D one after the other, which touch fewer cache lines this way than
+   //!        within rows. Blocks at the right and bottom border are padded
+   class TiledLayout
+   {
+   public:
+      static constexpr size_t BlockEdge = 8;
+      static constexpr size_t BlockArea = BlockEdge * BlockEdge;
+
+      TiledLayout( size_t width, size_t height ) :
+         _width( width ),
+         _height( height ),
+         _blocksX( ( width + BlockEdge - 1 ) / BlockEdge ),
+         _blocksY( ( height + BlockEdge - 1 ) / BlockEdge )
+      {
+      }
+
+      size_t GetStorageSize() const { return _blocksX * _blocksY * BlockArea; }
+      size_t GetIndex( size_t x, size_t y ) const
+      {
+         return ( ( y / BlockEdge ) * _blocksX + x / BlockEdge ) * BlockArea + ( y % BlockEdge ) * BlockEdge + x % BlockEdge;
+      }
+
+      //! \brief Calls func( begin, end ) for contiguous ranges of storage indices that together cover the rectangle.
+      //!        Rows of a block that the rectangle covers completely are passed as one range
+      template<typename Func>
+      void ForEachSpan( const TileRect& rect, Func&& func ) const
+      {
+         //Rectangles that end at the border include the padding, so that border blocks are covered completely too
+         const auto x1 = rect.x1 == _width ? _blocksX * BlockEdge : rect.x1;
+         const auto y1 = rect.y1 == _height ? _blocksY * BlockEdge : rect.y1;
+         for ( auto by = rect.y0 / BlockEdge; by * BlockEdge < y1; by++ )
+         {
+            const auto rowBegin = std::max( rect.y0, by * BlockEdge ) - by * BlockEdge;
+            const auto rowEnd = std::min( y1, ( by + 1 ) * BlockEdge ) - by * BlockEdge;
+            for ( auto bx = rect.x0 / BlockEdge; bx * BlockEdge < x1; bx++ )
+            {
+               const auto base = ( by * _blocksX + bx ) * BlockArea;
+               const auto colBegin = std::max( rect.x0, bx * BlockEdge ) - bx * BlockEdge;
+               const auto colEnd = std::min( x1, ( bx + 1 ) * BlockEdge ) - bx * BlockEdge;
+               if ( colBegin == 0 && colEnd == BlockEdge )
+               {
+                  func( base + rowBegin * BlockEdge, base + rowEnd * BlockEdge );
+                  continue;
+               }
+               for ( auto row = rowBegin; row < rowEnd; row++ ) func( base + row * BlockEdge + colBegin, base + row * BlockEdge + colEnd );
+            }
+         }
+      }
+
+   private:
+      size_t _width, _height;
+      size_t _blocksX, _blocksY;
+   };
+
+   //! \brief Histogram in structure of arrays layout: one plane of hit counts and one plane of color sums per
+   //!        channel. A hit only adds to the planes, so adding two histograms gives the same result as plotting
+   //!        all hits into one. The color sums are integers of 64 bits, which stay exact as long as the 32 bit
+   //!        counts do. The layout decides how pixels map to storage indices, see LinearLayout and TiledLayout.
+   //!        The storage is split into blocks of BlockEntries consecutive entries, one block of the TiledLayout
+   //!        each, and every block has a flag that is set once an entry of the block may have hits. Clearing,
+   //!        copying, adding, resolving and the maximum count skip the blocks without the flag, which are most of
+   //!        them for sparse genomes at high supersampling
+   template<typename _Layout>
+   class PlanarHistogram
+   {
+   public:
+      using Layout_t = _Layout;
+      using ColorSum_t = uint64_t;
+      static constexpr size_t Channels = 3;
+      static constexpr size_t BlockShift = 6;
+      static constexpr size_t BlockEntries = size_t( 1 ) << BlockShift;
+
+      //! \param memory Placement of the planes. They start out untouched, see MemoryPolicy
+      PlanarHistogram( size_t width, size_t height, const MemoryPolicy& memory = MemoryPolicy() ) :
+         _width( width ),
+         _height( height ),
+         _layout( width, height ),
+         _counts( _layout.GetStorageSize(), memory ),
+         _occupied( GetBlockCount( _layout.GetStorageSize() ), 0 )
+      {
+         for ( auto& plane : _colorSums ) plane = PlaneBuffer<ColorSum_t>( _layout.GetStorageSize(), memory );
+      }
+
+      //! \brief Creates a histogram on planes that were allocated elsewhere, e.g. views of a histogram file (see
+      //!        MapHistogramFile). The planes need the storage size of the layout. All blocks count as occupied, see
+      //!        ScanOccupied
+      PlanarHistogram( size_t width, size_t height, PlaneBuffer<uint32_t> counts, std::array<PlaneBuffer<ColorSum_t>, Channels> colorSums ) :
+         _width( width ),
+         _height( height ),
+         _layout( width, height ),
+         _counts( std::move( counts ) ),
+         _colorSums( std::move( colorSums ) ),
+         _occupied( GetBlockCount( _layout.GetStorageSize() ), 1 )
+      {
+         const auto size = _layout.GetStorageSize();
+         if ( _counts.size() != size || std::any_of( _colorSums.begin(), _colorSums.end(), [size]( const PlaneBuffer<ColorSum_t>& plane ) { return plane.size() != size; } ) )
+         {
+            throw std::runtime_error( "Planes don't match the layout!" );
+         }
+      }
+
+      PlanarHistogram( const PlanarHistogram& ) = default;
+      PlanarHistogram( PlanarHistogram&& ) = default;
+
+      //! \brief Adds a hit with the given color at the given coordinates
+      void Add( size_t x, size_t y, const Color3_8& color )
+      {
+#ifdef _DEBUG
+         if ( x >= _width || y >= _height ) throw std::runtime_error( "Index out of bounds!" );
+#endif
+         AddAt( _layout.GetIndex( x, y ), color );
+      }
+
+      //! \brief Adds a hit with the given color at the given storage index (see GetLayout)
+      void AddAt( size_t idx, const Color3_8& color )
+      {
+         _occupied[idx >> BlockShift] = 1;
+         _counts[idx]++;
+         _colorSums[0][idx] += color.r;
+         _colorSums[1][idx] += color.g;
+         _colorSums[2][idx] += color.b;
+      }
+
+      //! \brief Prefetches the cache lines of the entry at the given storage index in all planes
+      void Prefetch( size_t idx ) const
+      {
+         simd::Prefetch( _counts.data() + idx );
+         for ( const auto& plane : _colorSums ) simd::Prefetch( plane.data() + idx );
+      }
+
+      uint32_t GetCount( size_t x, size_t y ) const { return _counts[_layout.GetIndex( x, y )]; }
+
+      //! \brief Average color of all hits at the given coordinates, black if there were none
+      Color3_8 GetColor( size_t x, size_t y ) const
+      {
+         const auto idx = _layout.GetIndex( x, y );
+         const auto count = _counts[idx];
+         if ( !count ) return{};
+         return{
+            static_cast<uint8_t>( _colorSums[0][idx] / count ),
+            static_cast<uint8_t>( _colorSums[1][idx] / count ),
+            static_cast<uint8_t>( _colorSums[2][idx] / count )
+         };
+      }
+
+      //! \brief Raw access to the planes, indexed by storage index (see GetLayout). Whoever adds hits through them
+      //!        has to mark the blocks, see MarkOccupied and ScanOccupied
+      uint32_t* GetCounts() { return _counts.data(); }
+      const uint32_t* GetCounts() const { return _counts.data(); }
+      ColorSum_t* GetColorSums( size_t channel ) { return _colorSums[channel].data(); }
+      const ColorSum_t* GetColorSums( size_t channel ) const { return _colorSums[channel].data(); }
+
+      const _Layout& GetLayout() const { return _layout; }
+
+      //! \brief How the count plane was allocated, the color planes follow the same policy
+      const PlaneAllocation& GetAllocation() const { return _counts.GetAllocation(); }
+
+      void Clear()
+      {
+         std::fill( _counts.begin(), _counts.end(), 0 );
+         for ( auto& plane : _colorSums ) std::fill( plane.begin(), plane.end(), 0 );
+         std::fill( _occupied.begin(), _occupied.end(), 0 );
+         _resolvedMaxCount = 0;
+      }
+
+      //! \brief Clears all entries within the given rectangle. Blocks that the rectangle covers completely are empty
+      //!        afterwards, the others stay occupied
+      void Clear( const TileRect& rect )
+      {
+         ForEachOccupiedSpan( rect, [this]( size_t begin, size_t end )
+         {
+            std::fill( _counts.begin() + begin, _counts.begin() + end, 0 );
+            for ( auto& plane : _colorSums ) std::fill( plane.begin() + begin, plane.begin() + end, 0 );
+            for ( auto block = ( begin + BlockEntries - 1 ) >> BlockShift; ( block + 1 ) << BlockShift <= end; block++ ) _occupied[block] = 0;
+         } );
+      }
+
+      //! \brief Calls func( begin, end ) for contiguous ranges of storage indices that together cover the occupied
+      //!        blocks within the rectangle. Entries outside of these ranges have no hits
+      template<typename Func>
+      void ForEachOccupiedSpan( const TileRect& rect, Func&& func ) const
+      {
+         _layout.ForEachSpan( rect, [&]( size_t begin, size_t end )
+         {
+            //Spans of the TiledLayout lie within one block, rows of the LinearLayout are split where the blocks
+            //change between occupied and empty
+            auto runBegin = end;
+            for ( auto idx = begin; idx < end; idx = std::min( end, ( ( idx >> BlockShift ) + 1 ) << BlockShift ) )
+            {
+               if ( _occupied[idx >> BlockShift] )
+               {
+                  if ( runBegin == end ) runBegin = idx;
+               }
+               else if ( runBegin != end )
+               {
+                  func( runBegin, idx );
+                  runBegin = end;
+               }
+            }
+            if ( runBegin != end ) func( runBegin, end );
+         } );
+      }
+
+      //! \brief Marks the blocks of the storage range [begin, end) as occupied, after hits were added through the
+      //!        raw planes
+      void MarkOccupied( size_t begin, size_t end )
+      {
+         for ( auto block = begin >> BlockShift; block << BlockShift < end; block++ ) _occupied[block] = 1;
+      }
+
+      //! \brief Sets the flags of the blocks that overlap the storage range [begin, end) from their counts, e.g. after
+      //!        the planes were written through the raw planes
+      void ScanOccupied( size_t begin, size_t end )
+      {
+         if ( begin >= end ) return;
+         for ( auto block = begin >> BlockShift; block <= ( end - 1 ) >> BlockShift; block++ )
+         {
+            const auto counts = _counts.data() + ( block << BlockShift );
+            const auto blockEnd = _counts.data() + std::min( ( block + 1 ) << BlockShift, _counts.size() );
+            _occupied[block] = std::any_of( counts, blockEnd, []( uint32_t count ) { return count != 0; } ) ? 1 : 0;
+         }
+      }
+
+      //! \brief Sets the flags of all blocks from their counts, by up to threadBudget threads
+      void ScanOccupied( size_t threadBudget = 1 )
+      {
+         const auto chunkBlocks = ( ParallelTileEdge * ParallelTileEdge ) >> BlockShift;
+         ParallelFor( ( _occupied.size() + chunkBlocks - 1 ) / chunkBlocks, threadBudget, [&]( size_t chunk )
+         {
+            ScanOccupied( chunk * chunkBlocks << BlockShift, std::min( _occupied.size(), ( chunk + 1 ) * chunkBlocks ) << BlockShift );
+         } );
+      }
+
+      //! \brief Number of blocks that are marked as occupied, out of GetStorageSize() / BlockEntries
+      size_t CountOccupiedBlocks() const { return static_cast<size_t>( std::count( _occupied.begin(), _occupied.end(), 1 ) ); }
+
+      //! \brief Scales all entries by the given factor in (0, 1], so that new hits fade in over the old ones instead
+      //!        of starting from an empty histogram. The counts are rounded down, the color sums are scaled by the
+      //!        same ratio as the counts, so every entry keeps its average color up to the rounding of the sums. The
+      //!        next resolve is a complete one
+      void Decay( float factor, size_t threadBudget = 1 )
+      {
+         const TileGrid grid( _width, _height, ParallelTileEdge );
+         ParallelFor( grid.GetTileCount(), threadBudget, [&]( size_t tile )
+         {
+            ForEachOccupiedSpan( grid.GetTileRect( tile ), [&]( size_t begin, size_t end )
+            {
+               for ( auto idx = begin; idx < end; idx++ )
+               {
+                  if ( !_counts[idx] ) continue;
+                  const auto count = static_cast<uint32_t>( _counts[idx] * factor );
+                  const auto ratio = static_cast<double>( count ) / _counts[idx];
+                  _counts[idx] = count;
+                  for ( auto& plane : _colorSums ) plane[idx] = static_cast<ColorSum_t>( plane[idx] * ratio );
+               }
+            } );
+         } );
+         _resolvedMaxCount = 0;
+      }
+
+      //! \brief Copies the content of this histogram to the given other histogram. Blocks that are empty in both are
+      //!        skipped, blocks that are only occupied in the other one are cleared
+      void CopyTo( PlanarHistogram& other ) const
+      {
+         if ( _width != other._width || _height != other._height ) throw std::runtime_error( "Size mismatch!" );
+         //Runs of blocks that are handled the same way: 0 skipped, 1 copied, 2 cleared
+         auto handleRun = [&]( int action, size_t begin, size_t end )
+         {
+            //The last block can be shorter with the LinearLayout
+            const auto offset = begin << BlockShift;
+            const auto count = std::min( end << BlockShift, _counts.size() ) - offset;
+            for ( size_t plane = 0; plane <= Channels; plane++ )
+            {
+               void* dst = plane ? static_cast<void*>( other._colorSums[plane - 1].data() + offset ) : other._counts.data() + offset;
+               const void* src = plane ? static_cast<const void*>( _colorSums[plane - 1].data() + offset ) : _counts.data() + offset;
+               const auto bytes = count * ( plane ? sizeof( ColorSum_t ) : sizeof( uint32_t ) );
+               if ( action == 1 ) std::memcpy( dst, src, bytes );
+               else if ( action == 2 ) std::memset( dst, 0, bytes );
+            }
+         };
+         size_t runBegin = 0;
+         auto runAction = 0;
+         for ( size_t block = 0; block <= _occupied.size(); block++ )
+         {
+            const auto action = block == _occupied.size() ? -1 : _occupied[block] ? 1 : other._occupied[block] ? 2 : 0;
+            if ( action == runAction ) continue;
+            handleRun( runAction, runBegin, block );
+            runBegin = block;
+            runAction = action;
+         }
+         other._occupied = _occupied;
+      }
+
+      //! \brief Resolves the histogram into a range of colors, see Histogram::Resolve. Each entry contributes its
+      //!        average color, scaled by the log density
+      template<typename RndIter>
+      void Resolve( RndIter begin, RndIter end, size_t superSampling = 1, size_t threadBudget = 1 )
+      {
+         CheckRangeSize( begin, end, superSampling );
+         ResolveTiles( ColorStore<RndIter>{ begin, _width / superSampling }, superSampling, threadBudget );
+      }
+
+      //! \brief Resolves the histogram straight into an image of any format, e.g. a display buffer, without a range
+      //!        of colors in between. The image has to have the size of the histogram divided by the superSampling
+      void Resolve( const ImageView& image, size_t superSampling = 1, size_t threadBudget = 1 )
+      {
+         CheckImageSize( image, superSampling );
+         DispatchPixelFormat( image.format, [&]( auto store )
+         {
+            ResolveTiles( ImageStore<decltype( store )>{ image, store, 0 }, superSampling, threadBudget );
+         } );
+      }
+
+      //! \brief Resolves only the tiles that changed, see Histogram::ResolveChanges
+      //! \returns True if everything was resolved again, because the normalization moved
+      template<typename RndIter>
+      bool ResolveChanges( RndIter begin, RndIter end, size_t superSampling, DirtyTiles& changes, size_t threadBudget = 1 )
+      {
+         CheckRangeSize( begin, end, superSampling );
+         return ResolveChangedTiles( ColorStore<RndIter>{ begin, _width / superSampling }, superSampling, changes, threadBudget );
+      }
+
+      //! \brief Resolves only the tiles that changed into an image, see Resolve for images
+      bool ResolveChanges( const ImageView& image, size_t superSampling, DirtyTiles& changes, size_t threadBudget = 1 )
+      {
+         CheckImageSize( image, superSampling );
+         auto isComplete = false;
+         DispatchPixelFormat( image.format, [&]( auto store )
+         {
+            isComplete = ResolveChangedTiles( ImageStore<decltype( store )>{ image, store, 0 }, superSampling, changes, threadBudget );
+         } );
+         return isComplete;
+      }
+
+      //! \brief Resolves the output rows [row, row + band.height) into an image of only these rows, normalized by the
+      //!        given highest count of the histogram (see MaxCount). Resolving a histogram band by band gives the
+      //!        pixels of a complete resolve, without an image of the full size
+      void ResolveRows( const ImageView& band, size_t superSampling, size_t row, uint32_t maxCount, size_t threadBudget = 1 ) const
+      {
+         if ( band.width != _width / superSampling || row + band.height > _height / superSampling ) throw std::runtime_error( "Band has the wrong size!" );
+         const auto logMaxCount = std::log2( static_cast<float>( maxCount ) );
+         const TileGrid grid( _width, band.height * superSampling, DirtyTiles::TileSize * superSampling );
+         DispatchPixelFormat( band.format, [&]( auto store )
+         {
+            const ImageStore<decltype( store )> bandStore{ band, store, row };
+            ParallelFor( grid.GetTileCount(), threadBudget, [&]( size_t tile )
+            {
+               auto rect = grid.GetTileRect( tile );
+               rect.y0 += row * superSampling;
+               rect.y1 += row * superSampling;
+               ResolveRect( bandStore, superSampling, rect, logMaxCount );
+            } );
+         } );
+      }
+
+      //! \brief Returns the highest count of all entries, computed over tiles by up to threadBudget threads
+      uint32_t MaxCount( size_t threadBudget = 1 ) const
+      {
+         const TileGrid grid( _width, _height, ParallelTileEdge );
+         std::vector<uint32_t> tileMax( grid.GetTileCount() );
+         ParallelFor( grid.GetTileCount(), threadBudget, [&]( size_t tile )
+         {
+            uint32_t maxCount = 0;
+            ForEachOccupiedSpan( grid.GetTileRect( tile ), [&]( size_t begin, size_t end )
+            {
+               for ( auto idx = begin; idx < end; idx++ ) maxCount = std::max( maxCount, _counts[idx] );
+            } );
+            tileMax[tile] = maxCount;
+         } );
+         return tileMax.empty() ? 0 : *std::max_element( tileMax.begin(), tileMax.end() );
+      }
+
+      //! \brief Edge length of the tiles that parallel operations split the histogram into, a multiple of the
+      //!        TiledLayout blocks. 64x64 entries of 28 bytes are 112KB, which stays within the L2 cache
+      static constexpr size_t ParallelTileEdge = 64;
+
+      auto GetWidth() const { return _width; }
+      auto GetHeight() const { return _height; }
+
+   private:
+      static size_t GetBlockCount( size_t storageSize ) { return ( storageSize + BlockEntries - 1 ) >> BlockShift; }
+
+      //! \brief Writes resolved pixels into a range of colors
+      template<typename RndIter>
+      struct ColorStore
+      {
+         RndIter begin;
+         size_t outWidth;
+
+         void operator()( size_t x, size_t y, float r, float g, float b ) const
+         {
+            begin[y * outWidth + x] = Color3_8(
+               static_cast<uint8_t>( std::min( r, 255.f ) ),
+               static_cast<uint8_t>( std::min( g, 255.f ) ),
+               static_cast<uint8_t>( std::min( b, 255.f ) )
+            );
+         }
+      };
+
+      //! \brief Writes resolved pixels into an image with the pixel store of its format
+      template<typename PixelStore>
+      struct ImageStore
+      {
+         const ImageView& image;
+         PixelStore store;
+         //! \brief Output row that the first row of the image belongs to
+         size_t row0;
+
+         void operator()( size_t x, size_t y, float r, float g, float b ) const
+         {
+            store( image.data + ( y - row0 ) * image.stride + x * PixelStore::PixelBytes, r, g, b );
+         }
+      };
+
+      void CheckImageSize( const ImageView& image, size_t superSampling ) const
+      {
+         if ( image.width != _width / superSampling || image.height != _height / superSampling ) throw std::runtime_error( "Image has the wrong size!" );
+      }
+
+      template<typename RndIter>
+      void CheckRangeSize( RndIter begin, RndIter end, size_t superSampling ) const
+      {
+         const auto dist = static_cast<size_t>( std::distance( begin, end ) );
+         if ( dist != ( _width / superSampling ) * ( _height / superSampling ) ) throw std::runtime_error( "Range has the wrong size!" );
+      }
+
+      template<typename Store>
+      void ResolveTiles( const Store& store, size_t superSampling, size_t threadBudget )
+      {
+         _resolvedMaxCount = MaxCount( threadBudget );
+         const auto logMaxCount = std::log2( static_cast<float>( _resolvedMaxCount ) );
+
+         const DirtyTiles grid( _width, _height, superSampling );
+         ParallelFor( grid.GetTileCount(), threadBudget, [&]( size_t tile )
+         {
+            ResolveRect( store, superSampling, grid.GetTileRect( tile ), logMaxCount );
+         } );
+      }
+
+      template<typename Store>
+      bool ResolveChangedTiles( const Store& store, size_t superSampling, DirtyTiles& changes, size_t threadBudget )
+      {
+         const auto maxCount = std::max( _resolvedMaxCount, changes.GetMaxCount() );
+         const auto logMaxCount = std::log2( static_cast<float>( maxCount ) );
+         const auto resolvedLogMaxCount = std::log2( static_cast<float>( _resolvedMaxCount ) );
+
+         const auto isComplete = !_resolvedMaxCount || ( logMaxCount - resolvedLogMaxCount ) * 512 > resolvedLogMaxCount;
+         if ( isComplete )
+         {
+            ResolveTiles( store, superSampling, threadBudget );
+         }
+         else
+         {
+            ParallelFor( changes.GetTileCount(), threadBudget, [&]( size_t tile )
+            {
+               if ( changes.IsDirty( tile ) ) ResolveRect( store, superSampling, changes.GetTileRect( tile ), resolvedLogMaxCount );
+            } );
+         }
+         changes.Clear();
+         return isComplete;
+      }
+
+      //! \brief Passes every output pixel of the rectangle to store( x, y, r, g, b ), in output coordinates and with
+      //!        channel values on the scale of 0 to 255
+      template<typename Store>
+      void ResolveRect( const Store& store, size_t superSampling, const TileRect& rect, float logMaxCount ) const
+      {
+         //Dividing the color sums by the count gives the average color, the log density scales it
+         const auto scale = logMaxCount > 0.f ? 1.f / ( logMaxCount * superSampling * superSampling ) : 0.f;
+         for ( auto y = rect.y0; y < rect.y1; y += superSampling )
+         {
+            for ( auto x = rect.x0; x < rect.x1; x += superSampling )
+            {
+               float r = 0.f, g = 0.f, b = 0.f;
+               for ( auto ssy = y; ssy < y + superSampling; ssy++ )
+               {
+                  for ( auto ssx = x; ssx < x + superSampling; ssx++ )
+                  {
+                     const auto idx = _layout.GetIndex( ssx, ssy );
+                     if ( !_occupied[idx >> BlockShift] ) continue;
+                     const auto count = _counts[idx];
+                     if ( !count ) continue;
+                     const auto factor = std::log2( static_cast<float>( count ) ) * scale / count;
+                     r += ToFloat( _colorSums[0][idx] ) * factor;
+                     g += ToFloat( _colorSums[1][idx] ) * factor;
+                     b += ToFloat( _colorSums[2][idx] ) * factor;
+                  }
+               }
+               store( x / superSampling, y / superSampling, r, g, b );
+            }
+         }
+      }
+
+      //! \brief The sums never reach 2^63, and the signed conversion is a single instruction
+      static float ToFloat( ColorSum_t sum ) { return static_cast<float>( static_cast<int64_t>( sum ) ); }
+
+      const size_t _width, _height;
+      const _Layout _layout;
+      PlaneBuffer<uint32_t> _counts;
+      std::array<PlaneBuffer<ColorSum_t>, Channels> _colorSums;
+      //! \brief One flag per block of BlockEntries entries, 0 if none of them has hits
+      std::vector<uint8_t> _occupied;
+      //! \brief Maximum count that the resolved colors were normalized with, 0 if there was no resolve yet
+      uint32_t _resolvedMaxCount = 0;
+   };
+
+   //! \brief Histogram that FlameCalculator plots into and takes snapshots with
+   using FlameHistogram_t = PlanarHistogram<TiledLayout>;
+
+   //! \brief Adds the hits within the given rectangle of one histogram to another histogram of the same size. This is
+   //!        a plain sum of the planes of the blocks that are occupied in the source, without branches
+   //! \returns The highest count of the destination histogram within these blocks after adding. The other entries
+   //!          of the rectangle didn't change
+   template<typename _Layout>
+   uint32_t AddHistogram( PlanarHistogram<_Layout>& dst, const PlanarHistogram<_Layout>& from, const TileRect& rect )
+   {
+      if ( dst.GetWidth() != from.GetWidth() || dst.GetHeight() != from.GetHeight() ) throw std::runtime_error( "Size mismatch!" );
+      uint32_t maxCount = 0;
+      from.ForEachOccupiedSpan( rect, [&]( size_t begin, size_t end )
+      {
+         dst.MarkOccupied( begin, end );
+         auto dstCounts = dst.GetCounts();
+         const auto srcCounts = from.GetCounts();
+         for ( auto idx = begin; idx < end; idx++ )
+         {
+            dstCounts[idx] += srcCounts[idx];
+            maxCount = std::max( maxCount, dstCounts[idx] );
+         }
+         for ( size_t channel = 0; channel < PlanarHistogram<_Layout>::Channels; channel++ )
+         {
+            auto dstSums = dst.GetColorSums( channel );
+            const auto srcSums = from.GetColorSums( channel );
+            for ( auto idx = begin; idx < end; idx++ ) dstSums[idx] += srcSums[idx];
+         }
+      } );
+      return maxCount;
+   }
+
+   //! \brief Adds the hits of one histogram to another histogram of the same size
+   template<typename _Layout>
+   uint32_t AddHistogram( PlanarHistogram<_Layout>& dst, const PlanarHistogram<_Layout>& from )
+   {
+      return AddHistogram( dst, from, { 0, 0, from.GetWidth(), from.GetHeight() } );
+   }
+
+   //! \brief Adds all histograms to the first one, see MergeHistograms for Histogram
+   template<typename _Layout>
+   void MergeHistograms( std::vector<PlanarHistogram<_Layout>>& histograms, size_t threadBudget = 1 )
+   {
+      auto& dst = histograms[0];
+      const TileGrid grid( dst.GetWidth(), dst.GetHeight(), PlanarHistogram<_Layout>::ParallelTileEdge );
+      ParallelFor( grid.GetTileCount(), threadBudget, [&]( size_t tile )
+      {
+         const auto rect = grid.GetTileRect( tile );
+         for ( size_t h = 1; h < histograms.size(); h++ )
+         {
+            AddHistogram( dst, histograms[h], rect );
+         }
+      } );
+   }
+
+}
@@ -0,0 +1,220 @@
+#include "PlaneBuffer.h"
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <atomic>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace flame
+{
+   namespace
+   {
+      size_t RoundUp( size_t value, size_t multiple )
+      {
+         return ( value + multiple - 1 ) / multiple * multiple;
+      }
+
+      //! \brief Memory from the C runtime, for platforms without page level control and when mapping fails
+      PlaneAllocation AllocateFallback( size_t bytes )
+      {
+         PlaneAllocation allocation;
+         allocation.memory = std::calloc( bytes, 1 );
+         if ( !allocation.memory ) throw std::bad_alloc();
+         allocation.bytes = bytes;
+         allocation.mapping = allocation.memory;
+         allocation.mappedBytes = bytes;
+         return allocation;
+      }
+
+      //! \brief Offset of the next large plane into its first page, a page and a cache line apart from the previous
+      //!        one so that both the set index bits above and below 4KB differ
+      size_t NextPlaneOffset( size_t bytes )
+      {
+         static std::atomic<size_t> nextPlane( 0 );
+         return bytes >= HugePageSize ? ( nextPlane++ % 16 ) * ( 4096 + 64 ) : 0;
+      }
+
+#if defined(__linux__)
+      //! \brief Binds the pages to a NUMA node through the system call, which needs no libnuma
+      bool BindToNode( void* memory, size_t bytes, int node )
+      {
+#ifdef SYS_mbind
+         constexpr int MpolBind = 2;
+         constexpr size_t MaxNodes = 1024;
+         constexpr size_t BitsPerWord = sizeof( unsigned long ) * 8;
+         if ( node < 0 || static_cast<size_t>( node ) >= MaxNodes ) return false;
+
+         unsigned long mask[MaxNodes / BitsPerWord] = {};
+         mask[node / BitsPerWord] = 1ul << ( node % BitsPerWord );
+         return syscall( SYS_mbind, memory, bytes, MpolBind, mask, MaxNodes + 1, 0 ) == 0;
+#else
+         (void)memory;
+         (void)bytes;
+         (void)node;
+         return false;
+#endif
+      }
+
+      PlaneAllocation AllocateMapped( size_t bytes, const MemoryPolicy& policy )
+      {
+         PlaneAllocation allocation;
+         const auto isLarge = bytes >= HugePageSize;
+         const auto offset = NextPlaneOffset( bytes );
+
+#ifdef MAP_HUGETLB
+         if ( isLarge && policy.hugePages == HugePages::Explicit )
+         {
+            const auto hugeBytes = RoundUp( bytes + offset, HugePageSize );
+            auto mapping = mmap( nullptr, hugeBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+            if ( mapping != MAP_FAILED )
+            {
+               allocation.mapping = mapping;
+               allocation.mappedBytes = hugeBytes;
+               allocation.isHuge = true;
+            }
+         }
+#endif
+
+         if ( !allocation.mapping )
+         {
+            //Transparent huge pages need 2MB aligned ranges, so large planes are mapped with some slack that is
+            //trimmed again
+            const auto alignment = isLarge && policy.hugePages != HugePages::None ? HugePageSize : 0;
+            const auto mappedBytes = RoundUp( bytes + offset, static_cast<size_t>( sysconf( _SC_PAGESIZE ) ) );
+            auto mapping = mmap( nullptr, mappedBytes + alignment, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+            if ( mapping == MAP_FAILED ) return AllocateFallback( bytes );
+
+            auto begin = reinterpret_cast<uintptr_t>( mapping );
+            if ( alignment )
+            {
+               const auto aligned = RoundUp( begin, alignment );
+               if ( aligned > begin ) munmap( mapping, aligned - begin );
+               munmap( reinterpret_cast<void*>( aligned + mappedBytes ), begin + alignment - aligned );
+               begin = aligned;
+#ifdef MADV_HUGEPAGE
+               madvise( reinterpret_cast<void*>( begin ), mappedBytes, MADV_HUGEPAGE );
+#endif
+            }
+            allocation.mapping = reinterpret_cast<void*>( begin );
+            allocation.mappedBytes = mappedBytes;
+         }
+
+         allocation.memory = static_cast<char*>( allocation.mapping ) + offset;
+         allocation.bytes = bytes;
+         allocation.isMapped = true;
+         if ( policy.numaNode >= 0 ) allocation.isBound = BindToNode( allocation.mapping, allocation.mappedBytes, policy.numaNode );
+         return allocation;
+      }
+#elif defined(_WIN32)
+      PlaneAllocation AllocateMapped( size_t bytes, const MemoryPolicy& policy )
+      {
+         PlaneAllocation allocation;
+         const auto offset = NextPlaneOffset( bytes );
+         const auto process = GetCurrentProcess();
+         auto allocate = [&]( size_t size, DWORD type ) -> void*
+         {
+            if ( policy.numaNode >= 0 )
+            {
+               return VirtualAllocExNuma( process, nullptr, size, type, PAGE_READWRITE, static_cast<DWORD>( policy.numaNode ) );
+            }
+            return VirtualAlloc( nullptr, size, type, PAGE_READWRITE );
+         };
+
+         const auto largePageSize = GetLargePageMinimum();
+         if ( bytes >= HugePageSize && policy.hugePages == HugePages::Explicit && largePageSize )
+         {
+            const auto largeBytes = RoundUp( bytes + offset, largePageSize );
+            allocation.mapping = allocate( largeBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES );
+            allocation.mappedBytes = largeBytes;
+            allocation.isHuge = allocation.mapping != nullptr;
+         }
+         if ( !allocation.mapping )
+         {
+            allocation.mapping = allocate( bytes + offset, MEM_RESERVE | MEM_COMMIT );
+            allocation.mappedBytes = bytes + offset;
+         }
+         if ( !allocation.mapping ) return AllocateFallback( bytes );
+
+         allocation.memory = static_cast<char*>( allocation.mapping ) + offset;
+         allocation.bytes = bytes;
+         allocation.isMapped = true;
+         allocation.isBound = policy.numaNode >= 0;
+         return allocation;
+      }
+#else
+      PlaneAllocation AllocateMapped( size_t bytes, const MemoryPolicy& )
+      {
+         return AllocateFallback( bytes );
+      }
+#endif
+   }
+
+   PlaneAllocation AllocatePlane( size_t bytes, const MemoryPolicy& policy )
+   {
+      if ( !bytes ) return{};
+      return AllocateMapped( bytes, policy );
+   }
+
+   PlaneAllocation MapFilePlane( const std::string& path, uint64_t offset, size_t bytes, bool isWritable )
+   {
+      if ( offset % FileViewAlignment ) throw std::runtime_error( "File views have to start at a multiple of FileViewAlignment!" );
+      PlaneAllocation allocation;
+      if ( !bytes ) return allocation;
+#if defined(__linux__)
+      const auto file = open( path.c_str(), isWritable ? O_RDWR : O_RDONLY );
+      if ( file < 0 ) throw std::runtime_error( "Can't open " + path + " for mapping" );
+      //The view keeps the file open on its own
+      auto mapping = mmap( nullptr, bytes, isWritable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, static_cast<off_t>( offset ) );
+      close( file );
+      if ( mapping == MAP_FAILED ) throw std::runtime_error( "Can't map " + path );
+#elif defined(_WIN32)
+      const auto file = CreateFileA( path.c_str(), isWritable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                     OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+      if ( file == INVALID_HANDLE_VALUE ) throw std::runtime_error( "Can't open " + path + " for mapping" );
+      const auto fileMapping = CreateFileMappingA( file, nullptr, isWritable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr );
+      CloseHandle( file );
+      if ( !fileMapping ) throw std::runtime_error( "Can't map " + path );
+      //The view keeps the file mapping alive on its own
+      auto mapping = MapViewOfFile( fileMapping, isWritable ? FILE_MAP_WRITE : FILE_MAP_READ, static_cast<DWORD>( offset >> 32 ),
+                                    static_cast<DWORD>( offset ), bytes );
+      CloseHandle( fileMapping );
+      if ( !mapping ) throw std::runtime_error( "Can't map " + path );
+#else
+      void* mapping = nullptr;
+      throw std::runtime_error( "Can't map " + path + ", file views are not supported on this platform" );
+#endif
+      allocation.memory = mapping;
+      allocation.bytes = bytes;
+      allocation.mapping = mapping;
+      allocation.mappedBytes = bytes;
+      allocation.isMapped = true;
+      allocation.isFileView = true;
+      return allocation;
+   }
+
+   void FreePlane( const PlaneAllocation& allocation )
+   {
+      if ( !allocation.mapping ) return;
+      if ( !allocation.isMapped )
+      {
+         std::free( allocation.mapping );
+         return;
+      }
+#if defined(__linux__)
+      munmap( allocation.mapping, allocation.mappedBytes );
+#elif defined(_WIN32)
+      if ( allocation.isFileView ) UnmapViewOfFile( allocation.mapping );
+      else VirtualFree( allocation.mapping, 0, MEM_RELEASE );
+#endif
+   }
+}
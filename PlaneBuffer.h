@@ -0,0 +1,141 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <string>
+
+namespace flame
+{
+   //! \brief Page size that the histogram planes are allocated with
+   enum class HugePages
+   {
+      //! \brief Regular pages only
+      None,
+      //! \brief Regular pages that the kernel may back with transparent huge pages (madvise on Linux, a no-op on
+      //!        Windows)
+      Transparent,
+      //! \brief Reserved huge pages (hugetlbfs on Linux, large pages on Windows, which need the "Lock pages in memory"
+      //!        privilege). Falls back to Transparent if none are available
+      Explicit
+   };
+
+   //! \brief Where and how the planes of a histogram are allocated. The planes are always zero pages from the OS
+   //!        that nobody touched yet, so without a node their memory ends up on the NUMA node of the thread that
+   //!        writes to them first: for the buffers of a FlameCalculator that is the worker that iterates it
+   struct MemoryPolicy
+   {
+      //! \brief Binds the planes to this NUMA node, -1 leaves the placement to the first touch
+      int numaNode = -1;
+      //! \brief Planes smaller than HugePageSize always use regular pages
+      HugePages hugePages = HugePages::Transparent;
+   };
+
+   //! \brief Outcome of an allocation, the policy is only a request
+   struct PlaneAllocation
+   {
+      void* memory = nullptr;
+      size_t bytes = 0;
+      //! \brief Pages that contain the memory, which is offset into them (see AllocatePlane)
+      void* mapping = nullptr;
+      size_t mappedBytes = 0;
+      //! \brief How the memory has to be released
+      bool isMapped = false;
+      //! \brief A view of a file, see MapFilePlane
+      bool isFileView = false;
+      //! \brief Backed by reserved huge pages (transparent huge pages can't be told apart)
+      bool isHuge = false;
+      //! \brief Bound to the requested NUMA node
+      bool isBound = false;
+   };
+
+   //! \brief Size of the huge pages that HugePages::Explicit asks for
+   constexpr size_t HugePageSize = size_t( 2 ) << 20;
+
+   //! \brief Allocates zeroed memory according to the policy, falls back to what the platform supports. Throws
+   //!        std::bad_alloc if there is no memory at all. Large planes start at one of 16 offsets into their first
+   //!        page, in turn. The planes of a histogram are indexed alike, and with huge pages equal indices had equal
+   //!        physical address bits up to 2MB, so the entries of a hit competed for the same cache sets. That made
+   //!        the scatter in flames_bench twice as slow as with regular pages
+   PlaneAllocation AllocatePlane( size_t bytes, const MemoryPolicy& policy );
+   //! \brief Maps a range of a file into memory. Writable views write through to the file, read only views fault
+   //!        on writes. The offset has to be a multiple of FileViewAlignment. Throws std::runtime_error if the file
+   //!        can't be mapped
+   PlaneAllocation MapFilePlane( const std::string& path, uint64_t offset, size_t bytes, bool isWritable );
+   void FreePlane( const PlaneAllocation& allocation );
+
+   //! \brief Granularity of the offsets of file views, the allocation granularity of Windows, which is a multiple of
+   //!        the page sizes of Linux
+   constexpr size_t FileViewAlignment = size_t( 64 ) << 10;
+
+   //! \brief Fixed size array of a trivial type in memory from AllocatePlane, the storage of the histogram planes.
+   //!        It has the parts of the std::vector interface that the histograms use
+   template<typename T>
+   class PlaneBuffer
+   {
+      static_assert( std::is_trivially_copyable<T>::value, "The planes are copied and zeroed bytewise" );
+   public:
+      PlaneBuffer() = default;
+
+      PlaneBuffer( size_t size, const MemoryPolicy& policy ) :
+         _policy( policy ),
+         _size( size )
+      {
+         if ( size ) _allocation = AllocatePlane( size * sizeof( T ), policy );
+      }
+
+      //! \brief Takes over memory that was allocated elsewhere, e.g. by MapFilePlane
+      PlaneBuffer( size_t size, const PlaneAllocation& allocation ) :
+         _allocation( allocation ),
+         _size( size )
+      {
+      }
+
+      PlaneBuffer( const PlaneBuffer& other ) :
+         PlaneBuffer( other._size, other._policy )
+      {
+         if ( _size ) std::memcpy( data(), other.data(), _size * sizeof( T ) );
+      }
+
+      PlaneBuffer( PlaneBuffer&& other ) noexcept :
+         _allocation( other._allocation ),
+         _policy( other._policy ),
+         _size( other._size )
+      {
+         other._allocation = PlaneAllocation();
+         other._size = 0;
+      }
+
+      PlaneBuffer& operator=( PlaneBuffer other ) noexcept
+      {
+         std::swap( _allocation, other._allocation );
+         std::swap( _policy, other._policy );
+         std::swap( _size, other._size );
+         return *this;
+      }
+
+      ~PlaneBuffer()
+      {
+         if ( _allocation.memory ) FreePlane( _allocation );
+      }
+
+      T* data() { return static_cast<T*>( _allocation.memory ); }
+      const T* data() const { return static_cast<const T*>( _allocation.memory ); }
+      size_t size() const { return _size; }
+
+      T* begin() { return data(); }
+      T* end() { return data() + _size; }
+      const T* begin() const { return data(); }
+      const T* end() const { return data() + _size; }
+
+      T& operator[]( size_t idx ) { return data()[idx]; }
+      const T& operator[]( size_t idx ) const { return data()[idx]; }
+
+      const PlaneAllocation& GetAllocation() const { return _allocation; }
+   private:
+      PlaneAllocation _allocation;
+      MemoryPolicy _policy;
+      size_t _size = 0;
+   };
+}
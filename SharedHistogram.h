@@ -0,0 +1,130 @@
+#pragma once
+#include "PlanarHistogram.h"
+#include <atomic>
+#include <memory>
+
+namespace flame
+{
+
+   //! \brief Histogram that multiple FlameCalculators plot into at the same time, instead of each calculator having
+   //!        its own buffers. It is split into shards with the same planes as FlameHistogram_t, every calculator
+   //!        plots into one shard with relaxed atomic adds. A single shard needs the least memory, more shards
+   //!        mean fewer calculators contending for the same cache lines
+   class SharedHistogram
+   {
+   public:
+      SharedHistogram( size_t width, size_t height, size_t shardCount ) :
+         _width( width ),
+         _height( height ),
+         _layout( width, height ),
+         _nextShard( 0 )
+      {
+         if ( !shardCount ) throw std::runtime_error( "SharedHistogram needs at least one shard!" );
+         for ( size_t idx = 0; idx < shardCount; idx++ ) _shards.emplace_back( new Shard( _layout.GetStorageSize() ) );
+      }
+
+      SharedHistogram( const SharedHistogram& ) = delete;
+      SharedHistogram& operator=( const SharedHistogram& ) = delete;
+
+      //! \brief Hands out the shards round robin, so that the calculators are spread evenly over them
+      size_t AssignShard() { return _nextShard++ % _shards.size(); }
+
+      //! \brief Adds a hit with the given color at the given coordinates to one shard. Can be called concurrently
+      void Add( size_t shard, size_t x, size_t y, const Color3_8& color )
+      {
+         AddAt( shard, _layout.GetIndex( x, y ), color );
+      }
+
+      //! \brief Adds a hit with the given color at the given storage index to one shard
+      void AddAt( size_t shard, size_t idx, const Color3_8& color )
+      {
+         auto& target = *_shards[shard];
+         target.counts[idx].fetch_add( 1, std::memory_order_relaxed );
+         target.colorSums[0][idx].fetch_add( color.r, std::memory_order_relaxed );
+         target.colorSums[1][idx].fetch_add( color.g, std::memory_order_relaxed );
+         target.colorSums[2][idx].fetch_add( color.b, std::memory_order_relaxed );
+      }
+
+      //! \brief Overwrites the given rectangle of the snapshot with the sum of all shards and marks the blocks of the
+      //!        snapshot that got hits. Calculators may keep plotting meanwhile, hits that arrive during the copy may
+      //!        or may not be part of it
+      //! \returns The highest count within the rectangle of the snapshot
+      uint32_t CopyTo( FlameHistogram_t& snapshot, const TileRect& rect ) const
+      {
+         if ( snapshot.GetWidth() != _width || snapshot.GetHeight() != _height ) throw std::runtime_error( "Size mismatch!" );
+         uint32_t maxCount = 0;
+         _layout.ForEachSpan( rect, [&]( size_t begin, size_t end )
+         {
+            auto counts = snapshot.GetCounts();
+            uint32_t spanMaxCount = 0;
+            for ( auto idx = begin; idx < end; idx++ )
+            {
+               uint32_t count = 0;
+               for ( const auto& shard : _shards ) count += shard->counts[idx].load( std::memory_order_relaxed );
+               counts[idx] = count;
+               spanMaxCount = std::max( spanMaxCount, count );
+            }
+            if ( spanMaxCount ) snapshot.MarkOccupied( begin, end );
+            maxCount = std::max( maxCount, spanMaxCount );
+            for ( size_t channel = 0; channel < FlameHistogram_t::Channels; channel++ )
+            {
+               auto sums = snapshot.GetColorSums( channel );
+               for ( auto idx = begin; idx < end; idx++ )
+               {
+                  FlameHistogram_t::ColorSum_t sum = 0;
+                  for ( const auto& shard : _shards ) sum += shard->colorSums[channel][idx].load( std::memory_order_relaxed );
+                  sums[idx] = sum;
+               }
+            }
+         } );
+         return maxCount;
+      }
+
+      //! \brief Clears all shards. Calculators may keep plotting meanwhile, like with CopyTo hits that arrive during
+      //!        the clear may or may not survive it
+      void Clear()
+      {
+         for ( auto& shard : _shards )
+         {
+            for ( auto& count : shard->counts ) count.store( 0, std::memory_order_relaxed );
+            for ( auto& plane : shard->colorSums )
+            {
+               for ( auto& sum : plane ) sum.store( 0, std::memory_order_relaxed );
+            }
+         }
+      }
+
+      //! \brief Prefetches the cache lines of the entry at the given storage index of one shard
+      void Prefetch( size_t shard, size_t idx ) const
+      {
+         const auto& target = *_shards[shard];
+         simd::Prefetch( target.counts.data() + idx );
+         for ( const auto& plane : target.colorSums ) simd::Prefetch( plane.data() + idx );
+      }
+
+      size_t GetShardCount() const { return _shards.size(); }
+      const TiledLayout& GetLayout() const { return _layout; }
+      auto GetWidth() const { return _width; }
+      auto GetHeight() const { return _height; }
+
+   private:
+      struct Shard
+      {
+         explicit Shard( size_t size ) :
+            counts( size )
+         {
+            for ( auto& plane : colorSums ) plane = std::vector<std::atomic<FlameHistogram_t::ColorSum_t>>( size );
+         }
+
+         std::vector<std::atomic<uint32_t>> counts;
+         std::array<std::vector<std::atomic<FlameHistogram_t::ColorSum_t>>, FlameHistogram_t::Channels> colorSums;
+      };
+
+      const size_t _width, _height;
+      //! \brief Same layout as FlameHistogram_t, so that copying to a snapshot is a sum of contiguous spans
+      const TiledLayout _layout;
+      std::vector<std::unique_ptr<Shard>> _shards;
+      std::atomic<size_t> _nextShard;
+   };
+
+}
@@ -0,0 +1,249 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+#define FLAME_SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+
+//AVX2 is only available in translation units that are compiled for it (/arch:AVX2 or -mavx2 -mfma). Those
+//translation units must not use VecScalar or VecSse, otherwise the linker might pick AVX encoded versions of
+//these inline functions for the rest of the program
+#if defined(__AVX2__)
+#define FLAME_SIMD_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace flame
+{
+   namespace simd
+   {
+      //! \brief Instruction sets that the batch kernels are available for
+      enum class SimdLevel
+      {
+         Scalar,
+         Sse2,
+         Avx2
+      };
+
+      //! \brief Returns the best instruction set that is supported by the executing CPU
+      SimdLevel DetectSimdLevel();
+
+      //! \brief Hints the CPU to load the cache line of the given address, which is about to be written
+      inline void Prefetch( const void* address )
+      {
+#if defined(FLAME_SIMD_SSE2)
+         _mm_prefetch( static_cast<const char*>( address ), _MM_HINT_T0 );
+#elif defined(__GNUC__)
+         __builtin_prefetch( address, 1 );
+#else
+         (void)address;
+#endif
+      }
+
+      //! \brief Single lane vector, used for the scalar fallback of the batch kernels. All transcendental
+      //!        functions map to the standard library
+      struct VecScalar
+      {
+         static constexpr size_t Width = 1;
+         float v;
+
+         static VecScalar Load( const float* mem ) { return{ *mem }; }
+         static void Store( float* mem, const VecScalar& val ) { *mem = val.v; }
+         static VecScalar Broadcast( float val ) { return{ val }; }
+      };
+
+      inline VecScalar operator+( const VecScalar& l, const VecScalar& r ) { return{ l.v + r.v }; }
+      inline VecScalar operator-( const VecScalar& l, const VecScalar& r ) { return{ l.v - r.v }; }
+      inline VecScalar operator*( const VecScalar& l, const VecScalar& r ) { return{ l.v * r.v }; }
+      inline VecScalar operator/( const VecScalar& l, const VecScalar& r ) { return{ l.v / r.v }; }
+      inline VecScalar operator-( const VecScalar& v ) { return{ -v.v }; }
+
+      //Comparisons give masks of 1 (true) or 0 (false), which is all that Select and operator& need
+      inline VecScalar operator<( const VecScalar& l, const VecScalar& r ) { return{ l.v < r.v ? 1.f : 0.f }; }
+      inline VecScalar operator>( const VecScalar& l, const VecScalar& r ) { return{ l.v > r.v ? 1.f : 0.f }; }
+      inline VecScalar operator&( const VecScalar& l, const VecScalar& r ) { return{ l.v * r.v }; }
+
+      inline VecScalar Select( const VecScalar& mask, const VecScalar& ifTrue, const VecScalar& ifFalse )
+      {
+         return mask.v != 0.f ? ifTrue : ifFalse;
+      }
+      //! \brief True if the mask is true in any lane
+      inline bool AnyTrue( const VecScalar& mask ) { return mask.v != 0.f; }
+      inline VecScalar Abs( const VecScalar& v ) { return{ std::abs( v.v ) }; }
+      inline VecScalar Min( const VecScalar& l, const VecScalar& r ) { return{ std::min( l.v, r.v ) }; }
+      inline VecScalar Max( const VecScalar& l, const VecScalar& r ) { return{ std::max( l.v, r.v ) }; }
+      inline VecScalar Round( const VecScalar& v ) { return{ std::nearbyint( v.v ) }; }
+      inline VecScalar Floor( const VecScalar& v ) { return{ std::floor( v.v ) }; }
+      //There are no estimate instructions for single floats, the estimates are exact
+      inline VecScalar ReciprocalEstimate( const VecScalar& v ) { return{ 1.f / v.v }; }
+      inline VecScalar ReciprocalSqrtEstimate( const VecScalar& v ) { return{ 1.f / std::sqrt( v.v ) }; }
+
+      inline VecScalar Sqrt( const VecScalar& v ) { return{ std::sqrt( v.v ) }; }
+      inline VecScalar Sin( const VecScalar& v ) { return{ std::sin( v.v ) }; }
+      inline VecScalar Cos( const VecScalar& v ) { return{ std::cos( v.v ) }; }
+      inline VecScalar Atan( const VecScalar& v ) { return{ std::atan( v.v ) }; }
+      inline void SinCos( const VecScalar& v, VecScalar& s, VecScalar& c )
+      {
+         s.v = std::sin( v.v );
+         c.v = std::cos( v.v );
+      }
+
+#ifdef FLAME_SIMD_SSE2
+      //! \brief 4 lane SSE2 vector
+      struct VecSse
+      {
+         static constexpr size_t Width = 4;
+         __m128 v;
+
+         static VecSse Load( const float* mem ) { return{ _mm_loadu_ps( mem ) }; }
+         static void Store( float* mem, const VecSse& val ) { _mm_storeu_ps( mem, val.v ); }
+         static VecSse Broadcast( float val ) { return{ _mm_set1_ps( val ) }; }
+      };
+
+      inline VecSse operator+( const VecSse& l, const VecSse& r ) { return{ _mm_add_ps( l.v, r.v ) }; }
+      inline VecSse operator-( const VecSse& l, const VecSse& r ) { return{ _mm_sub_ps( l.v, r.v ) }; }
+      inline VecSse operator*( const VecSse& l, const VecSse& r ) { return{ _mm_mul_ps( l.v, r.v ) }; }
+      inline VecSse operator/( const VecSse& l, const VecSse& r ) { return{ _mm_div_ps( l.v, r.v ) }; }
+      inline VecSse operator-( const VecSse& v ) { return{ _mm_xor_ps( v.v, _mm_set1_ps( -0.f ) ) }; }
+      inline VecSse operator<( const VecSse& l, const VecSse& r ) { return{ _mm_cmplt_ps( l.v, r.v ) }; }
+      inline VecSse operator>( const VecSse& l, const VecSse& r ) { return{ _mm_cmpgt_ps( l.v, r.v ) }; }
+      inline VecSse operator&( const VecSse& l, const VecSse& r ) { return{ _mm_and_ps( l.v, r.v ) }; }
+
+      inline VecSse Select( const VecSse& mask, const VecSse& ifTrue, const VecSse& ifFalse )
+      {
+         return{ _mm_or_ps( _mm_and_ps( mask.v, ifTrue.v ), _mm_andnot_ps( mask.v, ifFalse.v ) ) };
+      }
+      inline bool AnyTrue( const VecSse& mask ) { return _mm_movemask_ps( mask.v ) != 0; }
+      inline VecSse Abs( const VecSse& v ) { return{ _mm_andnot_ps( _mm_set1_ps( -0.f ), v.v ) }; }
+      inline VecSse Min( const VecSse& l, const VecSse& r ) { return{ _mm_min_ps( l.v, r.v ) }; }
+      inline VecSse Max( const VecSse& l, const VecSse& r ) { return{ _mm_max_ps( l.v, r.v ) }; }
+      inline VecSse Sqrt( const VecSse& v ) { return{ _mm_sqrt_ps( v.v ) }; }
+      //! \brief Hardware estimates with a relative error of at most 1.5 * 2^-12
+      inline VecSse ReciprocalEstimate( const VecSse& v ) { return{ _mm_rcp_ps( v.v ) }; }
+      inline VecSse ReciprocalSqrtEstimate( const VecSse& v ) { return{ _mm_rsqrt_ps( v.v ) }; }
+      inline VecSse Round( const VecSse& v ) { return{ _mm_cvtepi32_ps( _mm_cvtps_epi32( v.v ) ) }; }
+      inline VecSse Floor( const VecSse& v )
+      {
+         //SSE2 has no floor, so truncate and correct the negative values
+         auto truncated = _mm_cvtepi32_ps( _mm_cvttps_epi32( v.v ) );
+         auto correction = _mm_and_ps( _mm_cmpgt_ps( truncated, v.v ), _mm_set1_ps( 1.f ) );
+         return{ _mm_sub_ps( truncated, correction ) };
+      }
+#endif
+
+#ifdef FLAME_SIMD_AVX2
+      //! \brief 8 lane AVX2 vector
+      struct VecAvx2
+      {
+         static constexpr size_t Width = 8;
+         __m256 v;
+
+         static VecAvx2 Load( const float* mem ) { return{ _mm256_loadu_ps( mem ) }; }
+         static void Store( float* mem, const VecAvx2& val ) { _mm256_storeu_ps( mem, val.v ); }
+         static VecAvx2 Broadcast( float val ) { return{ _mm256_set1_ps( val ) }; }
+      };
+
+      inline VecAvx2 operator+( const VecAvx2& l, const VecAvx2& r ) { return{ _mm256_add_ps( l.v, r.v ) }; }
+      inline VecAvx2 operator-( const VecAvx2& l, const VecAvx2& r ) { return{ _mm256_sub_ps( l.v, r.v ) }; }
+      inline VecAvx2 operator*( const VecAvx2& l, const VecAvx2& r ) { return{ _mm256_mul_ps( l.v, r.v ) }; }
+      inline VecAvx2 operator/( const VecAvx2& l, const VecAvx2& r ) { return{ _mm256_div_ps( l.v, r.v ) }; }
+      inline VecAvx2 operator-( const VecAvx2& v ) { return{ _mm256_xor_ps( v.v, _mm256_set1_ps( -0.f ) ) }; }
+      inline VecAvx2 operator<( const VecAvx2& l, const VecAvx2& r ) { return{ _mm256_cmp_ps( l.v, r.v, _CMP_LT_OQ ) }; }
+      inline VecAvx2 operator>( const VecAvx2& l, const VecAvx2& r ) { return{ _mm256_cmp_ps( l.v, r.v, _CMP_GT_OQ ) }; }
+      inline VecAvx2 operator&( const VecAvx2& l, const VecAvx2& r ) { return{ _mm256_and_ps( l.v, r.v ) }; }
+
+      inline VecAvx2 Select( const VecAvx2& mask, const VecAvx2& ifTrue, const VecAvx2& ifFalse )
+      {
+         return{ _mm256_blendv_ps( ifFalse.v, ifTrue.v, mask.v ) };
+      }
+      inline bool AnyTrue( const VecAvx2& mask ) { return _mm256_movemask_ps( mask.v ) != 0; }
+      inline VecAvx2 Abs( const VecAvx2& v ) { return{ _mm256_andnot_ps( _mm256_set1_ps( -0.f ), v.v ) }; }
+      inline VecAvx2 Min( const VecAvx2& l, const VecAvx2& r ) { return{ _mm256_min_ps( l.v, r.v ) }; }
+      inline VecAvx2 Max( const VecAvx2& l, const VecAvx2& r ) { return{ _mm256_max_ps( l.v, r.v ) }; }
+      inline VecAvx2 Sqrt( const VecAvx2& v ) { return{ _mm256_sqrt_ps( v.v ) }; }
+      inline VecAvx2 ReciprocalEstimate( const VecAvx2& v ) { return{ _mm256_rcp_ps( v.v ) }; }
+      inline VecAvx2 ReciprocalSqrtEstimate( const VecAvx2& v ) { return{ _mm256_rsqrt_ps( v.v ) }; }
+      inline VecAvx2 Round( const VecAvx2& v ) { return{ _mm256_round_ps( v.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ) }; }
+      inline VecAvx2 Floor( const VecAvx2& v ) { return{ _mm256_floor_ps( v.v ) }; }
+#endif
+
+      //! \brief Computes sine and cosine of all lanes. The argument is reduced to [-pi/4, pi/4] with a three
+      //!        part Cody-Waite reduction and evaluated with the minimax polynomials from Cephes (sinf/cosf).
+      //!        The error is within 2 ulp for |v| < 8192. Beyond that the reduction loses precision, the result
+      //!        then stays within [-1, 1] but is not accurate anymore
+      template<typename Vec>
+      void SinCos( const Vec& v, Vec& s, Vec& c )
+      {
+         const auto quadrant = Round( v * Vec::Broadcast( 0.636619772f ) );
+         auto r = v - quadrant * Vec::Broadcast( 1.5703125f );
+         r = r - quadrant * Vec::Broadcast( 4.837512969970703125e-4f );
+         r = r - quadrant * Vec::Broadcast( 7.54978995489188216e-8f );
+         r = Min( Max( r, Vec::Broadcast( -0.785398163f ) ), Vec::Broadcast( 0.785398163f ) );
+
+         const auto r2 = r * r;
+         auto sinPoly = Vec::Broadcast( -1.9515295891e-4f );
+         sinPoly = sinPoly * r2 + Vec::Broadcast( 8.3321608736e-3f );
+         sinPoly = sinPoly * r2 + Vec::Broadcast( -1.6666654611e-1f );
+         sinPoly = sinPoly * r2 * r + r;
+
+         auto cosPoly = Vec::Broadcast( 2.443315711809948e-5f );
+         cosPoly = cosPoly * r2 + Vec::Broadcast( -1.388731625493765e-3f );
+         cosPoly = cosPoly * r2 + Vec::Broadcast( 4.166664568298827e-2f );
+         cosPoly = cosPoly * r2 * r2 - Vec::Broadcast( 0.5f ) * r2 + Vec::Broadcast( 1.f );
+
+         //Quadrant modulo 4, computed in floating point so that no integer instructions are needed
+         const auto q = quadrant - Vec::Broadcast( 4.f ) * Floor( quadrant * Vec::Broadcast( 0.25f ) );
+         const auto qOdd = ( q - Vec::Broadcast( 2.f ) * Floor( q * Vec::Broadcast( 0.5f ) ) ) > Vec::Broadcast( 0.5f );
+         const auto sinNegative = q > Vec::Broadcast( 1.5f );
+         const auto cosNegative = ( q > Vec::Broadcast( 0.5f ) ) & ( q < Vec::Broadcast( 2.5f ) );
+
+         const auto sinBase = Select( qOdd, cosPoly, sinPoly );
+         const auto cosBase = Select( qOdd, sinPoly, cosPoly );
+         s = Select( sinNegative, -sinBase, sinBase );
+         c = Select( cosNegative, -cosBase, cosBase );
+      }
+
+      template<typename Vec>
+      Vec Sin( const Vec& v )
+      {
+         Vec s, c;
+         SinCos( v, s, c );
+         return s;
+      }
+
+      template<typename Vec>
+      Vec Cos( const Vec& v )
+      {
+         Vec s, c;
+         SinCos( v, s, c );
+         return c;
+      }
+
+      //! \brief Arcus tangent of all lanes, using the range reduction and polynomial of Cephes (atanf). The error
+      //!        is within 2 ulp over the whole range
+      template<typename Vec>
+      Vec Atan( const Vec& v )
+      {
+         const auto x = Abs( v );
+         const auto isBig = x > Vec::Broadcast( 2.414213562373095f );
+         const auto isMedium = x > Vec::Broadcast( 0.4142135623730950f );
+
+         const auto offset = Select( isBig, Vec::Broadcast( 1.570796326794897f ),
+                                     Select( isMedium, Vec::Broadcast( 0.785398163397448f ), Vec::Broadcast( 0.f ) ) );
+         const auto reduced = Select( isBig, Vec::Broadcast( -1.f ) / x,
+                                      Select( isMedium, ( x - Vec::Broadcast( 1.f ) ) / ( x + Vec::Broadcast( 1.f ) ), x ) );
+
+         const auto z = reduced * reduced;
+         auto poly = Vec::Broadcast( 8.05374449538e-2f );
+         poly = poly * z - Vec::Broadcast( 1.38776856032e-1f );
+         poly = poly * z + Vec::Broadcast( 1.99777106478e-1f );
+         poly = poly * z - Vec::Broadcast( 3.33329491539e-1f );
+         const auto result = offset + poly * z * reduced + reduced;
+
+         return Select( v < Vec::Broadcast( 0.f ), -result, result );
+      }
+   }
+}
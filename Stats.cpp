@@ -0,0 +1,228 @@
+#include "Stats.h"
+#include <stdexcept>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+namespace flame
+{
+   namespace
+   {
+      //! \brief Value of a dump line, integers are marked as such in the line protocol
+      struct StatsField
+      {
+         std::string key;
+         double value;
+         bool isInteger;
+      };
+
+      void AddDurationFields( std::vector<StatsField>& fields, const std::string& prefix, const DurationStats& stats )
+      {
+         using Micros = std::chrono::duration<double, std::micro>;
+         fields.push_back( { prefix + "_count", static_cast<double>( stats.count ), true } );
+         fields.push_back( { prefix + "_total_us", Micros( stats.total ).count(), false } );
+         fields.push_back( { prefix + "_mean_us", Micros( stats.GetMean() ).count(), false } );
+         fields.push_back( { prefix + "_max_us", Micros( stats.max ).count(), false } );
+      }
+
+      //! \brief Source names are made by the caller, only quotes and backslashes need escaping in JSON. The line
+      //!        protocol escapes commas, spaces and equal signs in tag values instead
+      std::string Escape( const std::string& text, StatsFormat format )
+      {
+         std::string escaped;
+         for ( auto c : text )
+         {
+            const auto needsEscape = format == StatsFormat::Json ? c == '"' || c == '\\' : c == ',' || c == ' ' || c == '=';
+            if ( needsEscape ) escaped += '\\';
+            escaped += c;
+         }
+         return escaped;
+      }
+
+      void WriteLine( std::ostream& target, StatsFormat format, const std::string& kind, const std::string& name,
+                      const std::vector<StatsField>& fields, int64_t timestamp )
+      {
+         //Formatted separately, so that the fixed notation doesn't stick to the target
+         std::ostringstream out;
+         out << std::fixed << std::setprecision( 3 );
+         if ( format == StatsFormat::Json )
+         {
+            out << "{\"time_ns\":" << timestamp << ",\"kind\":\"" << kind << "\",\"name\":\"" << Escape( name, format ) << "\"";
+            for ( const auto& field : fields )
+            {
+               out << ",\"" << field.key << "\":";
+               if ( field.isInteger ) out << static_cast<uint64_t>( field.value );
+               else out << field.value;
+            }
+            out << "}\n";
+         }
+         else
+         {
+            out << "flames_" << kind << ",name=" << Escape( name, format ) << " ";
+            for ( size_t idx = 0; idx < fields.size(); idx++ )
+            {
+               out << ( idx ? "," : "" ) << fields[idx].key << "=";
+               if ( fields[idx].isInteger ) out << static_cast<uint64_t>( fields[idx].value ) << "i";
+               else out << fields[idx].value;
+            }
+            out << " " << timestamp << "\n";
+         }
+         target << out.str();
+      }
+   }
+
+   DurationStats& DurationStats::operator+=( const DurationStats& other )
+   {
+      count += other.count;
+      total += other.total;
+      max = std::max( max, other.max );
+      return *this;
+   }
+
+   DurationStats StatDuration::Get() const
+   {
+      DurationStats stats;
+      stats.count = _count.Get();
+      stats.total = std::chrono::nanoseconds( _totalNs.Get() );
+      stats.max = std::chrono::nanoseconds( _maxNs.Get() );
+      return stats;
+   }
+
+   CalculatorStats& CalculatorStats::operator+=( const CalculatorStats& other )
+   {
+      iterations += other.iterations;
+      plotted += other.plotted;
+      rejected += other.rejected;
+      escapes += other.escapes;
+      chunks += other.chunks;
+      handoffs += other.handoffs;
+      merges += other.merges;
+      lockWaits += other.lockWaits;
+      lockHolds += other.lockHolds;
+      return *this;
+   }
+
+   CalculatorStats CalculatorCounters::Get() const
+   {
+      CalculatorStats stats;
+      stats.iterations = iterations.Get();
+      stats.plotted = plotted.Get();
+      stats.rejected = rejected.Get();
+      stats.escapes = escapes.Get();
+      stats.chunks = chunks.Get();
+      stats.handoffs = handoffs.Get();
+      stats.merges = merges.Get();
+      stats.lockWaits = lockWaits.Get();
+      stats.lockHolds = lockHolds.Get();
+      return stats;
+   }
+
+   StatsReporter::StatsReporter( StatsFormat format ) :
+      _format( format ),
+      _lastDump( std::chrono::steady_clock::now() ),
+      _isStopping( false )
+   {
+   }
+
+   StatsReporter::~StatsReporter()
+   {
+      Stop();
+   }
+
+   void StatsReporter::AddCalculator( const std::string& name, CalculatorSource source )
+   {
+      std::lock_guard<std::mutex> guard( _mutex );
+      const auto iterations = source().iterations;
+      _calculators.push_back( { name, std::move( source ), iterations } );
+   }
+
+   void StatsReporter::AddDuration( const std::string& name, const StatDuration& duration )
+   {
+      std::lock_guard<std::mutex> guard( _mutex );
+      _durations.emplace_back( name, &duration );
+   }
+
+   void StatsReporter::Start( std::ostream& out, std::chrono::milliseconds interval )
+   {
+      if ( _thread.joinable() ) throw std::runtime_error( "StatsReporter is already running!" );
+      _isStopping = false;
+      _thread = std::thread( [this, &out, interval]()
+      {
+         std::unique_lock<std::mutex> lock( _stopMutex );
+         while ( !_stopped.wait_for( lock, interval, [this]() { return _isStopping; } ) )
+         {
+            Dump( out );
+            out.flush();
+         }
+      } );
+   }
+
+   void StatsReporter::Stop()
+   {
+      {
+         std::lock_guard<std::mutex> guard( _stopMutex );
+         _isStopping = true;
+         _stopped.notify_all();
+      }
+      if ( _thread.joinable() ) _thread.join();
+   }
+
+   void StatsReporter::Dump( std::ostream& out )
+   {
+      std::lock_guard<std::mutex> guard( _mutex );
+      const auto now = std::chrono::steady_clock::now();
+      const auto seconds = std::chrono::duration<double>( now - _lastDump ).count();
+      _lastDump = now;
+      const auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+         std::chrono::system_clock::now().time_since_epoch() ).count();
+
+      CalculatorStats total;
+      uint64_t newIterations = 0;
+      for ( auto& calculator : _calculators )
+      {
+         const auto stats = calculator.source();
+         const auto iterations = stats.iterations - std::min( stats.iterations, calculator.iterations );
+         calculator.iterations = stats.iterations;
+         newIterations += iterations;
+         total += stats;
+         WriteCalculator( out, calculator.name, stats, seconds > 0.0 ? iterations / seconds : 0.0, timestamp );
+      }
+      if ( _calculators.size() > 1 )
+      {
+         WriteCalculator( out, "total", total, seconds > 0.0 ? newIterations / seconds : 0.0, timestamp );
+      }
+      for ( const auto& duration : _durations ) WriteDuration( out, duration.first, duration.second->Get(), timestamp );
+   }
+
+   void StatsReporter::WriteCalculator( std::ostream& out, const std::string& name, const CalculatorStats& stats, double rate,
+                                        int64_t timestamp ) const
+   {
+      std::vector<StatsField> fields = {
+         { "iterations", static_cast<double>( stats.iterations ), true },
+         { "iterations_per_second", rate, false },
+         { "plotted", static_cast<double>( stats.plotted ), true },
+         { "rejected", static_cast<double>( stats.rejected ), true },
+         { "escapes", static_cast<double>( stats.escapes ), true }
+      };
+      AddDurationFields( fields, "chunk", stats.chunks );
+      AddDurationFields( fields, "handoff", stats.handoffs );
+      AddDurationFields( fields, "merge", stats.merges );
+      AddDurationFields( fields, "lock_wait", stats.lockWaits );
+      AddDurationFields( fields, "lock_hold", stats.lockHolds );
+      WriteLine( out, _format, "calculator", name, fields, timestamp );
+   }
+
+   void StatsReporter::WriteDuration( std::ostream& out, const std::string& name, const DurationStats& stats, int64_t timestamp ) const
+   {
+      std::vector<StatsField> fields;
+      AddDurationFields( fields, "duration", stats );
+      WriteLine( out, _format, "operation", name, fields, timestamp );
+   }
+
+   StatsFormat ParseStatsFormat( const std::string& name )
+   {
+      if ( name == "json" ) return StatsFormat::Json;
+      if ( name == "line" ) return StatsFormat::LineProtocol;
+      throw std::runtime_error( "Unknown stats format '" + name + "', expected json or line" );
+   }
+}
@@ -0,0 +1,151 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace flame
+{
+   //! \brief Counter with a single writer and any number of readers. Adding is a plain load and store, without the
+   //!        locked read-modify-write of fetch_add, so it costs the same as a non-atomic counter
+   class StatCounter
+   {
+   public:
+      StatCounter() : _value( 0 ) {}
+
+      void Add( uint64_t value ) { _value.store( _value.load( std::memory_order_relaxed ) + value, std::memory_order_relaxed ); }
+      void RaiseTo( uint64_t value )
+      {
+         if ( value > _value.load( std::memory_order_relaxed ) ) _value.store( value, std::memory_order_relaxed );
+      }
+      uint64_t Get() const { return _value.load( std::memory_order_relaxed ); }
+   private:
+      std::atomic<uint64_t> _value;
+   };
+
+   //! \brief Number, sum and maximum of the durations of an operation
+   struct DurationStats
+   {
+      uint64_t count = 0;
+      std::chrono::nanoseconds total{ 0 };
+      std::chrono::nanoseconds max{ 0 };
+
+      std::chrono::nanoseconds GetMean() const { return count ? total / static_cast<int64_t>( count ) : std::chrono::nanoseconds( 0 ); }
+      DurationStats& operator+=( const DurationStats& other );
+   };
+
+   //! \brief Durations of an operation with a single writer, see StatCounter
+   class StatDuration
+   {
+   public:
+      void Add( std::chrono::nanoseconds duration )
+      {
+         _count.Add( 1 );
+         _totalNs.Add( static_cast<uint64_t>( duration.count() ) );
+         _maxNs.RaiseTo( static_cast<uint64_t>( duration.count() ) );
+      }
+      DurationStats Get() const;
+   private:
+      StatCounter _count, _totalNs, _maxNs;
+   };
+
+   //! \brief Copy of the counters of a FlameCalculator. Every hit of a point and of its plot symmetries is either
+   //!        plotted or rejected because it is outside of the histogram
+   struct CalculatorStats
+   {
+      uint64_t iterations = 0;
+      uint64_t plotted = 0;
+      uint64_t rejected = 0;
+      //! \brief Walkers that escaped to NaN or infinity and were moved back to a random point
+      uint64_t escapes = 0;
+      DurationStats chunks;
+      //! \brief Snapshot timings, see SnapshotLatency
+      DurationStats handoffs;
+      DurationStats merges;
+      //! \brief Time that snapshots waited for and held the snapshot lock of the calculator
+      DurationStats lockWaits;
+      DurationStats lockHolds;
+
+      CalculatorStats& operator+=( const CalculatorStats& other );
+   };
+
+   //! \brief Live counters of a FlameCalculator. The worker side counters are only written by the worker that runs
+   //!        the current chunk, the snapshot side ones only under the snapshot lock, so none of them is contended
+   struct CalculatorCounters
+   {
+      StatCounter iterations, plotted, rejected, escapes;
+      StatDuration chunks;
+      StatDuration handoffs, merges, lockWaits, lockHolds;
+
+      CalculatorStats Get() const;
+   };
+
+   //! \brief Format of the stats dumps
+   enum class StatsFormat
+   {
+      //! \brief One JSON object per line
+      Json,
+      //! \brief InfluxDB line protocol, one line per source
+      LineProtocol
+   };
+
+   //! \brief Writes the stats of the registered sources every interval from a thread of its own, or on request.
+   //!        Sources are read without stopping them. Every dump has a line per source and one for their total, with
+   //!        the rate of iterations since the previous dump
+   class StatsReporter
+   {
+   public:
+      using CalculatorSource = std::function<CalculatorStats()>;
+
+      explicit StatsReporter( StatsFormat format = StatsFormat::Json );
+      //! \brief Stops the periodic dumps
+      ~StatsReporter();
+
+      StatsReporter( const StatsReporter& ) = delete;
+      StatsReporter& operator=( const StatsReporter& ) = delete;
+
+      //! \brief Registers the counters of a calculator, has to outlive the reporter or its last dump
+      void AddCalculator( const std::string& name, CalculatorSource source );
+      //! \brief Registers the durations of an operation outside of the calculators, like the resolve
+      void AddDuration( const std::string& name, const StatDuration& duration );
+
+      //! \brief Dumps to the stream every interval until Stop. The stream has to outlive the reporter
+      void Start( std::ostream& out, std::chrono::milliseconds interval );
+      void Stop();
+      //! \brief Dumps right away
+      void Dump( std::ostream& out );
+   private:
+      struct Calculator
+      {
+         std::string name;
+         CalculatorSource source;
+         //! \brief Iterations at the previous dump
+         uint64_t iterations;
+      };
+
+      void WriteCalculator( std::ostream& out, const std::string& name, const CalculatorStats& stats, double rate,
+                            int64_t timestamp ) const;
+      void WriteDuration( std::ostream& out, const std::string& name, const DurationStats& stats, int64_t timestamp ) const;
+
+      const StatsFormat _format;
+      //! \brief Guards the sources and the rates between the periodic and the requested dumps
+      std::mutex _mutex;
+      std::vector<Calculator> _calculators;
+      std::vector<std::pair<std::string, const StatDuration*>> _durations;
+      std::chrono::steady_clock::time_point _lastDump;
+
+      std::thread _thread;
+      std::mutex _stopMutex;
+      std::condition_variable _stopped;
+      bool _isStopping;
+   };
+
+   //! \brief Parses "json" or "line", throws std::runtime_error otherwise
+   StatsFormat ParseStatsFormat( const std::string& name );
+}
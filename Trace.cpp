@@ -0,0 +1,124 @@
+#include "Trace.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+
+namespace flame
+{
+   std::atomic_bool Trace::_isEnabled( false );
+
+   namespace
+   {
+      struct TraceEvent
+      {
+         const char* name;
+         const char* category;
+         Trace::Clock_t::time_point begin;
+         Trace::Clock_t::duration duration;
+      };
+
+      //! \brief Events of one thread. Its mutex is only contended while the trace is written or cleared
+      struct ThreadEvents
+      {
+         std::mutex mutex;
+         std::vector<TraceEvent> events;
+         size_t threadId;
+      };
+
+      //! \brief Buffers of all threads that recorded events. The buffers are kept after their threads exit, their
+      //!        events are part of the trace
+      struct TraceBuffers
+      {
+         std::mutex mutex;
+         std::vector<std::shared_ptr<ThreadEvents>> threads;
+         const Trace::Clock_t::time_point start = Trace::Clock_t::now();
+      };
+
+      TraceBuffers& GetBuffers()
+      {
+         static TraceBuffers buffers;
+         return buffers;
+      }
+
+      ThreadEvents& GetThreadEvents()
+      {
+         thread_local std::shared_ptr<ThreadEvents> events;
+         if ( !events )
+         {
+            events = std::make_shared<ThreadEvents>();
+            auto& buffers = GetBuffers();
+            std::lock_guard<std::mutex> guard( buffers.mutex );
+            events->threadId = buffers.threads.size() + 1;
+            buffers.threads.push_back( events );
+         }
+         return *events;
+      }
+
+      //! \brief Event names are literals from the code, only quotes and backslashes would need escaping
+      void WriteString( std::ostream& out, const char* text )
+      {
+         out << '"';
+         for ( auto c = text; *c; c++ )
+         {
+            if ( *c == '"' || *c == '\\' ) out << '\\';
+            out << *c;
+         }
+         out << '"';
+      }
+   }
+
+   void Trace::Enable( bool isEnabled )
+   {
+      GetBuffers();
+      _isEnabled.store( isEnabled, std::memory_order_relaxed );
+   }
+
+   void Trace::Record( const char* name, const char* category, Clock_t::time_point begin, Clock_t::time_point end )
+   {
+      auto& thread = GetThreadEvents();
+      std::lock_guard<std::mutex> guard( thread.mutex );
+      if ( thread.events.size() < MaxEventsPerThread ) thread.events.push_back( { name, category, begin, end - begin } );
+   }
+
+   void Trace::Write( std::ostream& target )
+   {
+      auto& buffers = GetBuffers();
+      std::lock_guard<std::mutex> guard( buffers.mutex );
+      //Formatted separately, so that the fixed notation doesn't stick to the target
+      std::ostringstream out;
+      out << std::fixed << std::setprecision( 3 );
+      out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+      auto isFirst = true;
+      for ( const auto& thread : buffers.threads )
+      {
+         std::lock_guard<std::mutex> threadGuard( thread->mutex );
+         for ( const auto& event : thread->events )
+         {
+            //Complete events, with timestamps and durations in microseconds
+            const auto begin = std::chrono::duration<double, std::micro>( event.begin - buffers.start ).count();
+            const auto duration = std::chrono::duration<double, std::micro>( event.duration ).count();
+            out << ( isFirst ? "\n" : ",\n" ) << "{\"name\":";
+            WriteString( out, event.name );
+            out << ",\"cat\":";
+            WriteString( out, event.category );
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->threadId << ",\"ts\":" << begin << ",\"dur\":" << duration << "}";
+            isFirst = false;
+         }
+      }
+      out << "\n]}\n";
+      target << out.str();
+   }
+
+   void Trace::Clear()
+   {
+      auto& buffers = GetBuffers();
+      std::lock_guard<std::mutex> guard( buffers.mutex );
+      for ( const auto& thread : buffers.threads )
+      {
+         std::lock_guard<std::mutex> threadGuard( thread->mutex );
+         thread->events.clear();
+      }
+   }
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+namespace flame
+{
+   //! \brief Collects timed events for a timeline in the Chrome trace format (chrome://tracing, Perfetto). Tracing
+   //!        is off by default, a TraceScope then costs a relaxed load. Every thread records into a buffer of its
+   //!        own, so threads only contend while the trace is written
+   class Trace
+   {
+   public:
+      using Clock_t = std::chrono::steady_clock;
+
+      //! \brief Events per thread, later events are dropped
+      static constexpr size_t MaxEventsPerThread = 1 << 20;
+
+      //! \brief Starts or stops recording. The timeline starts at the first call
+      static void Enable( bool isEnabled );
+      static bool IsEnabled() { return _isEnabled.load( std::memory_order_relaxed ); }
+
+      //! \brief Records an event of the calling thread
+      //! \param name, category Have to outlive the trace, i.e. be string literals
+      static void Record( const char* name, const char* category, Clock_t::time_point begin, Clock_t::time_point end );
+
+      //! \brief Writes the events of all threads so far as a JSON trace
+      static void Write( std::ostream& out );
+      //! \brief Drops the events of all threads so far
+      static void Clear();
+   private:
+      static std::atomic_bool _isEnabled;
+   };
+
+   //! \brief Records an event for its lifetime, if tracing was enabled when it was created
+   class TraceScope
+   {
+   public:
+      //! \param name, category Have to be string literals, see Trace::Record
+      explicit TraceScope( const char* name, const char* category = "flame" ) :
+         _name( Trace::IsEnabled() ? name : nullptr ),
+         _category( category )
+      {
+         if ( _name ) _begin = Trace::Clock_t::now();
+      }
+
+      ~TraceScope()
+      {
+         if ( _name ) Trace::Record( _name, _category, _begin, Trace::Clock_t::now() );
+      }
+
+      TraceScope( const TraceScope& ) = delete;
+      TraceScope& operator=( const TraceScope& ) = delete;
+   private:
+      const char* _name;
+      const char* _category;
+      Trace::Clock_t::time_point _begin;
+   };
+}
@@ -1,13 +1,25 @@
 #include <iostream>
-#include <random>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
 #include "FlameFunctions.h"
-#include "Histogram.h"
+#include "PlanarHistogram.h"
 #include "FlameCalculator.h"
+#include "FlameBatch.h"
+#include "HeadlessRenderer.h"
+#include "FramePipeline.h"
+#include "ImageWriter.h"
+#include "GenomeFile.h"
+#include "GenomeHandle.h"
+#include "HistogramFile.h"
+#include "OutOfCoreHistogram.h"
+#include "Stats.h"
+#include "Trace.h"
+#include <fstream>
+#include <sstream>
 #include <future>
+#include <string>
 
 using namespace flame;
 
@@ -15,78 +27,540 @@ const int WinWidth = 1024;
 const int WinHeight = 1024;
 const int SuperSampling = 2;
 
-int main( int argc, char** argv )
+namespace
 {
-   const auto wndName = "Flames";
-   const auto bpp = 3;
+   FlameFunctionSet MakeDemoGenome( SymmetryMode symmetryMode )
+   {
+      FlameFunctionSet ffs;
+      ffs.AddFunction(
+         FlameFunction( { Variations::Linear }, { Coefficients::Build( 0.3f, 0, 0, 0, 0.3f, 0 ) }, { 1.f }, Color3_8( 138, 43, 226 ) ),
+         0.33f
+      );
 
-   cv::Mat mat = cv::Mat::zeros( WinWidth, WinHeight, CV_8UC3 );
-   cv::namedWindow( wndName );
+      ffs.AddFunction(
+         FlameFunction(
+      { Variations::Heart, Variations::Sinusoidal },
+      { Coefficients::Build( 0.3f, 0, 0, 0, 0.3f, 0.5f ), Coefficients::Build( 0.3f, 0.3f, 0.2f, 0.3f, 0.7f, 0.4f ) },
+      { 0.8f, 0.2f }, Color3_8( 153, 50, 204 ) ),
+         0.33f
+      );
 
-   FlameFunctionSet ffs;
-   ffs.AddFunction(
-      FlameFunction( { Variations::Linear }, { Coefficients::Build( 0.3f, 0, 0, 0, 0.3f, 0 ) }, { 1.f }, Color3_8( 138, 43, 226 ) ),
-      0.33f
-   );
-
-   ffs.AddFunction(
-      FlameFunction(
-   { Variations::Heart, Variations::Sinusoidal },
-   { Coefficients::Build( 0.3f, 0, 0, 0, 0.3f, 0.5f ), Coefficients::Build( 0.3f, 0.3f, 0.2f, 0.3f, 0.7f, 0.4f ) },
-   { 0.8f, 0.2f }, Color3_8( 153, 50, 204 ) ),
-      0.33f
-   );
-
-   ffs.AddFunction(
-      FlameFunction( { Variations::Spherical }, { Coefficients::Build( 0.3f, 0, 0.5f, 0, 0.3f, 0 ) }, { 1.f }, Color3_8( 255, 105, 180 ) ),
-      0.33f
-   );
-
-   ffs.AddSymmetries( { Symmetry::Rotate72 } );
-
-   const auto Threads = 7;
-   std::vector<SimpleHistogram_t> snapshotHistograms;
-   std::vector<FlameCalculator::Ptr> calculators;
-   for ( auto idx = 0; idx < Threads; idx++ )
+      ffs.AddFunction(
+         FlameFunction( { Variations::Spherical }, { Coefficients::Build( 0.3f, 0, 0.5f, 0, 0.3f, 0 ) }, { 1.f }, Color3_8( 255, 105, 180 ) ),
+         0.33f
+      );
+
+      ffs.AddSymmetries( { Symmetry::Rotate72 }, symmetryMode );
+
+      return ffs;
+   }
+
+   //! \brief Opens the stream of --stats FILE, stdout for "-". Returns nullptr without the argument
+   std::ostream* OpenStats( const std::vector<std::string>& args, std::ofstream& file )
    {
-      snapshotHistograms.emplace_back( WinWidth * SuperSampling, WinHeight * SuperSampling );
-      calculators.push_back(
-         std::make_unique<FlameCalculator>( ffs,
-                                            static_cast<size_t>( WinWidth ),
-                                            static_cast<size_t>( WinHeight ),
-                                            static_cast<size_t>( SuperSampling ) ) );
-      calculators[idx]->Start();
+      auto statsArg = std::find( args.begin(), args.end(), "--stats" );
+      if ( statsArg == args.end() || statsArg + 1 == args.end() ) return nullptr;
+      if ( *( statsArg + 1 ) == "-" ) return &std::cout;
+      file.open( *( statsArg + 1 ) );
+      return &file;
    }
 
-   std::vector<Color3_8> colors;
-   colors.resize( WinWidth * WinHeight );
+   //! \brief Watches a genome file for edits by its content, which doesn't depend on the timestamps of the file system
+   class GenomeWatcher
+   {
+   public:
+      explicit GenomeWatcher( const std::string& path ) :
+         _path( path ),
+         _content( ReadContent() )
+      {
+      }
+
+      //! \brief Loads the file if its content changed since the last call. Genomes with errors are reported once
+      //!        and skipped, until the file changes again
+      //! \returns True with the new genome in functions
+      bool Poll( FlameFunctionSet& functions )
+      {
+         auto content = ReadContent();
+         if ( content.empty() || content == _content ) return false;
+         _content = std::move( content );
+         try
+         {
+            functions = LoadGenome( _path );
+            return true;
+         }
+         catch ( const std::runtime_error& error )
+         {
+            std::cerr << error.what() << std::endl;
+            return false;
+         }
+      }
+   private:
+      std::string ReadContent() const
+      {
+         std::ifstream file( _path, std::ios::binary );
+         std::stringstream content;
+         content << file.rdbuf();
+         return content.str();
+      }
+
+      const std::string _path;
+      std::string _content;
+   };
 
-   while ( true )
+   //! \brief Renders into a window until a key is pressed. Edits of the --genome file are rendered as soon as the
+   //!        file is saved, without restarting the calculators
+   //!        Arguments: --shards N to plot into a SharedHistogram with N shards instead of per thread histograms,
+   //!        --threads N to use N workers instead of one per hardware thread, --pin to pin them,
+   //!        --target-noise LEVELS to stop iterating once the noise estimate reaches the target,
+   //!        --stats FILE|- --stats-format json|line to dump the stats of the calculators every second,
+   //!        --genome-change clear|decay to start edited genomes on an empty image or over the faded old one
+   int RunInteractive( const FlameFunctionSet& ffs, const std::vector<std::string>& args )
    {
-      for ( auto t = 0; t < Threads; t++ )
+      std::cout << "Using " << GetBatchKernels().name << " batch kernels" << std::endl;
+
+      size_t shards = 0;
+      auto shardsArg = std::find( args.begin(), args.end(), "--shards" );
+      if ( shardsArg != args.end() && shardsArg + 1 != args.end() ) shards = std::stoul( *( shardsArg + 1 ) );
+
+      //The calculators and the resolve share the workers, one calculator per worker
+      SchedulerSettings schedulerSettings;
+      auto threadsArg = std::find( args.begin(), args.end(), "--threads" );
+      if ( threadsArg != args.end() && threadsArg + 1 != args.end() ) schedulerSettings.threads = std::stoul( *( threadsArg + 1 ) );
+      schedulerSettings.pinThreads = std::find( args.begin(), args.end(), "--pin" ) != args.end();
+      TaskScheduler scheduler( schedulerSettings );
+      const auto Threads = scheduler.GetThreadCount();
+
+      ConvergenceSettings convergence;
+      auto noiseArg = std::find( args.begin(), args.end(), "--target-noise" );
+      if ( noiseArg != args.end() && noiseArg + 1 != args.end() ) convergence.targetNoise = std::stof( *( noiseArg + 1 ) );
+      ConvergenceTracker tracker( WinWidth * SuperSampling, WinHeight * SuperSampling, SuperSampling, convergence );
+      auto isIterating = true;
+
+      auto formatArg = std::find( args.begin(), args.end(), "--stats-format" );
+      StatsReporter reporter( formatArg != args.end() && formatArg + 1 != args.end() ? ParseStatsFormat( *( formatArg + 1 ) ) : StatsFormat::Json );
+      StatDuration resolveTime;
+      std::ofstream statsFile;
+      auto statsOut = OpenStats( args, statsFile );
+
+      GenomeHandle genome( ffs );
+      std::unique_ptr<GenomeWatcher> watcher;
+      auto genomeArg = std::find( args.begin(), args.end(), "--genome" );
+      if ( genomeArg != args.end() && genomeArg + 1 != args.end() ) watcher = std::make_unique<GenomeWatcher>( *( genomeArg + 1 ) );
+      auto changeArg = std::find( args.begin(), args.end(), "--genome-change" );
+      //The shared histogram keeps the totals of the calculators, which can only be cleared
+      const auto isDecaying = changeArg != args.end() && changeArg + 1 != args.end() && *( changeArg + 1 ) == "decay" && !shards;
+      const auto GenomeDecay = 0.25f;
+      const auto GenomePollInterval = std::chrono::milliseconds( 250 );
+      auto nextGenomePoll = Trace::Clock_t::now() + GenomePollInterval;
+      StatDuration genomeSwapTime;
+
+      std::unique_ptr<SharedHistogram> sharedHistogram;
+      if ( shards ) sharedHistogram = std::make_unique<SharedHistogram>( WinWidth * SuperSampling, WinHeight * SuperSampling, shards );
+
+      std::vector<FlameCalculator::Ptr> calculators;
+      for ( size_t idx = 0; idx < Threads; idx++ )
       {
-         calculators[t]->TakeSnapshot( snapshotHistograms[t] );
+         if ( sharedHistogram )
+         {
+            calculators.push_back( std::make_unique<FlameCalculator>( genome, *sharedHistogram, static_cast<size_t>( SuperSampling ) ) );
+         }
+         else
+         {
+            calculators.push_back(
+               std::make_unique<FlameCalculator>( genome,
+                                                  static_cast<size_t>( WinWidth ),
+                                                  static_cast<size_t>( WinHeight ),
+                                                  static_cast<size_t>( SuperSampling ) ) );
+         }
+         calculators[idx]->Start( scheduler );
+
+         auto calculator = calculators[idx].get();
+         reporter.AddCalculator( "calculator/" + std::to_string( idx ), [calculator]() { return calculator->GetStats(); } );
       }
-      flame::MergeHistograms( snapshotHistograms );
-      snapshotHistograms[0].Resolve( colors.begin(), colors.end(), 2 );
+      reporter.AddDuration( "resolve", resolveTime );
+      reporter.AddDuration( "genome_swap", genomeSwapTime );
+      if ( statsOut ) reporter.Start( *statsOut, std::chrono::seconds( 1 ) );
 
-      auto matPtr = mat.data;
+      //All calculators add their new hits to the same snapshot, so no merging is necessary. Only the tiles that
+      //changed visibly are merged and resolved again
+      FlameHistogram_t snapshotHistogram( WinWidth * SuperSampling, WinHeight * SuperSampling );
+      DirtyTiles changedTiles( WinWidth * SuperSampling, WinHeight * SuperSampling, SuperSampling );
+      const auto MinRelativeTileChange = 1.f / 64;
+      //Genome version of the hits in the snapshot, and when the newest version was published while its first
+      //frame is still missing
+      auto snapshotGenome = genome.GetVersion();
+      auto isSwapPending = false;
+      GenomeHandle::Clock_t::time_point swapPublished;
 
-      for ( auto y = 0; y < WinHeight; y++ )
+      //The frames are resolved in the BGR order of OpenCV, the window shows them without a copy. The window
+      //belongs to the presenter thread, which is the only one that may talk to HighGUI
+      PixelFormat displayFormat;
+      displayFormat.order = ChannelOrder::Bgr;
+      const void* shownFrame = nullptr;
+      FramePipeline pipeline( WinWidth * SuperSampling, WinHeight * SuperSampling, SuperSampling, displayFormat,
+                              [&]( const ImageView& frame )
       {
-         for ( auto x = 0; x < WinWidth; x++ )
+         const auto wndName = "Flames";
+         if ( !shownFrame ) cv::namedWindow( wndName );
+         if ( frame.data != shownFrame )
          {
-            auto& col = colors[y * WinWidth + x];
-            col.CopyToInverse( matPtr );
-            matPtr += bpp;
+            cv::imshow( wndName, cv::Mat( static_cast<int>( frame.height ), static_cast<int>( frame.width ), CV_8UC3, frame.data, frame.stride ) );
+            shownFrame = frame.data;
+         }
+         return cv::waitKey( 100 ) < 0;
+      } );
+
+      for ( auto frame = 1;; frame++ )
+      {
+         FlameFunctionSet edited;
+         if ( watcher && Trace::Clock_t::now() >= nextGenomePoll )
+         {
+            nextGenomePoll = Trace::Clock_t::now() + GenomePollInterval;
+            if ( watcher->Poll( edited ) ) std::cout << "Genome version " << genome.Publish( std::move( edited ) ) << std::endl;
+         }
+
+         //The snapshot moves to a new version once every calculator iterates it, until then the calculators keep
+         //the hits of the new version for later and the window shows the old one
+         const auto version = genome.GetVersion() != snapshotGenome ? genome.Get() : nullptr;
+         if ( version && version->number != snapshotGenome )
+         {
+            if ( !isIterating )
+            {
+               for ( auto& calc : calculators ) calc->Start( scheduler );
+               isIterating = true;
+            }
+            const auto isSwitched = std::all_of( calculators.begin(), calculators.end(),
+                                                 [&]( const FlameCalculator::Ptr& calc ) { return calc->GetGenomeVersion() == version->number; } );
+            if ( isSwitched )
+            {
+               if ( sharedHistogram ) sharedHistogram->Clear();
+               if ( isDecaying ) scheduler.Run( [&]() { snapshotHistogram.Decay( GenomeDecay, Threads + 1 ); } );
+               else snapshotHistogram.Clear();
+               //The noise of the new genome is normalized by its own highest count, not by that of the old one
+               tracker.Reset();
+               snapshotGenome = version->number;
+               swapPublished = version->published;
+               isSwapPending = true;
+            }
+         }
+
+         std::chrono::microseconds maxHandoff( 0 ), totalMerge( 0 );
+         for ( size_t t = 0; t < Threads; t++ )
+         {
+            auto latency = calculators[t]->TakeSnapshot( snapshotHistogram, &changedTiles, MinRelativeTileChange, snapshotGenome );
+            maxHandoff = std::max( maxHandoff, latency.handoff );
+            totalMerge += latency.merge;
+         }
+         const auto hasHits = changedTiles.GetMaxCount() > 0;
+         //The resolve tasks have a higher priority than the iteration, the workers take them after their chunk.
+         //Waits while the presenter still shows the frame before the previous one
+         auto isPresenting = true;
+         {
+            TraceScope trace( "resolve", "render" );
+            const auto resolveStart = Trace::Clock_t::now();
+            scheduler.Run( [&]() { isPresenting = pipeline.Submit( snapshotHistogram, changedTiles, Threads + 1 ); } );
+            resolveTime.Add( Trace::Clock_t::now() - resolveStart );
+         }
+         if ( !isPresenting ) break;
+
+         //The first frame with hits of a new version went to the presenter
+         if ( isSwapPending && hasHits )
+         {
+            const auto latency = Trace::Clock_t::now() - swapPublished;
+            genomeSwapTime.Add( latency );
+            isSwapPending = false;
+            std::cout << "Genome version " << snapshotGenome << " on screen after "
+               << std::chrono::duration_cast<std::chrono::milliseconds>( latency ).count() << "ms" << std::endl;
+         }
+
+         if ( frame % 50 == 0 )
+         {
+            std::cout << "Snapshot: handoff " << maxHandoff.count() << "us, merge " << totalMerge.count() << "us" << std::endl;
+
+            //The changed tiles only cover visible changes, so the noise is estimated over the whole snapshot
+            if ( isIterating && convergence.IsEnabled() )
+            {
+               scheduler.Run( [&]() { tracker.Update( snapshotHistogram, nullptr, Threads + 1 ); } );
+               if ( tracker.IsConverged() )
+               {
+                  for ( auto& calc : calculators ) calc->Stop();
+                  isIterating = false;
+                  std::cout << "Converged at noise " << tracker.GetNoise() << ", press a key to quit" << std::endl;
+               }
+            }
          }
       }
 
-      cv::imshow( wndName, mat );
-      if ( cv::waitKey( 100 ) >= 0 ) break;
+      reporter.Stop();
+      for ( auto& calc : calculators ) calc->Stop();
+
+      return 0;
+   }
+
+   //! \brief Parses a region of output pixels given as x0,y0,x1,y1
+   TileRect ParseRegion( const std::string& value )
+   {
+      TileRect region = { 0, 0, 0, 0 };
+      std::stringstream stream( value );
+      char separator;
+      stream >> region.x0 >> separator >> region.y0 >> separator >> region.x1 >> separator >> region.y1;
+      return region;
+   }
+
+   IterationMode ParseIterationMode( const std::string& name )
+   {
+      if ( name == "scalar" ) return IterationMode::Scalar;
+      if ( name == "batch" ) return IterationMode::Batch;
+      throw std::runtime_error( "Unknown mode '" + name + "', expected scalar or batch" );
+   }
+
+   MathPrecision ParseMathPrecision( const std::string& name )
+   {
+      if ( name == "exact" ) return MathPrecision::Exact;
+      if ( name == "fast" ) return MathPrecision::Fast;
+      throw std::runtime_error( "Unknown precision '" + name + "', expected exact or fast" );
    }
 
-   for ( auto& calc : calculators ) calc->Stop();
+   HugePages ParseHugePages( const std::string& name )
+   {
+      if ( name == "none" ) return HugePages::None;
+      if ( name == "transparent" ) return HugePages::Transparent;
+      if ( name == "explicit" ) return HugePages::Explicit;
+      throw std::runtime_error( "Unknown huge page policy '" + name + "', expected none, transparent or explicit" );
+   }
 
-   return 0;
+   //! \brief Renders without a window, until the sample budget is used up, and writes the result to a file. With
+   //!        --node I/N the process is node I of a distributed render of N nodes, which writes its histogram to the
+   //!        --checkpoint file instead of an image, see RunMerge. --out-of-core keeps the histogram in the --checkpoint
+   //!        file instead of memory, for renders that don't fit into it, and writes PPM images band by band
+   //!        Arguments: --width W --height H --ss S --threads T --pin (--spp N | --iterations N) --mode scalar|batch
+   //!        --shards N --precision exact|fast --seed N --numa-node N --huge-pages none|transparent|explicit
+   //!        --target-noise LEVELS --quantile Q --region X0,Y0,X1,Y1 --stats FILE|- --stats-format json|line
+   //!        --stats-interval MS --depth 8|16|float --checkpoint FILE --checkpoint-interval SECONDS --resume
+   //!        --node I/N --out-of-core --out FILE
+   int RunHeadless( const FlameFunctionSet& ffs, const std::vector<std::string>& args )
+   {
+      RenderSettings settings;
+      std::string outPath = "flame.png";
+      std::string depthName = "8";
+      std::ofstream statsFile;
+      settings.statsOut = OpenStats( args, statsFile );
+      settings.pinThreads = std::find( args.begin(), args.end(), "--pin" ) != args.end();
+      settings.resume = std::find( args.begin(), args.end(), "--resume" ) != args.end();
+      settings.outOfCore = std::find( args.begin(), args.end(), "--out-of-core" ) != args.end();
+      //A typo in a value would otherwise render or benchmark a different configuration than the one asked for
+      try
+      {
+         for ( size_t idx = 0; idx + 1 < args.size(); idx++ )
+         {
+            const auto& arg = args[idx];
+            const auto& value = args[idx + 1];
+            if ( arg == "--width" ) settings.width = std::stoul( value );
+            else if ( arg == "--height" ) settings.height = std::stoul( value );
+            else if ( arg == "--ss" ) settings.superSampling = std::stoul( value );
+            else if ( arg == "--threads" ) settings.threads = std::stoul( value );
+            else if ( arg == "--spp" ) settings.samplesPerPixel = std::stod( value );
+            else if ( arg == "--iterations" ) settings.iterations = std::stoull( value );
+            else if ( arg == "--mode" ) settings.mode = ParseIterationMode( value );
+            else if ( arg == "--shards" ) settings.histogramShards = std::stoul( value );
+            else if ( arg == "--precision" ) settings.precision = ParseMathPrecision( value );
+            else if ( arg == "--seed" ) settings.seed = std::stoull( value );
+            else if ( arg == "--target-noise" ) settings.convergence.targetNoise = std::stof( value );
+            else if ( arg == "--quantile" ) settings.convergence.quantile = std::stof( value );
+            else if ( arg == "--region" ) settings.convergence.region = ParseRegion( value );
+            else if ( arg == "--numa-node" ) settings.memory.numaNode = std::stoi( value );
+            else if ( arg == "--huge-pages" ) settings.memory.hugePages = ParseHugePages( value );
+            else if ( arg == "--stats-format" ) settings.statsFormat = ParseStatsFormat( value );
+            else if ( arg == "--stats-interval" ) settings.statsInterval = std::chrono::milliseconds( std::stoul( value ) );
+            else if ( arg == "--depth" ) depthName = value;
+            else if ( arg == "--checkpoint" ) settings.checkpointPath = value;
+            else if ( arg == "--checkpoint-interval" ) settings.checkpointInterval = std::chrono::seconds( std::stoul( value ) );
+            else if ( arg == "--node" )
+            {
+               char separator;
+               std::stringstream( value ) >> settings.node >> separator >> settings.nodes;
+            }
+            else if ( arg == "--out" ) outPath = value;
+            else continue;
+            idx++;
+         }
+      }
+      catch ( const std::runtime_error& error )
+      {
+         std::cerr << error.what() << std::endl;
+         return 1;
+      }
+      if ( settings.node >= settings.nodes || ( settings.nodes > 1 && settings.checkpointPath.empty() ) )
+      {
+         std::cerr << "--node I/N needs I < N and a --checkpoint file for the histogram" << std::endl;
+         return 1;
+      }
+      if ( settings.outOfCore && settings.checkpointPath.empty() )
+      {
+         std::cerr << "--out-of-core needs a --checkpoint file for the histogram" << std::endl;
+         return 1;
+      }
+      //Out-of-core histograms are resolved from their file, without an image in memory
+      settings.resolve = settings.nodes == 1 && !settings.outOfCore;
+      //The image is written at the end, a depth that its file can't have would throw the render away
+      PixelType depth;
+      try
+      {
+         depth = ParsePixelType( depthName );
+         if ( settings.nodes == 1 ) CheckImageType( outPath, depth );
+      }
+      catch ( const std::runtime_error& error )
+      {
+         std::cerr << error.what() << std::endl;
+         return 1;
+      }
+
+      std::cout << "Rendering " << settings.width << "x" << settings.height << " (SS " << settings.superSampling << ") with "
+         << settings.threads << " threads, " << settings.GetNodeBudget() << " iterations";
+      if ( settings.nodes > 1 ) std::cout << " as node " << settings.node << " of " << settings.nodes;
+      std::cout << std::endl;
+
+      //Resolved straight into the pixel format of the file
+      settings.format = GetImageFormat( outPath, depth );
+      RenderResult result;
+      try
+      {
+         result = RenderHeadless( ffs, settings );
+      }
+      catch ( const HistogramFileError& error )
+      {
+         std::cerr << "Can't resume: " << error.what() << std::endl;
+         return 1;
+      }
+      if ( settings.resolve ) WriteImage( outPath, result.image.GetView() );
+      else if ( settings.nodes == 1 && result.checkpointError.empty() ) ResolveHistogramFile( settings.checkpointPath, outPath, depth, settings.threads );
+      else outPath = settings.checkpointPath;
+
+      if ( result.resumedIterations ) std::cout << "Resumed from " << result.resumedIterations << " iterations" << std::endl;
+      if ( !result.checkpointError.empty() ) std::cerr << "Checkpoint failed: " << result.checkpointError << std::endl;
+
+      std::cout << "Wrote " << outPath << ": " << result.iterations << " iterations in " << result.wallTime.count() << "s, "
+         << result.GetIterationsPerSecond() / 1e6 << "M iterations/s, noise " << result.noise
+         << ( result.isConverged ? " (converged)" : "" ) << std::endl;
+      return 0;
+   }
+
+   //! \brief Sums the histogram files of the nodes of a distributed render and writes the image, see
+   //!        MergeHistogramFiles. Nodes whose files are missing are left out of the image
+   //!        Arguments: --merge FILE... --threads T --depth 8|16|float --merged FILE --out FILE, where --merged
+   //!        writes the merged histogram, which can be resumed like a checkpoint of one node
+   int RunMerge( const std::vector<std::string>& args )
+   {
+      std::vector<std::string> paths;
+      for ( auto arg = std::find( args.begin(), args.end(), "--merge" ) + 1; arg != args.end() && arg->compare( 0, 2, "--" ) != 0; ++arg )
+      {
+         paths.push_back( *arg );
+      }
+      SchedulerSettings schedulerSettings;
+      std::string outPath = "flame.png";
+      std::string mergedPath;
+      std::string depthName = "8";
+      for ( size_t idx = 0; idx + 1 < args.size(); idx++ )
+      {
+         const auto& arg = args[idx];
+         const auto& value = args[idx + 1];
+         if ( arg == "--threads" ) schedulerSettings.threads = std::stoul( value );
+         else if ( arg == "--depth" ) depthName = value;
+         else if ( arg == "--merged" ) mergedPath = value;
+         else if ( arg == "--out" ) outPath = value;
+         else continue;
+         idx++;
+      }
+      PixelType depth;
+      try
+      {
+         depth = ParsePixelType( depthName );
+         CheckImageType( outPath, depth );
+      }
+      catch ( const std::runtime_error& error )
+      {
+         std::cerr << error.what() << std::endl;
+         return 1;
+      }
+
+      TaskScheduler scheduler( schedulerSettings );
+      const auto threads = scheduler.GetThreadCount() + 1;
+      const auto start = std::chrono::high_resolution_clock::now();
+      HistogramFileInfo info;
+      std::unique_ptr<FlameHistogram_t> histogram;
+      try
+      {
+         const auto nodes = paths.empty() ? 0 : ReadHistogramFileInfo( paths[0] ).nodes;
+         scheduler.Run( [&]() { histogram = std::make_unique<FlameHistogram_t>( MergeHistogramFiles( paths, info, threads ) ); } );
+         if ( paths.size() < nodes ) std::cerr << "Merged " << paths.size() << " of " << nodes << " nodes" << std::endl;
+         if ( !mergedPath.empty() ) WriteHistogramFile( mergedPath, *histogram, info );
+      }
+      catch ( const HistogramFileError& error )
+      {
+         std::cerr << "Can't merge: " << error.what() << std::endl;
+         return 1;
+      }
+      const std::chrono::duration<double> mergeTime = std::chrono::high_resolution_clock::now() - start;
+
+      ImageBuffer image( info.width / info.superSampling, info.height / info.superSampling, GetImageFormat( outPath, depth ) );
+      scheduler.Run( [&]() { histogram->Resolve( image.GetView(), info.superSampling, threads ); } );
+      WriteImage( outPath, image.GetView() );
+      std::cout << "Wrote " << outPath << ": " << paths.size() << " histograms of " << info.iterations << " iterations merged in "
+         << mergeTime.count() << "s" << std::endl;
+      return 0;
+   }
+}
+
+int main( int argc, char** argv )
+{
+   std::vector<std::string> args( argv + 1, argv + argc );
+   auto findValue = [&]( const char* name ) -> const std::string*
+   {
+      auto arg = std::find( args.begin(), args.end(), name );
+      return arg != args.end() && arg + 1 != args.end() ? &*( arg + 1 ) : nullptr;
+   };
+
+   //--genome FILE renders a genome or flam3 file instead of the demo genome. --symmetry functions puts the
+   //symmetries of the demo genome into the chaos game instead of plotting every hit once per symmetry
+   FlameFunctionSet ffs;
+   if ( auto genomePath = findValue( "--genome" ) )
+   {
+      try
+      {
+         ffs = LoadGenome( *genomePath );
+      }
+      catch ( const GenomeError& error )
+      {
+         std::cerr << error.what() << std::endl;
+         return 1;
+      }
+   }
+   else
+   {
+      auto symmetry = findValue( "--symmetry" );
+      ffs = MakeDemoGenome( symmetry && *symmetry == "functions" ? SymmetryMode::Functions : SymmetryMode::Plot );
+   }
+
+   //--write-genome FILE saves the genome, to start a new genome file from the demo or to convert a flam3 file
+   if ( auto writePath = findValue( "--write-genome" ) )
+   {
+      std::ofstream file( *writePath );
+      WriteGenome( file, ffs );
+      return file ? 0 : 1;
+   }
+
+   //--trace FILE records a timeline of the chunks, snapshots and resolves for chrome://tracing or Perfetto
+   auto tracePath = findValue( "--trace" );
+   if ( tracePath ) Trace::Enable( true );
+
+   const auto isHeadless = std::find( args.begin(), args.end(), "--headless" ) != args.end();
+   const auto isMerge = std::find( args.begin(), args.end(), "--merge" ) != args.end();
+   const auto result = isMerge ? RunMerge( args ) : isHeadless ? RunHeadless( ffs, args ) : RunInteractive( ffs, args );
+
+   if ( tracePath )
+   {
+      std::ofstream file( *tracePath );
+      Trace::Write( file );
+   }
+   return result;
 }